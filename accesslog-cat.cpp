@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <iostream>
+#include <string>
+#include "binlog.h"
+
+using namespace std;
+
+/** Output buffer size */
+#define OUTPUT_BUFFER  (1 << 20)
+
+/** Decode binary domain log to standard output
+ *
+ * @param path Binary domain log path.
+ *
+ * @return True on success.
+ *
+ */
+static bool decode_file(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_LARGEFILE);
+	if (fd < 0) {
+		cerr << "Unable to open " << path << ": " << strerror(errno) << endl;
+		return false;
+	}
+	
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		cerr << "Unable to stat " << path << ": " << strerror(errno) << endl;
+		close(fd);
+		return false;
+	}
+	
+	size_t size = st.st_size;
+	if (size == 0) {
+		close(fd);
+		return true;
+	}
+	
+	void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	
+	if (addr == MAP_FAILED) {
+		cerr << "Unable to map " << path << ": " << strerror(errno) << endl;
+		return false;
+	}
+	
+	madvise(addr, size, MADV_SEQUENTIAL);
+	
+	const uint8_t *data = (const uint8_t *) addr;
+	binlog_decoder_t *decoder = new binlog_decoder_t;
+	binlog_decoder_init(*decoder);
+	
+	string line;
+	size_t pos = 0;
+	bool ok = true;
+	
+	while (pos < size) {
+		ssize_t consumed = binlog_decode(*decoder, data + pos, size - pos,
+		    line);
+		
+		if (consumed <= 0) {
+			cerr << path << ": " << ((consumed == 0) ? "Truncated" :
+			    "Invalid") << " record at offset " << pos << endl;
+			ok = false;
+			break;
+		}
+		
+		fwrite(line.c_str(), 1, line.length(), stdout);
+		putchar('\n');
+		
+		pos += consumed;
+	}
+	
+	delete decoder;
+	munmap(addr, size);
+	
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		cerr << "Usage: " << argv[0] << " file" BINLOG_SUFFIX " ..." << endl;
+		cerr << endl;
+		cerr << "Print the binary domain logs as text." << endl;
+		return 1;
+	}
+	
+	setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER);
+	
+	bool ok = true;
+	for (int i = 1; i < argc; i++) {
+		if (!decode_file(argv[i]))
+			ok = false;
+	}
+	
+	return ok ? 0 : 1;
+}
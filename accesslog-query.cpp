@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "index.h"
+#include "util.h"
+
+using namespace std;
+
+/** Default slack for the entries out of order (seconds) */
+#define QUERY_SLACK  300
+
+/** Length of the Apache timestamp (without the brackets) */
+#define TIMESTAMP_LENGTH  26
+
+/** Decode decimal digits
+ *
+ * @param str    Digits.
+ * @param length Number of digits.
+ * @param val    Decoded value.
+ *
+ * @return True on success.
+ *
+ */
+static bool digits_decode(const char *str, size_t length, long int &val)
+{
+	val = 0;
+	
+	for (size_t i = 0; i < length; i++) {
+		if ((str[i] < '0') || (str[i] > '9'))
+			return false;
+		
+		val = val * 10 + (str[i] - '0');
+	}
+	
+	return true;
+}
+
+/** Find time of log entry
+ *
+ * The first bracketed part of the entry is expected
+ * to be the Apache timestamp (%t), i.e.
+ * [DD/Mon/YYYY:HH:MM:SS +ZZZZ].
+ *
+ * @param line   Log entry.
+ * @param length Length of the log entry.
+ * @param epoch  Time of the log entry (Unix time).
+ *
+ * @return True on success.
+ *
+ */
+static bool entry_time(const char *line, size_t length, int64_t &epoch)
+{
+	static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	
+	const char *open = (const char *) memchr(line, '[', length);
+	if ((open == NULL) ||
+	    ((size_t) (line + length - open) < TIMESTAMP_LENGTH + 2))
+		return false;
+	
+	const char *time = open + 1;
+	datetime res;
+	
+	res.month = 0;
+	for (unsigned int i = 0; i < 12; i++) {
+		if (memcmp(time + 3, months + 3 * i, 3) == 0)
+			res.month = i + 1;
+	}
+	
+	if ((res.month == 0) ||
+	    (!digits_decode(time, 2, res.day)) ||
+	    (!digits_decode(time + 7, 4, res.year)) ||
+	    (!digits_decode(time + 12, 2, res.hour)) ||
+	    (!digits_decode(time + 15, 2, res.minute)) ||
+	    (!digits_decode(time + 18, 2, res.second)) ||
+	    (!digits_decode(time + 22, 4, res.offset)))
+		return false;
+	
+	if (time[21] == '-')
+		res.offset = -res.offset;
+	
+	epoch = datetime_epoch(res);
+	return true;
+}
+
+/** Parse time argument
+ *
+ * @param arg   Local time (YYYY-MM-DD HH:MM[:SS]) or
+ *              Unix time prefixed by '@'.
+ * @param epoch Parsed time (Unix time).
+ *
+ * @return True on success.
+ *
+ */
+static bool parse_time(const char *arg, int64_t &epoch)
+{
+	if (arg[0] == '@') {
+		char *err;
+		epoch = strtoll(arg + 1, &err, 10);
+		return ((arg[1] != 0) && (*err == 0));
+	}
+	
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	
+	const char *end = strptime(arg, "%Y-%m-%d %H:%M:%S", &tm);
+	if ((end == NULL) || (*end != 0)) {
+		memset(&tm, 0, sizeof(tm));
+		
+		end = strptime(arg, "%Y-%m-%d %H:%M", &tm);
+		if ((end == NULL) || (*end != 0))
+			return false;
+	}
+	
+	tm.tm_isdst = -1;
+	epoch = mktime(&tm);
+	return true;
+}
+
+/** Find where to start reading the domain log
+ *
+ * @param log_path Domain log path.
+ * @param from     Start of the range (including the slack).
+ *
+ * @return Offset of the last indexed entry before the range
+ *         (0 if there is no index).
+ *
+ */
+static uint64_t find_start(const string &log_path, int64_t from)
+{
+	int fd = open((log_path + INDEX_SUFFIX).c_str(), O_RDONLY | O_LARGEFILE);
+	if (fd < 0) {
+		cerr << "No index for " << log_path << ", reading whole log" << endl;
+		return 0;
+	}
+	
+	uint64_t offset = 0;
+	index_record_t records[1024];
+	ssize_t size;
+	
+	while ((size = read(fd, records, sizeof(records))) > 0) {
+		size_t count = size / sizeof(index_record_t);
+		
+		for (size_t i = 0; i < count; i++) {
+			if (records[i].time > from)
+				continue;
+			
+			if (records[i].offset > offset)
+				offset = records[i].offset;
+		}
+	}
+	
+	close(fd);
+	return offset;
+}
+
+/** Print usage information
+ *
+ * @param name Program name.
+ *
+ */
+static void usage(const char *name)
+{
+	cerr << "Usage: " << name << " [options] log from to" << endl;
+	cerr << endl;
+	cerr << "Print the entries of the domain log in the time range [from, to)."
+	    << endl;
+	cerr << "Times are local (YYYY-MM-DD HH:MM[:SS]) or Unix time (@N)." <<
+	    endl;
+	cerr << endl;
+	cerr << "  -s, --slack=SECONDS  Allowed disorder of the entries (default: "
+	    << QUERY_SLACK << ")" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option options[] = {
+		{ "slack", required_argument, NULL, 's' },
+		{ NULL, 0, NULL, 0 }
+	};
+	
+	int64_t slack = QUERY_SLACK;
+	
+	int opt;
+	while ((opt = getopt_long(argc, argv, "s:", options, NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			slack = atoll(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	
+	if (argc - optind != 3) {
+		usage(argv[0]);
+		return 1;
+	}
+	
+	string log_path = argv[optind];
+	int64_t from;
+	int64_t to;
+	
+	if ((!parse_time(argv[optind + 1], from)) ||
+	    (!parse_time(argv[optind + 2], to))) {
+		usage(argv[0]);
+		return 1;
+	}
+	
+	FILE *log = fopen(log_path.c_str(), "r");
+	if (log == NULL) {
+		cerr << "Unable to open " << log_path << ": " << strerror(errno) <<
+		    endl;
+		return 1;
+	}
+	
+	if (fseeko(log, find_start(log_path, from - slack), SEEK_SET) != 0) {
+		cerr << "Unable to seek in " << log_path << endl;
+		fclose(log);
+		return 1;
+	}
+	
+	char *line = NULL;
+	size_t capacity = 0;
+	ssize_t length;
+	
+	while ((length = getline(&line, &capacity, log)) > 0) {
+		int64_t epoch;
+		if (!entry_time(line, length, epoch))
+			continue;
+		
+		/* Past the range (even with the slack) */
+		if (epoch >= to + slack)
+			break;
+		
+		if ((epoch >= from) && (epoch < to))
+			fwrite(line, 1, length, stdout);
+	}
+	
+	free(line);
+	fclose(log);
+	return 0;
+}
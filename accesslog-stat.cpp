@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sched.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "aggregate.h"
+#include "stats.h"
+
+using namespace std;
+
+/** Directory where the shared memory segments live */
+static const string shm_dir = "/dev/shm";
+
+/** Short names of the error classes */
+static const char *error_names[ERROR_CLASSES] = ERROR_CLASS_NAMES;
+
+/** Take a consistent snapshot of the segment
+ *
+ * @param segment  Mapped statistics segment.
+ * @param snapshot Where to store the snapshot.
+ *
+ */
+static void snapshot_segment(const stats_segment_t *segment,
+    stats_segment_t &snapshot)
+{
+	while (true) {
+		uint64_t seq = __atomic_load_n(&segment->seq.value,
+		    __ATOMIC_ACQUIRE);
+		
+		/* Writer in progress */
+		if ((seq & 1) != 0) {
+			sched_yield();
+			continue;
+		}
+		
+		memcpy((void *) &snapshot, (const void *) segment,
+		    sizeof(stats_segment_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		
+		if (__atomic_load_n(&segment->seq.value, __ATOMIC_RELAXED) == seq)
+			return;
+	}
+}
+
+/** Print statistics of a single accesslog process
+ *
+ * @param name Shared memory segment name (without the leading slash).
+ *
+ * @return True if the statistics have been printed.
+ *
+ */
+static bool print_segment(const string &name)
+{
+	int fd = shm_open((string("/") + name).c_str(), O_RDONLY, 0);
+	if (fd < 0) {
+		cerr << name << ": " << strerror(errno) << endl;
+		return false;
+	}
+	
+	struct stat st;
+	if ((fstat(fd, &st) != 0) ||
+	    (st.st_size < (off_t) sizeof(stats_segment_t))) {
+		cerr << name << ": Not a statistics segment" << endl;
+		close(fd);
+		return false;
+	}
+	
+	void *addr = mmap(NULL, sizeof(stats_segment_t), PROT_READ,
+	    MAP_SHARED, fd, 0);
+	close(fd);
+	
+	if (addr == MAP_FAILED) {
+		cerr << name << ": " << strerror(errno) << endl;
+		return false;
+	}
+	
+	const stats_segment_t *segment = (const stats_segment_t *) addr;
+	if ((__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC) ||
+	    (segment->version != STATS_VERSION) ||
+	    (segment->size != sizeof(stats_segment_t))) {
+		cerr << name << ": Incompatible statistics segment" << endl;
+		munmap(addr, sizeof(stats_segment_t));
+		return false;
+	}
+	
+	stats_segment_t *snapshot = new stats_segment_t;
+	snapshot_segment(segment, *snapshot);
+	munmap(addr, sizeof(stats_segment_t));
+	
+	bool alive = (kill(snapshot->pid, 0) == 0) || (errno == EPERM);
+	
+	cout << "pid: " << snapshot->pid << (alive ? "" : " (stale)") << endl;
+	cout << "started: " << snapshot->started << endl;
+	cout << "lines: " << snapshot->lines.value << endl;
+	cout << "routed: " << snapshot->routed.value << endl;
+	cout << "dropped: " << snapshot->dropped.value << endl;
+	cout << "diverted: " << snapshot->diverted.value << endl;
+	cout << "bots: " << snapshot->bots.value << endl;
+	cout << "throttled: " << snapshot->throttled.value << endl;
+	cout << "failed: " << snapshot->failed.value << endl;
+	cout << "errors: " << snapshot->errors.value << endl;
+	
+	for (unsigned int i = 0; i < ERROR_CLASSES; i++)
+		cout << "errors-" << error_names[i] << ": " <<
+		    snapshot->error_classes[i].value << endl;
+	
+	cout << "drops: " << snapshot->drops.value << endl;
+	cout << "backlog: " << snapshot->backlog.value << endl;
+	cout << "updated: " << snapshot->updated.value << endl;
+	
+	uint64_t interval = snapshot->interval.value;
+	uint64_t count = snapshot->top_count.value;
+	if (count > STATS_TOP_DOMAINS)
+		count = STATS_TOP_DOMAINS;
+	
+	for (uint64_t i = 0; i < count; i++) {
+		const stats_domain_t &top = snapshot->top[i];
+		string domain(top.domain, strnlen(top.domain,
+		    STATS_DOMAIN_LENGTH));
+		
+		uint64_t lines_rate = 0;
+		uint64_t bytes_rate = 0;
+		if (interval > 0) {
+			lines_rate = top.lines * 1000 / interval;
+			bytes_rate = top.bytes * 1000 / interval;
+		}
+		
+		cout << "top: " << domain << " " << lines_rate << " lines/s " <<
+		    bytes_rate << " bytes/s" << endl;
+	}
+	
+	delete snapshot;
+	return true;
+}
+
+/** Print JSON array of counters
+ *
+ * @param name   Array name.
+ * @param values Counters.
+ * @param count  Number of counters.
+ *
+ */
+static void print_array(const char *name, const uint64_t *values,
+    size_t count)
+{
+	cout << ", \"" << name << "\": [";
+	
+	for (size_t i = 0; i < count; i++) {
+		if (i > 0)
+			cout << ", ";
+		
+		cout << values[i];
+	}
+	
+	cout << "]";
+}
+
+/** Print monthly domain summary as JSON
+ *
+ * @param path Summary file path.
+ *
+ * @return True if the summary has been printed.
+ *
+ */
+static bool print_summary(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		cerr << path << ": " << strerror(errno) << endl;
+		return false;
+	}
+	
+	aggregate_record_t record;
+	uint8_t registers[HLL_REGISTERS];
+	
+	ssize_t count = read(fd, &record, sizeof(record));
+	if ((count != sizeof(record)) || (record.magic != AGGREGATE_MAGIC) ||
+	    (record.version > AGGREGATE_VERSION)) {
+		cerr << path << ": Not a summary file" << endl;
+		close(fd);
+		return false;
+	}
+	
+	if ((record.version < 2) ||
+	    (read(fd, registers, HLL_REGISTERS) != HLL_REGISTERS))
+		memset(registers, 0, HLL_REGISTERS);
+	
+	close(fd);
+	
+	cout << "{\"hits\": " << record.hits << ", \"bytes\": " <<
+	    record.bytes << ", \"visitors\": " << hll_estimate(registers);
+	print_array("status", record.status, AGGREGATE_STATUS_CLASSES);
+	print_array("days", record.days, 31);
+	print_array("hours", record.hours, 24);
+	cout << "}" << endl;
+	
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	bool summaries = false;
+	
+	int opt;
+	while ((opt = getopt(argc, argv, "s")) != -1) {
+		switch (opt) {
+		case 's':
+			summaries = true;
+			break;
+		default:
+			cerr << "Usage: " << argv[0] << " [pid ...]" << endl;
+			cerr << "       " << argv[0] << " -s summary ..." << endl;
+			return 1;
+		}
+	}
+	
+	if (summaries) {
+		int ret = 0;
+		
+		for (int i = optind; i < argc; i++) {
+			if (!print_summary(argv[i]))
+				ret = 1;
+		}
+		
+		return ret;
+	}
+	
+	vector< string> names;
+	
+	if (optind < argc) {
+		/* Explicit list of PIDs */
+		for (int i = optind; i < argc; i++)
+			names.push_back(string(STATS_NAME + 1) + argv[i]);
+	} else {
+		/* All segments */
+		DIR *dir = opendir(shm_dir.c_str());
+		if (dir == NULL) {
+			cerr << shm_dir << ": " << strerror(errno) << endl;
+			return 1;
+		}
+		
+		struct dirent *dirent;
+		while ((dirent = readdir(dir)) != NULL) {
+			if (strncmp(dirent->d_name, STATS_NAME + 1,
+			    strlen(STATS_NAME + 1)) == 0)
+				names.push_back(dirent->d_name);
+		}
+		
+		closedir(dir);
+	}
+	
+	int ret = 0;
+	
+	for (vector< string>::const_iterator it = names.begin();
+	    it != names.end(); ++it) {
+		if (it != names.begin())
+			cout << endl;
+		
+		if (!print_segment(*it))
+			ret = 1;
+	}
+	
+	return ret;
+}
@@ -28,38 +28,68 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <getopt.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <iostream>
 #include <sstream>
 #include <vector>
 #include <string>
-#include <boost/tokenizer.hpp>
 #include <boost/regex.hpp>
+#include "aggregate.h"
+#include "anonymize.h"
+#include "binlog.h"
+#include "columns.h"
+#include "bots.h"
+#include "domains.h"
+#include "errors.h"
+#include "filter.h"
+#include "forward.h"
+#include "index.h"
+#include "inputs.h"
+#include "json.h"
+#include "logdir.h"
+#include "logformat.h"
+#include "psl.h"
+#include "quota.h"
+#include "reader.h"
+#include "rollup.h"
+#include "stats.h"
+#include "subscribe.h"
+#include "topk.h"
+#include "util.h"
 
 using namespace std;
 using namespace boost;
 
-/** Parts of domain name */
-typedef vector< string> domain_vector;
+typedef enum {
+	DATETIME_OK,
+	DATETIME_MISSING,
+	DATETIME_INVALID
+} datetime_status; /**< Date & time extraction result */
 
-/** Character list separator */
-typedef char_separator< char> separator_type;
+typedef enum {
+	DESTINATION_DOMAIN,
+	DESTINATION_DIVERTED,
+	DESTINATION_BOTS,
+	DESTINATIONS
+} destination_t; /**< Destination of a log entry */
 
-/** Character list tokenizer */
-typedef tokenizer< separator_type> tokenizer_type;
+/** Suffixes of the destinations (appended to the domain log path) */
+static const char *destination_suffixes[DESTINATIONS] = {
+	"",
+	FILTER_DIVERT_SUFFIX,
+	BOTS_SUFFIX
+};
 
-typedef struct {
-	long int year;
-	long int month;
-	long int day;
-	
-	long int hour;
-	long int minute;
-	long int second;
-	
-	long int offset;
-} datetime; /**< Date & time entry */
+/** Maximal wait for input before the periodic tasks are run (ms) */
+#define TICK_INTERVAL  1000
 
 /** Basic prefix of the domain directories */
 static const string prefix = "/home/httpd";
@@ -67,75 +97,44 @@ static const string prefix = "/home/httpd";
 /** Basic suffix for the domain directories */
 static string suffix = "";
 
+/** Compiled log format */
+static logformat_t format;
+
+/** Store the domain logs in the binary format */
+static bool binary = false;
+
+/** Store bot traffic also to the domain log */
+static bool bots_copy = false;
+
+/** Termination requested */
+static volatile sig_atomic_t terminated = 0;
+
 /** Decode integer from string (base 10)
- *
- * Throws invalid_argument on invalid
- * numerical string.
  *
  * @param decimal String to decode.
+ * @param val     Decoded integer.
  *
- * @return Decoded integer.
+ * @return True on success.
+ * @return False on invalid numerical string.
  *
  */
-static long int decDecode(const string &decimal)
+static bool decDecode(const string &decimal, long int &val)
 {
 	char *err;
 	
-	long int val = strtol(decimal.c_str(), &err, 10);
+	val = strtol(decimal.c_str(), &err, 10);
 	if ((err == NULL) || (*err != (char) 0))
-		throw invalid_argument("Not an integer");
+		return false;
 	
-	return val;
-}
-
-/** Encode integer to string (base 10)
- *
- *
- * @param value Integer to encode.
- *
- * @return Encoded string.
- *
- */
-static string decEncode(const long int value)
-{
-	ostringstream stream;
-	
-	stream << value;
-	return stream.str();
-}
-
-/** Add leading zeroes to the string
- *
- * If the first character is not a digit then no leading zeroes
- * are added to the string.
- *
- * @param str String to add leading zeroes to.
- * @param num Number of leading zeroes (default: 2).
- *
- * @return String with leading zeroes.
- *
- */
-static string leadzero(const string &str, const unsigned int num = 2)
-{
-	/* First character is not a digit */
-	if ((str.length() > 0) && ((str[0] < '0') || (str[0] > '9')))
-		return str;
-	
-	string ret = str;
-	while (ret.length() < num)
-		ret = string("0") + ret;
-	
-	return ret;
+	return true;
 }
 
 /** Decode month number from abbreviation
- *
- * Throws invalid_argument on invalid
- * month abbreviation.
  *
  * @param month Month abbreviation.
  *
  * @return Month number (1-based).
+ * @return 0 on invalid month abbreviation.
  *
  */
 static long int monthDecode(const string &month)
@@ -176,38 +175,15 @@ static long int monthDecode(const string &month)
 	if (month == "Dec")
 		return 12;
 	
-	throw invalid_argument("Invalid month '" + month + "'");
-}
-
-/** Get first occurence of a character
- *
- * @param str   String to search in.
- * @param delim Character to search.
- * @param start Index to start searching from (default: 0).
- *
- * @return Index of the first occurence of the delimiting
- *         character.
- * @return Length of the string if the delimiting character
- *         is not found.
- *
- */
-static string::size_type find_first(const string &str, const char delim,
-    const string::size_type start = 0)
-{
-	for (string::size_type pos = start; pos < str.length(); pos++) {
-		/* Found 'delim' */
-		if (str[pos] == delim)
-			return pos;
-	}
-	
-	return str.length();
+	return 0;
 }
 
 /** Find first non-occurence of a character
  *
- * @param str   String to search in.
- * @param until Character to avoid.
- * @param start Index to start searching from (default: 0).
+ * @param str    String to search in.
+ * @param length Length of the string.
+ * @param until  Character to avoid.
+ * @param start  Index to start searching from (default: 0).
  *
  * @return Index of the first occurence of a character different
  *         from the character we want to avoid.
@@ -215,191 +191,509 @@ static string::size_type find_first(const string &str, const char delim,
  *         of the character we want to avoid.
  *
  */
-static string::size_type find_until(const string &str, const char until,
-    const string::size_type start = 0)
+static size_t find_until(const char *str, size_t length, const char until,
+    const size_t start = 0)
 {
-	for (string::size_type pos = start; pos < str.length(); pos++) {
+	for (size_t pos = start; pos < length; pos++) {
 		/* Found character which is not 'until' */
 		if (str[pos] != until)
 			return pos;
 	}
 	
-	return str.length();
+	return length;
 }
 
-/** Split domain name into parts
+/** Extract date & time from log entry
  *
- * @param domain Domain name to tokenize.
+ * @param time   Date & time field of the log entry
+ *               (NULL if not present).
+ * @param length Length of the date & time field.
+ * @param res    Decoded date & time.
  *
- * @return Tokenized domain name.
+ * @return DATETIME_OK on success.
+ * @return DATETIME_MISSING if there is no date & time field.
+ * @return DATETIME_INVALID on invalid or incomplete date & time.
  *
  */
-static domain_vector split_domain(const string &domain)
+static datetime_status extract_datetime(const char *time, size_t length,
+    datetime &res)
 {
-	domain_vector vector;
+	if (time == NULL)
+		return DATETIME_MISSING;
 	
-	/* Split string by '.' character */
-	separator_type separator(".", "", keep_empty_tokens);
-	tokenizer_type domain_tokens(domain, separator);
+	/* Date & time signature: [DD/Mon/YYYY:HH:MM:SS +off] */
+	if ((length != 28) || (time[0] != '[') || (time[3] != '/') ||
+	    (time[7] != '/') || (time[12] != ':') || (time[15] != ':') ||
+	    (time[18] != ':') || (time[21] != ' ') || (time[27] != ']'))
+		return DATETIME_INVALID;
 	
-	for (tokenizer_type::iterator it = domain_tokens.begin();
-	    it != domain_tokens.end(); ++it)
-		vector.push_back(*it);
+	/* Day */
+	if (!decDecode(string(time + 1, 2), res.day))
+		return DATETIME_INVALID;
 	
-	return vector;
-}
-
-/** Extract date & time from log entry
- *
- * Throws invalid_argument on invalid
- * or no date & time signature.
- *
- * @param entry Date & time log entry.
- *
- * @return Decoded date & time.
- *
- */
-static datetime extract_datetime(const string &entry)
-{
-	/* Date & time signature: [DD-Mon-YYYY:HH:MM:SS +off] */
-	regex expression("\\[../.../....:..:..:.. .....\\]");
+	/* Month */
+	res.month = monthDecode(string(time + 4, 3));
+	if (res.month == 0)
+		return DATETIME_INVALID;
 	
-	string::const_iterator begin = entry.begin();
-	string::const_iterator end = entry.end();
-	match_results< string::const_iterator> match;
+	/* Year */
+	if (!decDecode(string(time + 8, 4), res.year))
+		return DATETIME_INVALID;
 	
-	datetime res;
-	bool valid = false;
+	/* Hour */
+	if (!decDecode(string(time + 13, 2), res.hour))
+		return DATETIME_INVALID;
 	
-	/* Regexp match */
-	if (regex_search(begin, end, match, expression, match_default)) {
-		string datetime = match[0];
-		
-		/* Split match by all separating characters */
-		separator_type separator("[/: ]", "", drop_empty_tokens);
-		tokenizer_type datetime_tokens(datetime, separator);
-		
-		unsigned int pos = 0;
-		for (tokenizer_type::iterator it = datetime_tokens.begin();
-		    it != datetime_tokens.end(); ++it, pos++) {
-			switch (pos) {
-			case 0:  /* Day */
-				res.day = decDecode(*it);
-				break;
-			case 1:  /* Month */
-				res.month = monthDecode(*it);
-				break;
-			case 2: /* Year */
-				res.year = decDecode(*it);
-				break;
-			case 3: /* Hour */
-				res.hour = decDecode(*it);
-				break;
-			case 4: /* Minute */
-				res.minute = decDecode(*it);
-				break;
-			case 5: /* Second */
-				res.second = decDecode(*it);
-				break;
-			case 6: /* Offset */
-				res.offset = decDecode(*it);
-				valid = true;
-				break;
-			default:
-				throw invalid_argument("Invalid date & time format");
-			}
-		}
-	}
+	/* Minute */
+	if (!decDecode(string(time + 16, 2), res.minute))
+		return DATETIME_INVALID;
 	
-	if (valid)
-		return res;
+	/* Second */
+	if (!decDecode(string(time + 19, 2), res.second))
+		return DATETIME_INVALID;
 	
-	throw invalid_argument("Date & time not found or not complete");
+	/* Offset */
+	if (!decDecode(string(time + 22, 5), res.offset))
+		return DATETIME_INVALID;
+	
+	return DATETIME_OK;
 }
 
-/** Long write (wrapper for write(2))
+/** Append log entry to a log file
+ *
+ * @param dir    Month directory of the log file.
+ * @param name   Log file name.
+ * @param access Log entry (without the trailing newline).
+ * @param offset Where to store the offset of the entry
+ *               in the log file (NULL if not needed).
  *
- * @param fd    File descriptor.
- * @param buf   Data to write.
- * @param count Number of bytes to write.
+ * @return True if the log file was opened.
  *
  */
-static void write_long(int fd, const void *buf, size_t count)
+static bool append_entry(logdir_t *dir, const string &name,
+    const string &access, uint64_t *offset)
 {
-	size_t total = count;
-	
-	while (total > 0) {
-		ssize_t written = write(fd, buf, total);
-		
-		if (written < 0)
-			return;
-		
-		total -= written;
-		buf = (void *) (((char *) buf) + written);
+	int fd = logdir_open(dir, name, O_APPEND);
+	if (fd < 0)
+		return false;
+	
+	/* The only writer, thus the entry is appended right here */
+	if (offset != NULL)
+		*offset = lseek(fd, 0, SEEK_END);
+	
+	/* The entry and the newline by a single system call */
+	struct iovec iov[2];
+	iov[0].iov_base = (void *) access.c_str();
+	iov[0].iov_len = access.length();
+	iov[1].iov_base = (void *) "\n";
+	iov[1].iov_len = 1;
+	
+	ssize_t written = writev(fd, iov, 2);
+	if ((written >= 0) && ((size_t) written <= access.length())) {
+		write_long(fd, access.c_str() + written, access.length() - written);
+		write_long(fd, "\n", 1);
 	}
+	
+	close(fd);
+	
+	return true;
 }
 
 /** Process log entry and store to domain log
  *
- * @param entry Log entry to process.
+ * @param entry        Log entry to process.
+ * @param size         Length of the log entry.
+ * @param index        Structural index of the block containing the
+ *                     log entry.
+ * @param offset       Offset of the log entry within the block.
+ * @param input_suffix Suffix of the domain directories.
  *
  */
-static void process_entry(const string &entry)
+static void process_entry(const char *entry, size_t size,
+    const strindex_t &index, size_t offset, const string &input_suffix)
 {
 	/* Ignore leading spaces */
-	string::size_type domain_start = find_until(entry, ' ');
+	size_t entry_start = find_until(entry, size, ' ');
 	
-	/* Find domain name end */
-	string::size_type domain_end = find_first(entry, ' ', domain_start);
+	const char *line = entry + entry_start;
+	size_t length = size - entry_start;
 	
-	/* Ignore leading spaces in log entry */
-	string::size_type log_start = find_until(entry, ' ', domain_end);
+	log_fields_t fields;
+	logformat_parse(format, line, length, &index, offset + entry_start,
+	    fields);
+	
+	const field_span_t &vhost = fields.field[FIELD_VHOST];
 	
 	/* Domain name is not empty */
-	if ((log_start < entry.length()) && (domain_start < domain_end)) {
-		string domain =
-		    entry.substr(domain_start, domain_end - domain_start);
-		domain_vector domain_parts = split_domain(domain);
+	if ((vhost.start != FIELD_ABSENT) && (vhost.length > 0) &&
+	    (fields.payload < length)) {
+		domain_t *interned = domains_intern(line + vhost.start,
+		    vhost.length);
+		const string &domain = interned->name;
 		
 		/* Domain name has two or more parts */
-		if (domain_parts.size() >= 2) {
-			string access = entry.substr(log_start);
-			datetime log_time = extract_datetime(access);
+		if (!interned->sld.empty()) {
+			const field_span_t &time = fields.field[FIELD_TIME];
+			datetime log_time;
+			
+			switch (extract_datetime(field_present(fields, FIELD_TIME) ?
+			    line + time.start : NULL, time.length, log_time)) {
+			case DATETIME_OK:
+				break;
+			case DATETIME_MISSING:
+				error_report(ERROR_NO_DATETIME, entry, size, NULL);
+				return;
+			case DATETIME_INVALID:
+				error_report(ERROR_DATETIME, entry, size, NULL);
+				return;
+			}
+			
+			filter_action_t action = filter_entry(line, fields, domain);
+			if (action == FILTER_DROP) {
+				stats_dropped();
+				return;
+			}
+			
+			/* Destinations of the log entry */
+			unsigned int route;
+			
+			if (action == FILTER_DIVERT)
+				route = 1 << DESTINATION_DIVERTED;
+			else if (bots_entry(line, fields))
+				route = (1 << DESTINATION_BOTS) |
+				    (bots_copy ? (1 << DESTINATION_DOMAIN) : 0);
+			else
+				route = 1 << DESTINATION_DOMAIN;
+			
+			/* Reserve space for rewriting the entry in place */
+			string access;
+			access.reserve(length - fields.payload + ANONYMIZE_SLACK);
+			access.assign(line + fields.payload, length - fields.payload);
+			
+			/*
+			 * All the per-domain outputs below read the entry
+			 * as stored, thus none of them sees the original
+			 * client address of an anonymized domain
+			 */
+			logformat_rebase(fields);
+			anonymize_entry(interned, fields, access);
+			
+			/* Over-quota entries are not stored */
+			if (!quota_entry(interned->sld, access.length() + 1))
+				return;
 			
 			/*
 			 * Domain log path is
-			 * ${PREFIX}/${2ND_LEVEL_DOMAIN}/logs/${YYYY}-${MM}/${DOMAIN}${SUFFIX}
+			 * ${PREFIX}/${2ND_LEVEL_DOMAIN}/logs/${YYYY}-${MM}${SUFFIX}/${DOMAIN}
 			 */
-			string log_dir = prefix +
-			    string("/") + domain_parts[domain_parts.size() - 2] +
-			    string(".") + domain_parts[domain_parts.size() - 1] +
-			    string("/logs/") + leadzero(decEncode(log_time.year), 4) +
-			    string("-") + leadzero(decEncode(log_time.month)) +
-			    suffix;
+			if (!domains_locate(interned, log_time.year, log_time.month,
+			    input_suffix))
+				return;
 			
-			/* Make sure the {YYYY}-{MM} directory exists */
-			mkdir(log_dir.c_str(), S_IRUSR | S_IWUSR | S_IXUSR |
-			    S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+			logdir_t *dir = interned->dir;
+			const string &log_path = interned->log_path;
 			
-			/* Open domain log for appending */
-			int fd = open((log_dir + string("/") + domain).c_str(),
-			    O_WRONLY | O_CREAT | O_APPEND | O_LARGEFILE,
-			    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-			if (fd >= 0) {
-				/* Store log entry */
-				write_long(fd, access.c_str(), access.length());
-				write_long(fd, "\n", 1);
-				close(fd);
+			for (unsigned int dest = 0; dest < DESTINATIONS; dest++) {
+				if ((route & (1 << dest)) == 0)
+					continue;
+				
+				bool indexed = (dest == DESTINATION_DOMAIN) &&
+				    (index_wanted(log_path, log_time));
+				uint64_t log_offset = 0;
+				
+				if ((dest == DESTINATION_DOMAIN) && (binary)) {
+					if (!binlog_entry(interned, access))
+						continue;
+				} else {
+					/* Log file name */
+					string suffixed;
+					const string *name = &domain;
+					
+					if (*destination_suffixes[dest] != 0) {
+						suffixed = domain + destination_suffixes[dest];
+						name = &suffixed;
+					}
+					
+					if (!append_entry(dir, *name, access,
+					    indexed ? &log_offset : NULL))
+						continue;
+				}
+				
+				switch (dest) {
+				case DESTINATION_DOMAIN:
+					stats_routed(domain, access.length() + 1);
+					subscribe_entry(domain, access);
+					
+					if (indexed)
+						index_entry(interned, log_time, log_offset);
+					
+					aggregate_entry(log_path, access.c_str(), fields,
+					    log_time);
+					columns_entry(interned, access.c_str(),
+					    access.length(), log_time);
+					json_entry(interned, access.c_str(), fields, log_time);
+					topk_entry(log_path, access.c_str(), fields);
+					rollup_entry(interned, access.c_str(), fields,
+					    log_time);
+					break;
+				case DESTINATION_DIVERTED:
+					stats_diverted();
+					break;
+				case DESTINATION_BOTS:
+					stats_bots();
+					break;
+				}
 			}
-		}
+		} else
+			error_report(ERROR_DOMAIN, entry, size, NULL);
+	} else
+		error_report(ERROR_NO_DOMAIN, entry, size, NULL);
+}
+
+/** Process log entry read from the input
+ *
+ * @param entry  Log entry to process.
+ * @param size   Length of the log entry.
+ * @param index  Structural index of the block containing the log entry.
+ * @param offset Offset of the log entry within the block.
+ * @param arg    Reader argument (suffix of the domain directories
+ *               of the input or NULL for the default one).
+ *
+ */
+static void process_line(const char *entry, size_t size,
+    const strindex_t &index, size_t offset, void *arg)
+{
+	const string &input_suffix = (arg != NULL) ? *((const string *) arg) :
+	    suffix;
+	
+	forward_line(entry, size, input_suffix);
+	stats_line();
+	
+	try {
+		process_entry(entry, size, index, offset, input_suffix);
+	} catch (std::exception & e) {
+		error_report(ERROR_OTHER, entry, size, e.what());
+	} catch (...) {
+		/* All exceptions are treated non-fatal */
+		error_report(ERROR_OTHER, entry, size, NULL);
 	}
 }
 
+/** Termination signal handler
+ *
+ * Since the handler is installed without SA_RESTART,
+ * it also interrupts the blocking wait for input.
+ *
+ * @param signum Signal number.
+ *
+ */
+static void terminate(int signum)
+{
+	terminated = 1;
+}
+
+/** Print usage information
+ *
+ * @param name Program name.
+ *
+ */
+static void usage(const char *name)
+{
+	cerr << "Usage: " << name << " [options] [suffix]" << endl;
+	cerr << endl;
+	cerr << "  -a, --anonymize=FILE   Anonymize client addresses of the "
+	    "domains in FILE" << endl;
+	cerr << "  -B, --binary           Store the domain logs in the binary "
+	    "format" << endl;
+	cerr << "  -b, --bots[=copy]      Store crawler traffic separately (or "
+	    "also)" << endl;
+	cerr << "                         into the bots log" << endl;
+	cerr << "  -C, --columns          Export columnar row groups next to "
+	    "the domain logs" << endl;
+	cerr << "  -F, --filter=FILE      Drop or divert log entries matching "
+	    "the rules in FILE" << endl;
+	cerr << "  -f, --format=FORMAT    Apache LogFormat of the input" << endl;
+	cerr << "                         (default: " << LOGFORMAT_DEFAULT <<
+	    ")" << endl;
+	cerr << "  -I, --input=[SUFFIX=]SOURCE" << endl;
+	cerr << "                         Read log entries from SOURCE instead "
+	    "of the standard" << endl;
+	cerr << "                         input (repeatable, see below)" << endl;
+	cerr << "  -i, --index            Keep time indices next to the domain "
+	    "logs" << endl;
+	cerr << "  -J, --json             Keep JSON-lines logs next to the domain "
+	    "logs" << endl;
+	cerr << "  -k, --anonymize-key=FILE" << endl;
+	cerr << "                         Key of the client address pseudonyms "
+	    "(default: random)" << endl;
+	cerr << "  -L, --listen=ADDRESS   Receive forwarded log entries on "
+	    "ADDRESS instead of" << endl;
+	cerr << "                         the standard input" << endl;
+	cerr << "  -O, --forward=ADDRESS  Also forward the log entries to the "
+	    "collector at ADDRESS" << endl;
+	cerr << "  -p, --public-suffix    Store the logs under the registrable "
+	    "domain (Public" << endl;
+	cerr << "                         Suffix List) instead of the last two "
+	    "parts" << endl;
+	cerr << "  -Q, --quota=FILE       Limit the lines and bytes stored per "
+	    "2nd-level domain" << endl;
+	cerr << "  -q, --quarantine=FILE  Append rejected log entries to FILE" <<
+	    endl;
+	cerr << "  -R, --rcvbuf=BYTES     Receive buffer size of the datagram "
+	    "inputs" << endl;
+	cerr << "  -r, --rollup           Keep per-minute rollups next to the "
+	    "domain logs" << endl;
+	cerr << "  -S, --subscribe=PATH   Stream live log entries to subscribers "
+	    "on socket PATH" << endl;
+	cerr << "  -s, --summary          Keep monthly summaries next to the "
+	    "domain logs" << endl;
+	cerr << "  -t, --top              Keep top paths, referers and user "
+	    "agents next to" << endl;
+	cerr << "                         the domain logs" << endl;
+	cerr << "  -z, --compress         Compress the forwarded log entries "
+	    "(LZ4)" << endl;
+	cerr << endl;
+	cerr << "ADDRESS is HOST:PORT or a Unix socket path. SOURCE is - "
+	    "(standard input)," << endl;
+	cerr << "a FIFO path, unix:PATH (stream socket), unixgram:PATH "
+	    "(datagram socket)" << endl;
+	cerr << "or udp:HOST:PORT (syslog headers of the datagrams are "
+	    "stripped)." << endl;
+}
+
 int main(int argc, char *argv[])
 {
+	static const struct option options[] = {
+		{ "anonymize", required_argument, NULL, 'a' },
+		{ "anonymize-key", required_argument, NULL, 'k' },
+		{ "binary", no_argument, NULL, 'B' },
+		{ "bots", optional_argument, NULL, 'b' },
+		{ "columns", no_argument, NULL, 'C' },
+		{ "compress", no_argument, NULL, 'z' },
+		{ "filter", required_argument, NULL, 'F' },
+		{ "format", required_argument, NULL, 'f' },
+		{ "forward", required_argument, NULL, 'O' },
+		{ "index", no_argument, NULL, 'i' },
+		{ "input", required_argument, NULL, 'I' },
+		{ "json", no_argument, NULL, 'J' },
+		{ "listen", required_argument, NULL, 'L' },
+		{ "public-suffix", no_argument, NULL, 'p' },
+		{ "quarantine", required_argument, NULL, 'q' },
+		{ "quota", required_argument, NULL, 'Q' },
+		{ "rcvbuf", required_argument, NULL, 'R' },
+		{ "rollup", no_argument, NULL, 'r' },
+		{ "subscribe", required_argument, NULL, 'S' },
+		{ "summary", no_argument, NULL, 's' },
+		{ "top", no_argument, NULL, 't' },
+		{ NULL, 0, NULL, 0 }
+	};
+	
+	const char *anonymize = NULL;
+	const char *anonymize_key = NULL;
+	bool bots = false;
+	bool columns = false;
+	bool compress = false;
+	const char *filter_rules = NULL;
+	const char *log_format = LOGFORMAT_DEFAULT;
+	const char *forward = NULL;
+	bool index = false;
+	vector< const char *> inputs;
+	bool json = false;
+	const char *listen_on = NULL;
+	bool public_suffix = false;
+	const char *quarantine = NULL;
+	const char *quota = NULL;
+	long int rcvbuf = 0;
+	bool rollup = false;
+	const char *subscribe = NULL;
+	bool summary = false;
+	bool top = false;
+	
+	int opt;
+	while ((opt = getopt_long(argc, argv, "a:Bb::CF:f:I:iJk:L:O:pQ:q:R:rS:stz", options, NULL)) != -1) {
+		switch (opt) {
+		case 'a':
+			anonymize = optarg;
+			break;
+		case 'B':
+			binary = true;
+			break;
+		case 'b':
+			if ((optarg != NULL) && (strcmp(optarg, "copy") != 0)) {
+				usage(argv[0]);
+				return 1;
+			}
+			
+			bots = true;
+			bots_copy = (optarg != NULL);
+			break;
+		case 'C':
+			columns = true;
+			break;
+		case 'F':
+			filter_rules = optarg;
+			break;
+		case 'f':
+			log_format = optarg;
+			break;
+		case 'I':
+			inputs.push_back(optarg);
+			break;
+		case 'i':
+			index = true;
+			break;
+		case 'J':
+			json = true;
+			break;
+		case 'k':
+			anonymize_key = optarg;
+			break;
+		case 'L':
+			listen_on = optarg;
+			break;
+		case 'O':
+			forward = optarg;
+			break;
+		case 'p':
+			public_suffix = true;
+			break;
+		case 'Q':
+			quota = optarg;
+			break;
+		case 'q':
+			quarantine = optarg;
+			break;
+		case 'R':
+			if ((!decDecode(optarg, rcvbuf)) || (rcvbuf <= 0) ||
+			    (rcvbuf > INT_MAX)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'r':
+			rollup = true;
+			break;
+		case 'S':
+			subscribe = optarg;
+			break;
+		case 's':
+			summary = true;
+			break;
+		case 't':
+			top = true;
+			break;
+		case 'z':
+			compress = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	
 	/* Get optional suffix */
-	if (argc > 1) {
-		string arg = argv[1];
+	if (optind < argc) {
+		string arg = argv[optind];
 		regex filter("[a-z]*");
 		string::const_iterator begin = arg.begin();
 		string::const_iterator end = arg.end();
@@ -409,21 +703,187 @@ int main(int argc, char *argv[])
 			suffix = string(".") + match[0];
 	}
 	
-	string entry;
-	
-	/* Process each line of input */
-	while (getline(cin, entry, '\n')) {
-		try {
-			process_entry(entry);
-		} catch (std::exception & e) {
-			cerr << "Exception while processing access log entry: " <<
-			    e.what() << endl;
-		} catch (...) {
-			/* All exceptions are treated non-fatal */
-			cerr << "Unexpected exception while processing "
-			    "access log entry" << endl;
+	string error;
+	if (!logformat_compile(log_format, format, error)) {
+		cerr << "Invalid log format: " << error << endl;
+		return 1;
+	}
+	
+	if ((filter_rules != NULL) &&
+	    (!filter_init(filter_rules, format, error))) {
+		cerr << "Invalid filter rules: " << error << endl;
+		return 1;
+	}
+	
+	if ((anonymize != NULL) &&
+	    (!anonymize_init(anonymize, anonymize_key, format, error))) {
+		cerr << "Invalid anonymization: " << error << endl;
+		return 1;
+	}
+	
+	if ((quota != NULL) && (!quota_init(quota, error))) {
+		cerr << "Invalid quotas: " << error << endl;
+		return 1;
+	}
+	
+	if ((bots) && (!bots_init(format))) {
+		cerr << "Log format does not contain the user agent" << endl;
+		return 1;
+	}
+	
+	if ((public_suffix) && (!psl_available())) {
+		cerr << "Built without the Public Suffix List (see PSL_LIST in "
+		    "the Makefile)" << endl;
+		return 1;
+	}
+	
+	if ((binary) && (index)) {
+		cerr << "Time indices are not supported with binary domain logs" <<
+		    endl;
+		return 1;
+	}
+	
+	if (binary)
+		binlog_init();
+	
+	if (index)
+		index_init();
+	
+	if (rollup)
+		rollup_init(format);
+	
+	if (summary)
+		aggregate_init(format);
+	
+	if (columns)
+		columns_init(format);
+	
+	if (json)
+		json_init(format);
+	
+	if (top)
+		topk_init(format);
+	
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = terminate;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGHUP, &action, NULL);
+	
+	if (!errors_init(quarantine)) {
+		cerr << "Unable to open quarantine file " << quarantine << ": " <<
+		    strerror(errno) << endl;
+		return 1;
+	}
+	
+	if ((subscribe != NULL) && (!subscribe_init(subscribe))) {
+		cerr << "Unable to listen on " << subscribe << ": " <<
+		    strerror(errno) << endl;
+		return 1;
+	}
+	
+	if ((forward != NULL) && (!forward_init(forward, compress, error))) {
+		cerr << "Unable to forward: " << error << endl;
+		return 1;
+	}
+	
+	if ((listen_on != NULL) &&
+	    (!forward_listen(listen_on, process_line, error))) {
+		cerr << "Unable to listen on " << listen_on << ": " << error << endl;
+		return 1;
+	}
+	
+	inputs_receive_buffer(rcvbuf);
+	
+	for (size_t i = 0; i < inputs.size(); i++) {
+		/* Optional suffix of the input */
+		const char *source = inputs[i];
+		string input_suffix = suffix;
+		
+		size_t prefix_length = strspn(source, "abcdefghijklmnopqrstuvwxyz");
+		if ((prefix_length > 0) && (source[prefix_length] == '=')) {
+			input_suffix = string(".") + string(source, prefix_length);
+			source += prefix_length + 1;
+		}
+		
+		if (!inputs_add(source, input_suffix, process_line, error)) {
+			cerr << "Unable to read input " << error << endl;
+			return 1;
+		}
+	}
+	
+	stats_init();
+	logdir_init(prefix);
+	domains_init(public_suffix);
+	
+	reader_t input;
+	reader_init(input, STDIN_FILENO, process_line, NULL);
+	
+	struct pollfd pfds[SUBSCRIBE_MAX + FORWARD_POLLFDS + 3];
+	
+	/*
+	 * Process input until its end or termination. The collector
+	 * and the daemon with explicit inputs do not read the standard
+	 * input (directly) and run until termination.
+	 */
+	while (!terminated) {
+		pfds[0].fd = ((listen_on != NULL) || (!inputs.empty())) ? -1 :
+		    STDIN_FILENO;
+		pfds[0].events = POLLIN;
+		pfds[0].revents = 0;
+		
+		/* Event polling of the inputs (if any) */
+		pfds[1].fd = inputs_fd();
+		pfds[1].events = POLLIN;
+		pfds[1].revents = 0;
+		
+		size_t count = subscribe_pollfds(pfds + 2);
+		size_t forward_count = forward_pollfds(pfds + count + 2);
+		
+		int ready = poll(pfds, count + forward_count + 2,
+		    forward_timeout(TICK_INTERVAL));
+		
+		if ((ready < 0) && (errno != EINTR))
+			break;
+		
+		if (ready > 0) {
+			/* Before reading input, which may drop subscribers */
+			subscribe_events(pfds + 2, count);
+			forward_events(pfds + count + 2, forward_count);
+			
+			if (pfds[1].revents != 0)
+				inputs_events();
+			
+			if ((pfds[0].revents != 0) && (!reader_read(input)))
+				break;
 		}
+		
+		forward_tick();
+		logdir_tick();
+		stats_tick();
+		errors_tick();
+		quota_tick();
+		index_tick();
+		binlog_tick();
+		aggregate_tick();
+		columns_tick();
+		topk_tick();
+		rollup_tick();
 	}
 	
+	aggregate_done();
+	columns_done();
+	topk_done();
+	rollup_done();
+	inputs_done();
+	forward_done();
+	subscribe_done();
+	quota_done();
+	errors_done();
+	domains_done();
+	logdir_done();
+	stats_done();
 	return 0;
 }
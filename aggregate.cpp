@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include "aggregate.h"
+#include "hash.h"
+#include "timer.h"
+
+using namespace std;
+
+/** Snapshot interval (ms) */
+#define AGGREGATE_INTERVAL  60000
+
+/** Idle time after which a summary is evicted from memory (ms) */
+#define AGGREGATE_IDLE  3600000
+
+typedef struct {
+	aggregate_record_t record;
+	hll_t visitors;
+	bool dirty;
+	uint64_t touched;
+} aggregate_entry_t; /**< In-memory summary */
+
+/** Summaries indexed by the domain log path */
+typedef unordered_map< string, aggregate_entry_t> aggregate_map;
+
+/** Aggregation enabled */
+static bool enabled = false;
+
+/** In-memory summaries */
+static aggregate_map summaries;
+
+/** Time of the last snapshot (ms) */
+static uint64_t last_snapshot;
+
+/** Enable aggregation
+ *
+ * @param format Compiled log format (the client address,
+ *               status and size fields are required
+ *               if present).
+ *
+ */
+void aggregate_init(logformat_t &format)
+{
+	logformat_require(format, FIELD_HOST);
+	logformat_require(format, FIELD_STATUS);
+	logformat_require(format, FIELD_BYTES);
+	
+	enabled = true;
+	last_snapshot = monotonic_ms();
+}
+
+/** Load summary from disk
+ *
+ * Summaries of version 1 (without the sketch
+ * of the client addresses) are also accepted.
+ *
+ * @param path  Summary file path.
+ * @param entry Loaded summary (empty if there
+ *              is no valid summary file).
+ *
+ */
+static void load(const string &path, aggregate_entry_t &entry)
+{
+	aggregate_record_t &record = entry.record;
+	
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd >= 0) {
+		ssize_t count = read(fd, &record, sizeof(record));
+		
+		if ((count == sizeof(record)) && (record.magic == AGGREGATE_MAGIC) &&
+		    (record.version <= AGGREGATE_VERSION)) {
+			uint8_t registers[HLL_REGISTERS];
+			
+			if ((record.version >= 2) &&
+			    (read(fd, registers, HLL_REGISTERS) == HLL_REGISTERS))
+				hll_merge(entry.visitors, registers);
+			
+			record.version = AGGREGATE_VERSION;
+			close(fd);
+			return;
+		}
+		
+		close(fd);
+	}
+	
+	memset(&record, 0, sizeof(record));
+	record.magic = AGGREGATE_MAGIC;
+	record.version = AGGREGATE_VERSION;
+}
+
+/** Store summary to disk
+ *
+ * @param path  Summary file path.
+ * @param entry Summary to store.
+ *
+ */
+static void store(const string &path, const aggregate_entry_t &entry)
+{
+	uint8_t buffer[sizeof(aggregate_record_t) + HLL_REGISTERS];
+	
+	memcpy(buffer, &entry.record, sizeof(aggregate_record_t));
+	hll_registers(entry.visitors, buffer + sizeof(aggregate_record_t));
+	
+	write_file(path.c_str(), buffer, sizeof(buffer));
+}
+
+/** Account log entry
+ *
+ * @param log_path Domain log path.
+ * @param line     Log entry as stored.
+ * @param fields   Parsed log entry.
+ * @param time     Log entry date & time.
+ *
+ */
+void aggregate_entry(const string &log_path, const char *line,
+    const log_fields_t &fields, const datetime &time)
+{
+	if (!enabled)
+		return;
+	
+	aggregate_map::iterator it = summaries.find(log_path);
+	if (it == summaries.end()) {
+		it = summaries.insert(make_pair(log_path,
+		    aggregate_entry_t())).first;
+		load(log_path + AGGREGATE_SUFFIX, it->second);
+	}
+	
+	aggregate_entry_t &entry = it->second;
+	aggregate_record_t &record = entry.record;
+	
+	record.hits++;
+	
+	/* Client address */
+	const field_span_t &host = fields.field[FIELD_HOST];
+	if (host.start != FIELD_ABSENT)
+		hll_add(entry.visitors, hash_bytes(line + host.start, host.length));
+	
+	/* Response size ('-' for no content) */
+	const field_span_t &bytes = fields.field[FIELD_BYTES];
+	uint64_t size;
+	if ((bytes.start != FIELD_ABSENT) &&
+	    (span_decode(line + bytes.start, bytes.length, size)))
+		record.bytes += size;
+	
+	/* Status class */
+	const field_span_t &status = fields.field[FIELD_STATUS];
+	unsigned int status_class = 0;
+	if ((status.start != FIELD_ABSENT) && (status.length == 3) &&
+	    (line[status.start] >= '1') && (line[status.start] <= '5'))
+		status_class = line[status.start] - '0';
+	
+	record.status[status_class]++;
+	
+	if ((time.day >= 1) && (time.day <= 31))
+		record.days[time.day - 1]++;
+	
+	if ((time.hour >= 0) && (time.hour < 24))
+		record.hours[time.hour]++;
+	
+	entry.dirty = true;
+	entry.touched = monotonic_ms();
+}
+
+/** Store modified summaries
+ *
+ * @param now     Current time (ms).
+ * @param evict   Evict the summaries idle for too long.
+ *
+ */
+static void snapshot(uint64_t now, bool evict)
+{
+	aggregate_map::iterator it = summaries.begin();
+	while (it != summaries.end()) {
+		aggregate_entry_t &entry = it->second;
+		
+		if (entry.dirty) {
+			store(it->first + AGGREGATE_SUFFIX, entry);
+			entry.dirty = false;
+		}
+		
+		if ((evict) && (now - entry.touched > AGGREGATE_IDLE))
+			it = summaries.erase(it);
+		else
+			++it;
+	}
+}
+
+/** Store modified summaries periodically
+ *
+ * Does nothing until the snapshot interval
+ * elapses, thus it is cheap to call often.
+ *
+ */
+void aggregate_tick(void)
+{
+	if (!enabled)
+		return;
+	
+	uint64_t now = monotonic_ms();
+	if (now - last_snapshot < AGGREGATE_INTERVAL)
+		return;
+	
+	snapshot(now, true);
+	last_snapshot = now;
+}
+
+/** Store all modified summaries */
+void aggregate_done(void)
+{
+	if (!enabled)
+		return;
+	
+	snapshot(monotonic_ms(), false);
+	summaries.clear();
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AGGREGATE_H_
+#define AGGREGATE_H_
+
+#include <stdint.h>
+#include <string>
+#include "hll.h"
+#include "logformat.h"
+#include "util.h"
+
+/** Suffix of the summary file (appended to the domain log path) */
+#define AGGREGATE_SUFFIX  ".summary"
+
+/** Summary file magic number */
+#define AGGREGATE_MAGIC  UINT32_C(0x616c7375)
+
+/** Summary file layout version */
+#define AGGREGATE_VERSION  2
+
+/** Status classes (other, 1xx, 2xx, 3xx, 4xx, 5xx) */
+#define AGGREGATE_STATUS_CLASSES  6
+
+/** Per-domain monthly summary
+ *
+ * The summary is stored in the host byte order next
+ * to the monthly domain log, followed by the HLL_REGISTERS
+ * registers of the HyperLogLog sketch of the client
+ * addresses (since version 2).
+ *
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	
+	uint64_t hits;
+	uint64_t bytes;
+	uint64_t status[AGGREGATE_STATUS_CLASSES];
+	uint64_t days[31];
+	uint64_t hours[24];
+} aggregate_record_t;
+
+extern void aggregate_init(logformat_t &);
+extern void aggregate_entry(const std::string &, const char *,
+    const log_fields_t &, const datetime &);
+extern void aggregate_tick(void);
+extern void aggregate_done(void);
+
+#endif
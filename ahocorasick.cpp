@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "ahocorasick.h"
+
+using namespace std;
+
+/** Trie state during the construction */
+typedef struct {
+	vector< uint32_t> next;
+	uint32_t fail;
+	vector< uint32_t> patterns;
+} trie_state_t;
+
+/** Build Aho-Corasick automaton
+ *
+ * @param automaton Automaton to build.
+ * @param patterns  Patterns (the pattern identifiers are
+ *                  the indices in the vector).
+ * @param nocase    Match case-insensitively.
+ *
+ */
+void ahocorasick_build(ahocorasick_t &automaton,
+    const vector< string> &patterns, bool nocase)
+{
+	/* Byte equivalence classes (class 0 for unused bytes) */
+	memset(automaton.classes, 0, sizeof(automaton.classes));
+	automaton.class_count = 1;
+	
+	for (size_t i = 0; i < patterns.size(); i++) {
+		for (size_t j = 0; j < patterns[i].length(); j++) {
+			uint8_t chr = patterns[i][j];
+			if (nocase)
+				chr = tolower(chr);
+			
+			if (automaton.classes[chr] == 0)
+				automaton.classes[chr] = automaton.class_count++;
+		}
+	}
+	
+	if (nocase) {
+		for (unsigned int chr = 0; chr < 256; chr++)
+			automaton.classes[chr] = automaton.classes[tolower(chr)];
+	}
+	
+	unsigned int class_count = automaton.class_count;
+	
+	/* Trie of the patterns */
+	vector< trie_state_t> trie(1);
+	trie[0].next.assign(class_count, 0);
+	trie[0].fail = 0;
+	
+	for (size_t i = 0; i < patterns.size(); i++) {
+		uint32_t state = 0;
+		
+		for (size_t j = 0; j < patterns[i].length(); j++) {
+			uint16_t cls = automaton.classes[(uint8_t) patterns[i][j]];
+			
+			if (trie[state].next[cls] == 0) {
+				trie[state].next[cls] = trie.size();
+				trie.push_back(trie_state_t());
+				trie.back().next.assign(class_count, 0);
+				trie.back().fail = 0;
+			}
+			
+			state = trie[state].next[cls];
+		}
+		
+		trie[state].patterns.push_back(i);
+	}
+	
+	/*
+	 * Failure links in breadth-first order, turning
+	 * the missing transitions into the transitions
+	 * of the failure state (full DFA)
+	 */
+	deque< uint32_t> queue;
+	for (unsigned int cls = 0; cls < class_count; cls++) {
+		if (trie[0].next[cls] != 0)
+			queue.push_back(trie[0].next[cls]);
+	}
+	
+	while (!queue.empty()) {
+		uint32_t state = queue.front();
+		queue.pop_front();
+		
+		const trie_state_t &fail = trie[trie[state].fail];
+		trie[state].patterns.insert(trie[state].patterns.end(),
+		    fail.patterns.begin(), fail.patterns.end());
+		
+		for (unsigned int cls = 0; cls < class_count; cls++) {
+			uint32_t next = trie[state].next[cls];
+			
+			if (next != 0) {
+				trie[next].fail = trie[trie[state].fail].next[cls];
+				queue.push_back(next);
+			} else
+				trie[state].next[cls] = trie[trie[state].fail].next[cls];
+		}
+	}
+	
+	/* Flatten */
+	automaton.delta.resize(trie.size() * class_count);
+	automaton.output_start.resize(trie.size() + 1);
+	automaton.outputs.clear();
+	
+	for (size_t state = 0; state < trie.size(); state++) {
+		for (unsigned int cls = 0; cls < class_count; cls++) {
+			uint32_t next = trie[state].next[cls];
+			
+			automaton.delta[state * class_count + cls] =
+			    ((next * class_count) << 1) |
+			    (trie[next].patterns.empty() ? 0 : 1);
+		}
+		
+		automaton.output_start[state] = automaton.outputs.size();
+		automaton.outputs.insert(automaton.outputs.end(),
+		    trie[state].patterns.begin(), trie[state].patterns.end());
+	}
+	
+	automaton.output_start[trie.size()] = automaton.outputs.size();
+}
+
+/** Find all patterns occuring in a text
+ *
+ * @param automaton Automaton.
+ * @param text      Text to search.
+ * @param length    Length of the text.
+ * @param matches   Identifiers of the matched patterns (appended,
+ *                  a pattern occuring repeatedly is reported
+ *                  repeatedly).
+ *
+ */
+void ahocorasick_match(const ahocorasick_t &automaton, const char *text,
+    size_t length, vector< uint32_t> &matches)
+{
+	const uint32_t *delta = &automaton.delta[0];
+	const uint32_t *output_start = &automaton.output_start[0];
+	uint32_t row = 0;
+	
+	for (size_t pos = 0; pos < length; pos++) {
+		uint32_t next = delta[row + automaton.classes[(uint8_t) text[pos]]];
+		row = next >> 1;
+		
+		if (next & 1) {
+			uint32_t state = row / automaton.class_count;
+			
+			for (uint32_t i = output_start[state];
+			    i < output_start[state + 1]; i++)
+				matches.push_back(automaton.outputs[i]);
+		}
+	}
+}
+
+/** Check whether any pattern occurs in a text
+ *
+ * @param automaton Automaton.
+ * @param text      Text to search.
+ * @param length    Length of the text.
+ *
+ * @return True if any pattern occurs in the text.
+ *
+ */
+bool ahocorasick_any(const ahocorasick_t &automaton, const char *text,
+    size_t length)
+{
+	const uint32_t *delta = &automaton.delta[0];
+	uint32_t row = 0;
+	
+	for (size_t pos = 0; pos < length; pos++) {
+		uint32_t next = delta[row + automaton.classes[(uint8_t) text[pos]]];
+		if (next & 1)
+			return true;
+		
+		row = next >> 1;
+	}
+	
+	return false;
+}
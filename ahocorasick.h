@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AHOCORASICK_H_
+#define AHOCORASICK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Aho-Corasick automaton
+ *
+ * The automaton is compiled into a full DFA over byte
+ * equivalence classes (all bytes which do not occur in
+ * any pattern share a single class), so matching costs
+ * a single table lookup per input byte.
+ *
+ */
+typedef struct {
+	/* Byte to equivalence class */
+	uint16_t classes[256];
+	unsigned int class_count;
+	
+	/*
+	 * Transitions indexed by state * class_count + class,
+	 * holding the index of the row of the next state shifted
+	 * left by one and the lowest bit set if the next state
+	 * matches any pattern
+	 */
+	std::vector< uint32_t> delta;
+	
+	/* Matched patterns of the states (including the suffixes) */
+	std::vector< uint32_t> output_start;
+	std::vector< uint32_t> outputs;
+} ahocorasick_t;
+
+extern void ahocorasick_build(ahocorasick_t &,
+    const std::vector< std::string> &, bool);
+extern void ahocorasick_match(const ahocorasick_t &, const char *, size_t,
+    std::vector< uint32_t> &);
+extern bool ahocorasick_any(const ahocorasick_t &, const char *, size_t);
+
+#endif
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <arpa/inet.h>
+#include <sys/random.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include "anonymize.h"
+#include "hash.h"
+#include "util.h"
+
+using namespace std;
+
+typedef enum {
+	ANONYMIZE_NONE,
+	ANONYMIZE_TRUNCATE,
+	ANONYMIZE_HASH
+} anonymize_mode_t; /**< Client address anonymization */
+
+/** Domains (and their subdomains) opted in */
+static unordered_map< string, anonymize_mode_t> domains;
+
+/** Mode of all the other domains ("*" entry) */
+static anonymize_mode_t default_mode = ANONYMIZE_NONE;
+
+/** Pseudonym key */
+static uint8_t key[SIPHASH_KEY_LENGTH];
+
+/** Anonymization enabled */
+static bool enabled = false;
+
+/** Decode hexadecimal digit
+ *
+ * @param chr Digit.
+ *
+ * @return Value of the digit or -1 if invalid.
+ *
+ */
+static int hex_decode(char chr)
+{
+	if ((chr >= '0') && (chr <= '9'))
+		return chr - '0';
+	
+	chr = tolower(chr);
+	if ((chr >= 'a') && (chr <= 'f'))
+		return chr - 'a' + 10;
+	
+	return -1;
+}
+
+/** Load pseudonym key
+ *
+ * @param path  Key file path (32 hexadecimal digits) or NULL
+ *              for a random key.
+ * @param error Error description on failure.
+ *
+ * @return True on success.
+ *
+ */
+static bool load_key(const char *path, string &error)
+{
+	if (path == NULL) {
+		/* Pseudonyms are stable only until restart */
+		if (getrandom(key, sizeof(key), 0) != sizeof(key)) {
+			error = "Unable to generate pseudonym key";
+			return false;
+		}
+		
+		return true;
+	}
+	
+	ifstream file(path);
+	string hex;
+	
+	if ((!file) || (!(file >> hex))) {
+		error = string("Unable to read pseudonym key from ") + path;
+		return false;
+	}
+	
+	if (hex.length() != 2 * SIPHASH_KEY_LENGTH) {
+		error = "Pseudonym key has to be 32 hexadecimal digits";
+		return false;
+	}
+	
+	for (size_t i = 0; i < SIPHASH_KEY_LENGTH; i++) {
+		int high = hex_decode(hex[2 * i]);
+		int low = hex_decode(hex[2 * i + 1]);
+		
+		if ((high < 0) || (low < 0)) {
+			error = "Pseudonym key has to be 32 hexadecimal digits";
+			return false;
+		}
+		
+		key[i] = (high << 4) | low;
+	}
+	
+	return true;
+}
+
+/** Initialize client address anonymization
+ *
+ * Each line of the opt-in list contains a domain name
+ * (covering also its subdomains) or "*" (covering all
+ * other domains) followed by the mode ("truncate" or
+ * "hash").
+ *
+ * @param path     Opt-in list path.
+ * @param key_path Pseudonym key path (NULL for a random key).
+ * @param format   Compiled log format (the client address
+ *                 is required).
+ * @param error    Error description on failure.
+ *
+ * @return True on success.
+ *
+ */
+bool anonymize_init(const char *path, const char *key_path,
+    logformat_t &format, string &error)
+{
+	if (!logformat_require(format, FIELD_HOST)) {
+		error = "Format does not contain client address (%h)";
+		return false;
+	}
+	
+	ifstream file(path);
+	if (!file) {
+		error = string("Unable to open ") + path;
+		return false;
+	}
+	
+	string line;
+	unsigned int number = 0;
+	
+	while (getline(file, line)) {
+		number++;
+		
+		istringstream words(line);
+		string domain;
+		string mode_name;
+		
+		/* Empty line or comment */
+		if ((!(words >> domain)) || (domain[0] == '#'))
+			continue;
+		
+		anonymize_mode_t mode;
+		words >> mode_name;
+		
+		if (mode_name == "truncate")
+			mode = ANONYMIZE_TRUNCATE;
+		else if (mode_name == "hash")
+			mode = ANONYMIZE_HASH;
+		else {
+			ostringstream stream;
+			stream << path << ":" << number << ": Unknown mode '" <<
+			    mode_name << "'";
+			error = stream.str();
+			return false;
+		}
+		
+		for (size_t i = 0; i < domain.length(); i++)
+			domain[i] = tolower(domain[i]);
+		
+		if (domain == "*")
+			default_mode = mode;
+		else
+			domains[domain] = mode;
+	}
+	
+	if (!load_key(key_path, error))
+		return false;
+	
+	enabled = true;
+	return true;
+}
+
+/** Resolve anonymization mode of a domain name
+ *
+ * @param domain Domain name.
+ *
+ * @return Mode of the domain or of its nearest parent domain.
+ *
+ */
+static anonymize_mode_t resolve_mode(const string &domain)
+{
+	if (domains.empty())
+		return default_mode;
+	
+	string name = domain;
+	for (size_t i = 0; i < name.length(); i++)
+		name[i] = tolower(name[i]);
+	
+	size_t pos = 0;
+	while (true) {
+		unordered_map< string, anonymize_mode_t>::const_iterator it =
+		    domains.find(name.substr(pos));
+		if (it != domains.end())
+			return it->second;
+		
+		pos = name.find('.', pos);
+		if (pos == string::npos)
+			break;
+		
+		pos++;
+	}
+	
+	return default_mode;
+}
+
+/** Find anonymization mode of a domain
+ *
+ * The mode is resolved once per interned domain
+ * and cached in it.
+ *
+ * @param domain Interned domain.
+ *
+ * @return Mode of the domain.
+ *
+ */
+static anonymize_mode_t domain_mode(domain_t *domain)
+{
+	if (domain->anonymize < 0)
+		domain->anonymize = resolve_mode(domain->name);
+	
+	return (anonymize_mode_t) domain->anonymize;
+}
+
+/** Anonymize client address in a log entry
+ *
+ * The address is rewritten in place. Truncation keeps
+ * the IPv4 /24 or the IPv6 /48 network, the pseudonym
+ * is an address of the same family derived from the
+ * keyed hash of the address. The parsed fields are
+ * updated to describe the rewritten entry.
+ *
+ * @param domain Interned domain.
+ * @param fields Parsed log entry (relative to the entry
+ *               as stored, see logformat_rebase()).
+ * @param access Log entry as stored, its capacity has to
+ *               allow for ANONYMIZE_SLACK more bytes to
+ *               avoid reallocation.
+ *
+ * @return True if the entry has been rewritten.
+ *
+ */
+bool anonymize_entry(domain_t *domain, log_fields_t &fields, string &access)
+{
+	if (!enabled)
+		return false;
+	
+	field_span_t &host = fields.field[FIELD_HOST];
+	if ((host.start == FIELD_ABSENT) ||
+	    (host.start + host.length > access.length()))
+		return false;
+	
+	anonymize_mode_t mode = domain_mode(domain);
+	if (mode == ANONYMIZE_NONE)
+		return false;
+	
+	size_t start = host.start;
+	
+	uint8_t addr[ADDRESS_LENGTH];
+	if (!address_decode(access.c_str() + start, host.length, addr))
+		return false;
+	
+	/* IPv4-mapped address */
+	static const uint8_t mapped[12] =
+	    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+	bool ipv4 = (memcmp(addr, mapped, sizeof(mapped)) == 0);
+	
+	if (mode == ANONYMIZE_TRUNCATE) {
+		if (ipv4)
+			addr[15] = 0;
+		else
+			memset(addr + 6, 0, ADDRESS_LENGTH - 6);
+	} else {
+		uint64_t hash[2];
+		hash[0] = siphash(key, addr, ADDRESS_LENGTH);
+		hash[1] = siphash(key, hash, sizeof(hash[0]));
+		
+		if (ipv4)
+			memcpy(addr + 12, hash, 4);
+		else
+			memcpy(addr, hash, ADDRESS_LENGTH);
+	}
+	
+	char buf[INET6_ADDRSTRLEN];
+	if (ipv4)
+		inet_ntop(AF_INET, addr + 12, buf, sizeof(buf));
+	else
+		inet_ntop(AF_INET6, addr, buf, sizeof(buf));
+	
+	size_t buf_length = strlen(buf);
+	access.replace(start, host.length, buf, buf_length);
+	
+	/* Shift the fields following the address */
+	for (unsigned int field = 0; field < FIELDS; field++) {
+		field_span_t &span = fields.field[field];
+		
+		if ((span.start != FIELD_ABSENT) && (span.start > host.start))
+			span.start = span.start + buf_length - host.length;
+	}
+	
+	host.length = buf_length;
+	return true;
+}
@@ -0,0 +1,145 @@
+#!/bin/bash
+#
+# Copyright (c) 2017 Martin Decky
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# - Redistributions of source code must retain the above copyright
+#   notice, this list of conditions and the following disclaimer.
+# - Redistributions in binary form must reproduce the above copyright
+#   notice, this list of conditions and the following disclaimer in the
+#   documentation and/or other materials provided with the distribution.
+# - The name of the author may not be used to endorse or promote products
+#   derived from this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+# IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+# OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+# IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+# INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+# NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+# THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+# THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#
+
+#
+# Compare the time to store log entries by two revisions
+#
+# Usage: bench/append.sh [BASE [NEW [LINES [RUNS]]]]
+#
+# Each revision is built in a temporary work tree and fed
+# (by cat, as from a pipe) with the same generated sample of
+# LINES vhost_combined entries spread over 16 domains. The
+# wall time of each of the RUNS runs is printed, followed by
+# the minimum, median and mean of each revision. The runs
+# are noisy, thus use at least 5 of them.
+#
+# The logs are stored under /home/httpd (the compiled-in
+# prefix) in the bench-N.test domains, which are created
+# and removed by the script. Thus it needs write access
+# to /home/httpd.
+#
+# The numbers of the single writev() in append_entry()
+# are reproduced by
+#
+#   bench/append.sh 89706f0 8f501a6
+#
+
+set -e
+
+BASE="${1:-HEAD~1}"
+NEW="${2:-HEAD}"
+LINES="${3:-1000000}"
+RUNS="${4:-5}"
+DOMAINS=16
+PREFIX=/home/httpd
+
+ROOT="$(git rev-parse --show-toplevel)"
+WORK="$(mktemp -d)"
+
+cleanup() {
+	for rev in base new ; do
+		git -C "${ROOT}" worktree remove --force "${WORK}/${rev}" \
+			2> /dev/null || true
+	done
+	
+	rm -rf "${WORK}"
+	
+	domain=1
+	while [ "${domain}" -le "${DOMAINS}" ] ; do
+		rm -rf "${PREFIX}/bench-${domain}.test"
+		domain=$((domain + 1))
+	done
+}
+
+trap cleanup EXIT
+
+# Build both revisions
+for rev in base new ; do
+	if [ "${rev}" = "base" ] ; then
+		commit="${BASE}"
+	else
+		commit="${NEW}"
+	fi
+	
+	git -C "${ROOT}" worktree add --detach "${WORK}/${rev}" "${commit}" \
+		> /dev/null 2>&1
+	make -C "${WORK}/${rev}" -j"$(nproc)" accesslog > /dev/null
+done
+
+# Only the domains with the logs directory are stored
+domain=1
+while [ "${domain}" -le "${DOMAINS}" ] ; do
+	mkdir -p "${PREFIX}/bench-${domain}.test/logs"
+	domain=$((domain + 1))
+done
+
+# Deterministic sample (the same for both revisions)
+awk -v lines="${LINES}" -v domains="${DOMAINS}" 'BEGIN {
+	srand(1);
+	for (i = 0; i < lines; i++) {
+		domain = int(rand() * domains) + 1;
+		printf("www.bench-%d.test 192.0.2.%d - - " \
+		    "[15/Oct/2026:%02d:%02d:%02d +0200] " \
+		    "\"GET /page/%d.html HTTP/1.1\" 200 %d " \
+		    "\"https://www.bench-%d.test/\" " \
+		    "\"Mozilla/5.0 (X11; Linux x86_64; rv:130.0) " \
+		    "Gecko/20100101 Firefox/130.0\"\n",
+		    domain, int(rand() * 254) + 1,
+		    (i / 3600) % 24, (i / 60) % 60, i % 60,
+		    int(rand() * 1000), int(rand() * 100000), domain);
+	}
+}' > "${WORK}/sample.txt"
+
+echo "${LINES} entries, ${RUNS} runs, wall time in seconds"
+
+# Alternate the revisions not to favor either by the system state
+TIMEFORMAT="%R"
+run=1
+while [ "${run}" -le "${RUNS}" ] ; do
+	for rev in base new ; do
+		rm -rf "${PREFIX}"/bench-*.test/logs/*
+		sync
+		
+		{ time (cat "${WORK}/sample.txt" | \
+			"${WORK}/${rev}/accesslog" 2> /dev/null) ; } 2>&1 | \
+			tee -a "${WORK}/${rev}.times" | sed "s/^/${rev} /"
+	done
+	
+	run=$((run + 1))
+done
+
+for rev in base new ; do
+	sort -n "${WORK}/${rev}.times" | awk -v rev="${rev}" '{
+		times[NR] = $1;
+		sum += $1;
+	} END {
+		printf("%s: min %.3f, median %.3f, mean %.3f\n", rev, times[1],
+		    times[int((NR + 1) / 2)], sum / NR);
+	}'
+done
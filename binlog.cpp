@@ -0,0 +1,969 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/file.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "binlog.h"
+#include "hash.h"
+#include "timer.h"
+
+using namespace std;
+
+/** Eviction check interval (ms) */
+#define BINLOG_INTERVAL  60000
+
+/** Encoder state idle for longer is evicted (ms) */
+#define BINLOG_IDLE  3600000
+
+/** Client address stored as 4 bytes */
+#define FLAG_IPV4  0x01
+
+/** Client address stored as 16 bytes */
+#define FLAG_IPV6  0x02
+
+/** Request line split into method, path and protocol */
+#define FLAG_REQUEST  0x04
+
+/** Trailing fields after the user agent */
+#define FLAG_REST  0x08
+
+/** Time zone offset changed (follows as zigzag varint) */
+#define FLAG_OFFSET  0x10
+
+/** Length of the Apache timestamp (without the brackets) */
+#define TIMESTAMP_LENGTH  26
+
+/** Frequent status codes (encoded as their index + 1) */
+static const unsigned int statuses[] = {
+	200, 204, 206, 301, 302, 303, 304, 307, 308, 400, 401, 403, 404, 405,
+	408, 410, 413, 416, 429, 444, 499, 500, 501, 502, 503, 504
+};
+
+#define STATUSES  (sizeof(statuses) / sizeof(statuses[0]))
+
+/** Month names */
+static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+typedef struct {
+	uint8_t flags;
+	uint8_t addr[ADDRESS_LENGTH];
+	
+	int64_t time;
+	long int offset;
+	
+	unsigned int status;
+	
+	/* Size of the response plus one (0 for "-") */
+	uint64_t bytes;
+	
+	const char *strings[BINLOG_STRINGS];
+	size_t lengths[BINLOG_STRINGS];
+} entry_t; /**< Structured combined log entry */
+
+typedef struct {
+	/* Dictionaries (hash to identifier, identifier to string) */
+	unordered_map< uint64_t, uint32_t> index[BINLOG_STRINGS];
+	vector< string> dicts[BINLOG_STRINGS];
+	
+	/* Time base */
+	int64_t time;
+	long int offset;
+	
+	/* Segment started */
+	bool started;
+	
+	/* Size of the file after the last record written */
+	off_t size;
+	
+	/* Last use (ms) */
+	uint64_t touched;
+} encoder_t; /**< Binary log encoder state */
+
+/** Encoder states indexed by the domain log path */
+typedef unordered_map< string, encoder_t *> encoder_map;
+
+/** Binary logs enabled */
+static bool enabled = false;
+
+/** Encoder states */
+static encoder_map encoders;
+
+/** Time of the last eviction check (ms) */
+static uint64_t last_check;
+
+/** Append unsigned varint (LEB128)
+ *
+ * @param buf Buffer.
+ * @param val Value.
+ *
+ */
+static void put_varint(string &buf, uint64_t val)
+{
+	while (val >= 0x80) {
+		buf += (char) ((val & 0x7f) | 0x80);
+		val >>= 7;
+	}
+	
+	buf += (char) val;
+}
+
+/** Read unsigned varint (LEB128)
+ *
+ * @param data Data.
+ * @param size Size of the data.
+ * @param pos  Position (advanced past the varint).
+ * @param val  Value.
+ *
+ * @return True on success.
+ *
+ */
+static bool get_varint(const uint8_t *data, size_t size, size_t &pos,
+    uint64_t &val)
+{
+	val = 0;
+	
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		if (pos >= size)
+			return false;
+		
+		uint8_t byte = data[pos++];
+		val |= ((uint64_t) (byte & 0x7f)) << shift;
+		
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	
+	return false;
+}
+
+/** Zigzag encoding of signed value */
+static inline uint64_t zigzag(int64_t val)
+{
+	return (((uint64_t) val) << 1) ^ ((uint64_t) (val >> 63));
+}
+
+/** Zigzag decoding of signed value */
+static inline int64_t unzigzag(uint64_t val)
+{
+	return (int64_t) (val >> 1) ^ -((int64_t) (val & 1));
+}
+
+/** Decode decimal digits
+ *
+ * @param str    Digits.
+ * @param length Number of digits.
+ * @param val    Decoded value.
+ *
+ * @return True on success.
+ *
+ */
+static bool digits_decode(const char *str, size_t length, long int &val)
+{
+	val = 0;
+	
+	for (size_t i = 0; i < length; i++) {
+		if ((str[i] < '0') || (str[i] > '9'))
+			return false;
+		
+		val = val * 10 + (str[i] - '0');
+	}
+	
+	return true;
+}
+
+/** Find end of quoted string
+ *
+ * Apache escapes the double quotes and backslashes
+ * inside quoted strings by a backslash.
+ *
+ * @param line   Log entry.
+ * @param length Length of the log entry.
+ * @param pos    Position after the opening quote.
+ *
+ * @return Position of the closing quote (length if none).
+ *
+ */
+static size_t find_quote(const char *line, size_t length, size_t pos)
+{
+	while (pos < length) {
+		if (line[pos] == '\\')
+			pos += 2;
+		else if (line[pos] == '"')
+			return pos;
+		else
+			pos++;
+	}
+	
+	return length;
+}
+
+/** Parse token up to a space
+ *
+ * @param line   Log entry.
+ * @param length Length of the log entry.
+ * @param pos    Position (advanced past the space).
+ * @param entry  Structured entry.
+ * @param which  String to store the token to.
+ *
+ * @return True on success.
+ *
+ */
+static bool parse_token(const char *line, size_t length, size_t &pos,
+    entry_t &entry, binlog_string_t which)
+{
+	const char *space = (const char *) memchr(line + pos, ' ', length - pos);
+	if (space == NULL)
+		return false;
+	
+	entry.strings[which] = line + pos;
+	entry.lengths[which] = space - (line + pos);
+	pos = space - line + 1;
+	
+	return true;
+}
+
+/** Parse quoted string followed by a space (or the end)
+ *
+ * @param line   Log entry.
+ * @param length Length of the log entry.
+ * @param pos    Position (advanced past the closing quote).
+ * @param entry  Structured entry.
+ * @param which  String to store the quoted string to.
+ *
+ * @return True on success.
+ *
+ */
+static bool parse_quoted(const char *line, size_t length, size_t &pos,
+    entry_t &entry, binlog_string_t which)
+{
+	if ((pos >= length) || (line[pos] != '"'))
+		return false;
+	
+	size_t end = find_quote(line, length, pos + 1);
+	if (end == length)
+		return false;
+	
+	entry.strings[which] = line + pos + 1;
+	entry.lengths[which] = end - pos - 1;
+	pos = end + 1;
+	
+	return true;
+}
+
+/** Parse combined log entry
+ *
+ * The entry is parsed leniently, the caller verifies
+ * that the entry is reproduced exactly by render().
+ *
+ * @param line   Log entry (without the virtual host).
+ * @param length Length of the log entry.
+ * @param entry  Structured entry.
+ *
+ * @return True if the entry looks like a combined log entry.
+ *
+ */
+static bool parse(const char *line, size_t length, entry_t &entry)
+{
+	size_t pos = 0;
+	entry.flags = 0;
+	
+	/* Client address, identity, user */
+	if ((!parse_token(line, length, pos, entry, BINLOG_HOST)) ||
+	    (!parse_token(line, length, pos, entry, BINLOG_IDENT)) ||
+	    (!parse_token(line, length, pos, entry, BINLOG_USER)))
+		return false;
+	
+	if (address_decode(entry.strings[BINLOG_HOST], entry.lengths[BINLOG_HOST],
+	    entry.addr)) {
+		if (memchr(entry.strings[BINLOG_HOST], ':',
+		    entry.lengths[BINLOG_HOST]) == NULL) {
+			memmove(entry.addr, entry.addr + 12, 4);
+			entry.flags |= FLAG_IPV4;
+		} else
+			entry.flags |= FLAG_IPV6;
+	}
+	
+	/* Time */
+	if ((pos + TIMESTAMP_LENGTH + 3 > length) || (line[pos] != '[') ||
+	    (line[pos + TIMESTAMP_LENGTH + 1] != ']') ||
+	    (line[pos + TIMESTAMP_LENGTH + 2] != ' '))
+		return false;
+	
+	const char *time = line + pos + 1;
+	datetime res;
+	
+	res.month = 0;
+	for (unsigned int i = 0; i < 12; i++) {
+		if (memcmp(time + 3, months + 3 * i, 3) == 0)
+			res.month = i + 1;
+	}
+	
+	if ((res.month == 0) ||
+	    (!digits_decode(time, 2, res.day)) ||
+	    (!digits_decode(time + 7, 4, res.year)) ||
+	    (!digits_decode(time + 12, 2, res.hour)) ||
+	    (!digits_decode(time + 15, 2, res.minute)) ||
+	    (!digits_decode(time + 18, 2, res.second)) ||
+	    (!digits_decode(time + 22, 4, res.offset)))
+		return false;
+	
+	if (time[21] == '-')
+		res.offset = -res.offset;
+	
+	entry.time = datetime_epoch(res);
+	entry.offset = res.offset;
+	pos += TIMESTAMP_LENGTH + 3;
+	
+	/* Request line */
+	if (!parse_quoted(line, length, pos, entry, BINLOG_REQUEST))
+		return false;
+	
+	const char *request = entry.strings[BINLOG_REQUEST];
+	size_t request_length = entry.lengths[BINLOG_REQUEST];
+	const char *first = (const char *) memchr(request, ' ', request_length);
+	const char *last = (const char *) memrchr(request, ' ', request_length);
+	
+	if ((first != NULL) && (first != last)) {
+		entry.strings[BINLOG_METHOD] = request;
+		entry.lengths[BINLOG_METHOD] = first - request;
+		entry.strings[BINLOG_PATH] = first + 1;
+		entry.lengths[BINLOG_PATH] = last - first - 1;
+		entry.strings[BINLOG_PROTOCOL] = last + 1;
+		entry.lengths[BINLOG_PROTOCOL] = request + request_length - last - 1;
+		entry.flags |= FLAG_REQUEST;
+	}
+	
+	/* Status */
+	long int status;
+	if ((pos + 5 > length) || (line[pos] != ' ') ||
+	    (!digits_decode(line + pos + 1, 3, status)) || (line[pos + 4] != ' '))
+		return false;
+	
+	entry.status = status;
+	pos += 5;
+	
+	/* Size */
+	const char *space = (const char *) memchr(line + pos, ' ', length - pos);
+	if (space == NULL)
+		return false;
+	
+	size_t size_length = space - (line + pos);
+	if ((size_length == 1) && (line[pos] == '-'))
+		entry.bytes = 0;
+	else {
+		uint64_t size;
+		if ((size_length > 18) ||
+		    (!span_decode(line + pos, size_length, size)))
+			return false;
+		
+		entry.bytes = size + 1;
+	}
+	
+	pos += size_length + 1;
+	
+	/* Referer and user agent */
+	if ((!parse_quoted(line, length, pos, entry, BINLOG_REFERER)) ||
+	    (pos >= length) || (line[pos] != ' '))
+		return false;
+	
+	pos++;
+	if (!parse_quoted(line, length, pos, entry, BINLOG_AGENT))
+		return false;
+	
+	/* Anything else */
+	if (pos < length) {
+		entry.strings[BINLOG_REST] = line + pos;
+		entry.lengths[BINLOG_REST] = length - pos;
+		entry.flags |= FLAG_REST;
+	}
+	
+	return true;
+}
+
+/** Append string of an entry
+ *
+ * @param out   Output.
+ * @param entry Structured entry.
+ * @param which String of the entry.
+ *
+ */
+static inline void render_string(string &out, const entry_t &entry,
+    binlog_string_t which)
+{
+	out.append(entry.strings[which], entry.lengths[which]);
+}
+
+/** Render combined log entry
+ *
+ * @param entry Structured entry.
+ * @param out   Log entry text.
+ *
+ */
+static void render(const entry_t &entry, string &out)
+{
+	char buf[INET6_ADDRSTRLEN + 1];
+	
+	out.clear();
+	
+	if (entry.flags & FLAG_IPV4) {
+		inet_ntop(AF_INET, entry.addr, buf, sizeof(buf));
+		out += buf;
+	} else if (entry.flags & FLAG_IPV6) {
+		inet_ntop(AF_INET6, entry.addr, buf, sizeof(buf));
+		out += buf;
+	} else
+		render_string(out, entry, BINLOG_HOST);
+	
+	out += ' ';
+	render_string(out, entry, BINLOG_IDENT);
+	out += ' ';
+	render_string(out, entry, BINLOG_USER);
+	
+	datetime time;
+	datetime_civil(entry.time, entry.offset, time);
+	
+	/* Room for any values (invalid entries are not reproduced) */
+	char timestamp[128];
+	snprintf(timestamp, sizeof(timestamp),
+	    " [%02ld/%.3s/%04ld:%02ld:%02ld:%02ld %c%04ld] \"", time.day,
+	    months + 3 * (time.month - 1), time.year, time.hour, time.minute,
+	    time.second, (time.offset < 0) ? '-' : '+',
+	    (time.offset < 0) ? -time.offset : time.offset);
+	out += timestamp;
+	
+	if (entry.flags & FLAG_REQUEST) {
+		render_string(out, entry, BINLOG_METHOD);
+		out += ' ';
+		render_string(out, entry, BINLOG_PATH);
+		out += ' ';
+		render_string(out, entry, BINLOG_PROTOCOL);
+	} else
+		render_string(out, entry, BINLOG_REQUEST);
+	
+	if (entry.bytes == 0)
+		snprintf(buf, sizeof(buf), "\" %03u -", entry.status);
+	else
+		snprintf(buf, sizeof(buf), "\" %03u %llu", entry.status,
+		    (unsigned long long) (entry.bytes - 1));
+	
+	out += buf;
+	out += " \"";
+	render_string(out, entry, BINLOG_REFERER);
+	out += "\" \"";
+	render_string(out, entry, BINLOG_AGENT);
+	out += '"';
+	
+	if (entry.flags & FLAG_REST)
+		render_string(out, entry, BINLOG_REST);
+}
+
+/** Enable binary logs */
+void binlog_init(void)
+{
+	enabled = true;
+	last_check = monotonic_ms();
+}
+
+/** Encode dictionary string
+ *
+ * Known strings are encoded as their identifier plus one,
+ * new strings as zero followed by the length and the
+ * string, which is added to the dictionary (unless full).
+ *
+ * @param encoder Encoder state.
+ * @param which   Dictionary.
+ * @param str     String.
+ * @param length  Length of the string.
+ * @param buf     Output buffer.
+ *
+ */
+static void encode_string(encoder_t &encoder, binlog_string_t which,
+    const char *str, size_t length, string &buf)
+{
+	vector< string> &dict = encoder.dicts[which];
+	uint64_t hash = hash_bytes(str, length);
+	
+	unordered_map< uint64_t, uint32_t>::const_iterator it =
+	    encoder.index[which].find(hash);
+	if ((it != encoder.index[which].end()) &&
+	    (dict[it->second].length() == length) &&
+	    (memcmp(dict[it->second].c_str(), str, length) == 0)) {
+		put_varint(buf, it->second + 1);
+		return;
+	}
+	
+	put_varint(buf, 0);
+	put_varint(buf, length);
+	buf.append(str, length);
+	
+	/* Hash collisions are added, but cannot be found */
+	if (dict.size() < BINLOG_DICT_MAX) {
+		if (it == encoder.index[which].end())
+			encoder.index[which][hash] = dict.size();
+		
+		dict.push_back(string(str, length));
+	}
+}
+
+/** Encode structured entry
+ *
+ * @param encoder Encoder state.
+ * @param entry   Structured entry.
+ * @param buf     Output buffer.
+ *
+ */
+static void encode_entry(encoder_t &encoder, const entry_t &entry,
+    string &buf)
+{
+	uint8_t flags = entry.flags;
+	if (entry.offset != encoder.offset)
+		flags |= FLAG_OFFSET;
+	
+	buf += (char) BINLOG_ENTRY;
+	buf += (char) flags;
+	
+	if (flags & FLAG_OFFSET) {
+		put_varint(buf, zigzag(entry.offset));
+		encoder.offset = entry.offset;
+	}
+	
+	put_varint(buf, zigzag(entry.time - encoder.time));
+	encoder.time = entry.time;
+	
+	if (flags & FLAG_IPV4)
+		buf.append((const char *) entry.addr, 4);
+	else if (flags & FLAG_IPV6)
+		buf.append((const char *) entry.addr, ADDRESS_LENGTH);
+	else
+		encode_string(encoder, BINLOG_HOST, entry.strings[BINLOG_HOST],
+		    entry.lengths[BINLOG_HOST], buf);
+	
+	encode_string(encoder, BINLOG_IDENT, entry.strings[BINLOG_IDENT],
+	    entry.lengths[BINLOG_IDENT], buf);
+	encode_string(encoder, BINLOG_USER, entry.strings[BINLOG_USER],
+	    entry.lengths[BINLOG_USER], buf);
+	
+	if (flags & FLAG_REQUEST) {
+		encode_string(encoder, BINLOG_METHOD, entry.strings[BINLOG_METHOD],
+		    entry.lengths[BINLOG_METHOD], buf);
+		encode_string(encoder, BINLOG_PATH, entry.strings[BINLOG_PATH],
+		    entry.lengths[BINLOG_PATH], buf);
+		encode_string(encoder, BINLOG_PROTOCOL,
+		    entry.strings[BINLOG_PROTOCOL], entry.lengths[BINLOG_PROTOCOL],
+		    buf);
+	} else
+		encode_string(encoder, BINLOG_REQUEST, entry.strings[BINLOG_REQUEST],
+		    entry.lengths[BINLOG_REQUEST], buf);
+	
+	unsigned int code = 0;
+	for (unsigned int i = 0; i < STATUSES; i++) {
+		if (statuses[i] == entry.status) {
+			code = i + 1;
+			break;
+		}
+	}
+	
+	put_varint(buf, code);
+	if (code == 0)
+		put_varint(buf, entry.status);
+	
+	put_varint(buf, entry.bytes);
+	
+	encode_string(encoder, BINLOG_REFERER, entry.strings[BINLOG_REFERER],
+	    entry.lengths[BINLOG_REFERER], buf);
+	encode_string(encoder, BINLOG_AGENT, entry.strings[BINLOG_AGENT],
+	    entry.lengths[BINLOG_AGENT], buf);
+	
+	if (flags & FLAG_REST)
+		encode_string(encoder, BINLOG_REST, entry.strings[BINLOG_REST],
+		    entry.lengths[BINLOG_REST], buf);
+}
+
+/** Drop the encoder state
+ *
+ * The next entry starts a new segment, thus no
+ * record refers to the dictionary strings which
+ * might not have reached the file.
+ *
+ * @param encoder Encoder state.
+ *
+ */
+static void reset_encoder(encoder_t &encoder)
+{
+	for (unsigned int i = 0; i < BINLOG_STRINGS; i++) {
+		encoder.index[i].clear();
+		encoder.dicts[i].clear();
+	}
+	
+	encoder.started = false;
+}
+
+/** Append log entry to the binary domain log
+ *
+ * Entries which are not reproduced exactly from
+ * their structure are stored verbatim. The records
+ * of a segment refer to the dictionaries built by
+ * the previous records, thus the file is locked
+ * while appending and a new segment is started
+ * whenever the file is not the one last written
+ * (e.g. another process appended to it or it has
+ * been rotated). A record not written completely
+ * is truncated and the dictionaries are dropped.
+ *
+ * @param domain Domain of the log entry (located).
+ * @param access Log entry as stored in the text domain log.
+ *
+ * @return True if the entry has been stored.
+ *
+ */
+bool binlog_entry(domain_t *domain, const string &access)
+{
+	static string name;
+	static string buf;
+	static string rendered;
+	
+	if (!enabled)
+		return false;
+	
+	name.assign(domain->name);
+	name.append(BINLOG_SUFFIX);
+	
+	int fd = logdir_open(domain->dir, name, O_APPEND);
+	if (fd < 0)
+		return false;
+	
+	encoder_t *&encoder = encoders[domain->log_path];
+	if (encoder == NULL) {
+		encoder = new encoder_t;
+		encoder->started = false;
+	}
+	
+	encoder->touched = monotonic_ms();
+	buf.clear();
+	
+	/* Exclusive with other writers of the file */
+	struct stat st;
+	if ((flock(fd, LOCK_EX) != 0) || (fstat(fd, &st) != 0)) {
+		close(fd);
+		return false;
+	}
+	
+	if ((encoder->started) && (st.st_size != encoder->size))
+		reset_encoder(*encoder);
+	
+	/* New segment (the dictionaries of the previous are unknown) */
+	if (!encoder->started) {
+		buf += (char) BINLOG_RESET;
+		buf += "ALB";
+		buf += (char) BINLOG_VERSION;
+		
+		encoder->time = 0;
+		encoder->offset = 0;
+		encoder->started = true;
+	}
+	
+	entry_t entry;
+	bool structured = parse(access.c_str(), access.length(), entry);
+	
+	if (structured) {
+		render(entry, rendered);
+		structured = (rendered == access);
+	}
+	
+	if (structured)
+		encode_entry(*encoder, entry, buf);
+	else {
+		buf += (char) BINLOG_RAW;
+		put_varint(buf, access.length());
+		buf += access;
+	}
+	
+	bool stored = write_long(fd, buf.c_str(), buf.length());
+	
+	if (stored)
+		encoder->size = st.st_size + buf.length();
+	else {
+		/* Do not leave a partial record behind (best effort) */
+		ftruncate(fd, st.st_size);
+		reset_encoder(*encoder);
+	}
+	
+	close(fd);
+	return stored;
+}
+
+/** Evict idle encoder states periodically
+ *
+ * Does nothing until the check interval
+ * elapses, thus it is cheap to call per line.
+ *
+ */
+void binlog_tick(void)
+{
+	if (!enabled)
+		return;
+	
+	uint64_t now = monotonic_ms();
+	if (now - last_check < BINLOG_INTERVAL)
+		return;
+	
+	for (encoder_map::iterator it = encoders.begin();
+	    it != encoders.end(); ) {
+		if (now - it->second->touched > BINLOG_IDLE) {
+			delete it->second;
+			it = encoders.erase(it);
+		} else
+			++it;
+	}
+	
+	last_check = now;
+}
+
+/** Initialize binary log decoder
+ *
+ * @param decoder Decoder state.
+ *
+ */
+void binlog_decoder_init(binlog_decoder_t &decoder)
+{
+	for (unsigned int i = 0; i < BINLOG_STRINGS; i++)
+		decoder.dicts[i].clear();
+	
+	decoder.time = 0;
+	decoder.offset = 0;
+	decoder.started = false;
+}
+
+/** Decode dictionary string
+ *
+ * @param decoder Decoder state.
+ * @param which   Dictionary.
+ * @param data    Data.
+ * @param size    Size of the data.
+ * @param pos     Position (advanced past the string).
+ * @param entry   Structured entry.
+ *
+ * @return True on success.
+ *
+ */
+static bool decode_string(binlog_decoder_t &decoder, binlog_string_t which,
+    const uint8_t *data, size_t size, size_t &pos, entry_t &entry)
+{
+	vector< string> &dict = decoder.dicts[which];
+	uint64_t id;
+	
+	if (!get_varint(data, size, pos, id))
+		return false;
+	
+	if (id > 0) {
+		if (id > dict.size())
+			return false;
+		
+		entry.strings[which] = dict[id - 1].c_str();
+		entry.lengths[which] = dict[id - 1].length();
+		return true;
+	}
+	
+	uint64_t length;
+	if ((!get_varint(data, size, pos, length)) || (length > size - pos))
+		return false;
+	
+	entry.strings[which] = (const char *) data + pos;
+	entry.lengths[which] = length;
+	
+	/* Each dictionary grows at most once per entry */
+	if (dict.size() < BINLOG_DICT_MAX) {
+		dict.push_back(string((const char *) data + pos, length));
+		entry.strings[which] = dict.back().c_str();
+	}
+	
+	pos += length;
+	return true;
+}
+
+/** Decode structured entry
+ *
+ * @param decoder Decoder state.
+ * @param data    Data.
+ * @param size    Size of the data.
+ * @param pos     Position (advanced past the entry).
+ * @param entry   Structured entry.
+ *
+ * @return True on success.
+ *
+ */
+static bool decode_entry(binlog_decoder_t &decoder, const uint8_t *data,
+    size_t size, size_t &pos, entry_t &entry)
+{
+	if (pos >= size)
+		return false;
+	
+	entry.flags = data[pos++];
+	uint64_t val;
+	
+	if (entry.flags & FLAG_OFFSET) {
+		if (!get_varint(data, size, pos, val))
+			return false;
+		
+		decoder.offset = unzigzag(val);
+	}
+	
+	if (!get_varint(data, size, pos, val))
+		return false;
+	
+	decoder.time += unzigzag(val);
+	entry.time = decoder.time;
+	entry.offset = decoder.offset;
+	
+	if (entry.flags & (FLAG_IPV4 | FLAG_IPV6)) {
+		size_t length = (entry.flags & FLAG_IPV4) ? 4 : ADDRESS_LENGTH;
+		if (length > size - pos)
+			return false;
+		
+		memcpy(entry.addr, data + pos, length);
+		pos += length;
+	} else if (!decode_string(decoder, BINLOG_HOST, data, size, pos, entry))
+		return false;
+	
+	if ((!decode_string(decoder, BINLOG_IDENT, data, size, pos, entry)) ||
+	    (!decode_string(decoder, BINLOG_USER, data, size, pos, entry)))
+		return false;
+	
+	if (entry.flags & FLAG_REQUEST) {
+		if ((!decode_string(decoder, BINLOG_METHOD, data, size, pos,
+		    entry)) ||
+		    (!decode_string(decoder, BINLOG_PATH, data, size, pos, entry)) ||
+		    (!decode_string(decoder, BINLOG_PROTOCOL, data, size, pos,
+		    entry)))
+			return false;
+	} else if (!decode_string(decoder, BINLOG_REQUEST, data, size, pos,
+	    entry))
+		return false;
+	
+	if (!get_varint(data, size, pos, val))
+		return false;
+	
+	if (val > STATUSES)
+		return false;
+	
+	if (val > 0)
+		entry.status = statuses[val - 1];
+	else {
+		if ((!get_varint(data, size, pos, val)) || (val > 999))
+			return false;
+		
+		entry.status = val;
+	}
+	
+	if (!get_varint(data, size, pos, entry.bytes))
+		return false;
+	
+	if ((!decode_string(decoder, BINLOG_REFERER, data, size, pos, entry)) ||
+	    (!decode_string(decoder, BINLOG_AGENT, data, size, pos, entry)))
+		return false;
+	
+	if ((entry.flags & FLAG_REST) &&
+	    (!decode_string(decoder, BINLOG_REST, data, size, pos, entry)))
+		return false;
+	
+	return true;
+}
+
+/** Decode the next log entry
+ *
+ * @param decoder Decoder state.
+ * @param data    Data (starting at a record).
+ * @param size    Size of the data.
+ * @param line    Decoded log entry text.
+ *
+ * @return Number of bytes consumed (including the preceding
+ *         segment headers).
+ * @return 0 if the data is truncated.
+ * @return -1 if the data is invalid.
+ *
+ */
+ssize_t binlog_decode(binlog_decoder_t &decoder, const uint8_t *data,
+    size_t size, string &line)
+{
+	size_t pos = 0;
+	
+	while (true) {
+		if (pos >= size)
+			return 0;
+		
+		uint8_t type = data[pos++];
+		
+		if (type == BINLOG_RESET) {
+			if (size - pos < 4)
+				return 0;
+			
+			if ((memcmp(data + pos, "ALB", 3) != 0) ||
+			    (data[pos + 3] != BINLOG_VERSION))
+				return -1;
+			
+			binlog_decoder_init(decoder);
+			decoder.started = true;
+			pos += 4;
+			continue;
+		}
+		
+		if (!decoder.started)
+			return -1;
+		
+		if (type == BINLOG_RAW) {
+			uint64_t length;
+			if (!get_varint(data, size, pos, length))
+				return 0;
+			
+			if (length > size - pos)
+				return 0;
+			
+			line.assign((const char *) data + pos, length);
+			return pos + length;
+		}
+		
+		if (type != BINLOG_ENTRY)
+			return -1;
+		
+		entry_t entry;
+		if (!decode_entry(decoder, data, size, pos, entry))
+			return -1;
+		
+		render(entry, line);
+		return pos;
+	}
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BINLOG_H_
+#define BINLOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include "domains.h"
+#include "util.h"
+
+/** Suffix of the binary domain log (appended to the domain log path) */
+#define BINLOG_SUFFIX  ".bin"
+
+/** Binary log format version */
+#define BINLOG_VERSION  1
+
+/** Maximal number of strings in each dictionary of a segment */
+#define BINLOG_DICT_MAX  16384
+
+/** Binary log record types
+ *
+ * A binary log is a sequence of segments, each starting
+ * with a BINLOG_RESET record ("ALB" and the version),
+ * which resets the dictionaries and the time base. The
+ * following records are either BINLOG_ENTRY (structured
+ * combined log entry) or BINLOG_RAW (varint length and
+ * the verbatim entry which cannot be reproduced from the
+ * structure).
+ *
+ */
+typedef enum {
+	BINLOG_RESET,
+	BINLOG_ENTRY,
+	BINLOG_RAW
+} binlog_record_type_t;
+
+typedef enum {
+	BINLOG_HOST,
+	BINLOG_IDENT,
+	BINLOG_USER,
+	BINLOG_METHOD,
+	BINLOG_PATH,
+	BINLOG_PROTOCOL,
+	BINLOG_REQUEST,
+	BINLOG_REFERER,
+	BINLOG_AGENT,
+	BINLOG_REST,
+	BINLOG_STRINGS
+} binlog_string_t; /**< Dictionary-encoded strings of an entry */
+
+typedef struct {
+	/* Dictionaries (indexed by the string identifiers) */
+	std::vector< std::string> dicts[BINLOG_STRINGS];
+	
+	/* Time base */
+	int64_t time;
+	long int offset;
+	
+	/* Segment started */
+	bool started;
+} binlog_decoder_t; /**< Binary log decoder state */
+
+extern void binlog_init(void);
+extern bool binlog_entry(domain_t *, const std::string &);
+extern void binlog_tick(void);
+
+extern void binlog_decoder_init(binlog_decoder_t &);
+extern ssize_t binlog_decode(binlog_decoder_t &, const uint8_t *, size_t,
+    std::string &);
+
+#endif
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "bots.h"
+#include "ahocorasick.h"
+
+using namespace std;
+
+/** Number of cached classification results (power of 2) */
+#define CACHE_SIZE  512
+
+/** Maximal length of a cached user agent */
+#define CACHE_AGENT_LENGTH  240
+
+typedef struct {
+	uint32_t length;
+	bool bot;
+	char agent[CACHE_AGENT_LENGTH];
+} cache_entry_t; /**< Cached classification of a user agent */
+
+/** Crawler user agent signatures (matched case-insensitively)
+ *
+ * Specific signatures of the well-known crawlers, followed
+ * by the generic markers used by most of the others.
+ *
+ */
+static const char *signatures[] = {
+	"googlebot",
+	"adsbot-google",
+	"mediapartners-google",
+	"apis-google",
+	"google-inspectiontool",
+	"storebot-google",
+	"googleother",
+	"bingbot",
+	"bingpreview",
+	"msnbot",
+	"adidxbot",
+	"slurp",
+	"duckduckbot",
+	"baiduspider",
+	"yandex",
+	"sogou",
+	"exabot",
+	"seznambot",
+	"yeti/",
+	"daum",
+	"coccocbot",
+	"qwantify",
+	"petalbot",
+	"applebot",
+	"facebookexternalhit",
+	"facebot",
+	"meta-externalagent",
+	"twitterbot",
+	"linkedinbot",
+	"pinterestbot",
+	"slackbot",
+	"discordbot",
+	"telegrambot",
+	"whatsapp",
+	"skypeuripreview",
+	"ia_archiver",
+	"archive.org_bot",
+	"ahrefsbot",
+	"semrushbot",
+	"mj12bot",
+	"dotbot",
+	"blexbot",
+	"dataforseobot",
+	"serpstatbot",
+	"megaindex",
+	"rogerbot",
+	"screaming frog",
+	"siteauditbot",
+	"zoominfobot",
+	"gptbot",
+	"chatgpt-user",
+	"oai-searchbot",
+	"claudebot",
+	"anthropic-ai",
+	"perplexitybot",
+	"ccbot",
+	"bytespider",
+	"amazonbot",
+	"imagesiftbot",
+	"uptimerobot",
+	"pingdom",
+	"statuscake",
+	"site24x7",
+	"crawler",
+	"spider",
+	"bot/",
+	"bot;",
+	"bot)",
+	"+http"
+};
+
+/** Compiled signatures */
+static ahocorasick_t automaton;
+
+/** Classification results of the recent user agents
+ *
+ * Only a handful of distinct user agents make most of
+ * the requests, thus comparing the user agent with the
+ * cached one is much cheaper than running the automaton.
+ *
+ */
+static cache_entry_t *cache = NULL;
+
+/** Bot classification enabled */
+static bool enabled = false;
+
+/** Initialize bot traffic classification
+ *
+ * @param format Compiled log format (the user agent is required).
+ *
+ * @return False if the format does not contain the user agent.
+ *
+ */
+bool bots_init(logformat_t &format)
+{
+	if (!logformat_require(format, FIELD_USER_AGENT))
+		return false;
+	
+	vector< string> patterns(signatures,
+	    signatures + sizeof(signatures) / sizeof(signatures[0]));
+	ahocorasick_build(automaton, patterns, true);
+	
+	cache = new cache_entry_t[CACHE_SIZE];
+	for (unsigned int i = 0; i < CACHE_SIZE; i++)
+		cache[i].length = UINT32_MAX;
+	
+	enabled = true;
+	return true;
+}
+
+/** Cache slot of a user agent
+ *
+ * Only the length and a few bytes at the end (where the
+ * versions of the user agents differ) are hashed, the
+ * slot is verified by comparing the whole user agent.
+ *
+ * @param agent  User agent.
+ * @param length Length of the user agent.
+ *
+ * @return Cache slot.
+ *
+ */
+static inline unsigned int cache_slot(const char *agent, size_t length)
+{
+	uint64_t tail = 0;
+	size_t tail_length = length < sizeof(tail) ? length : sizeof(tail);
+	
+	memcpy(&tail, agent + length - tail_length, tail_length);
+	
+	uint64_t hash = (tail ^ length) * UINT64_C(0x9e3779b97f4a7c15);
+	return (hash >> 32) & (CACHE_SIZE - 1);
+}
+
+/** Classify log entry
+ *
+ * @param line   Log entry.
+ * @param fields Parsed log entry.
+ *
+ * @return True if the user agent is a known crawler.
+ *
+ */
+bool bots_entry(const char *line, const log_fields_t &fields)
+{
+	if (!enabled)
+		return false;
+	
+	const field_span_t &agent = fields.field[FIELD_USER_AGENT];
+	if (agent.start == FIELD_ABSENT)
+		return false;
+	
+	const char *str = line + agent.start;
+	
+	if (agent.length > CACHE_AGENT_LENGTH)
+		return ahocorasick_any(automaton, str, agent.length);
+	
+	cache_entry_t &entry = cache[cache_slot(str, agent.length)];
+	
+	if ((entry.length != agent.length) ||
+	    (memcmp(entry.agent, str, agent.length) != 0)) {
+		entry.length = agent.length;
+		entry.bot = ahocorasick_any(automaton, str, agent.length);
+		memcpy(entry.agent, str, agent.length);
+	}
+	
+	return entry.bot;
+}
@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "columns.h"
+#include "timer.h"
+
+using namespace std;
+
+/** Maximal number of rows of a row group */
+#define COLUMNS_ROWS  16384
+
+/** Row groups idle for longer are flushed (ms) */
+#define COLUMNS_IDLE  300000
+
+/** Row groups older are flushed (ms) */
+#define COLUMNS_AGE  3600000
+
+/** Flush check interval (ms) */
+#define COLUMNS_INTERVAL  10000
+
+typedef struct {
+	field_t field;
+	column_encoding_t encoding;
+	
+	/* Index of the directive in the LogFormat */
+	size_t item;
+	
+	/* Integer values or dictionary indices plus one */
+	vector< int64_t> values;
+	
+	/* Dictionary */
+	unordered_map< string, uint32_t> index;
+	vector< const string *> dict;
+} column_t; /**< Column being built */
+
+typedef struct {
+	vector< column_t> columns;
+	uint32_t rows;
+	
+	uint64_t started;
+	uint64_t touched;
+	
+	/* Month directory (relative to the prefix) and columnar file name */
+	string dir;
+	string name;
+} row_group_t; /**< Row group being built */
+
+/** Row groups indexed by the domain log path */
+typedef unordered_map< string, row_group_t *> row_group_map;
+
+/** Columnar export enabled */
+static bool enabled = false;
+
+/** Log format of the entries */
+static const logformat_t *format;
+
+/** Directives exported (indices in the LogFormat, in the column order) */
+static vector< size_t> items_exported;
+
+/** Spans of the directives of the current entry */
+static vector< field_span_t> spans;
+
+/** Row groups being built */
+static row_group_map groups;
+
+/** Time of the last flush check (ms) */
+static uint64_t last_check;
+
+/** Append unsigned varint (LEB128)
+ *
+ * @param buf Buffer.
+ * @param val Value.
+ *
+ */
+static void put_varint(string &buf, uint64_t val)
+{
+	while (val >= 0x80) {
+		buf += (char) ((val & 0x7f) | 0x80);
+		val >>= 7;
+	}
+	
+	buf += (char) val;
+}
+
+/** Enable columnar export
+ *
+ * There is a column for each directive of the
+ * format except the virtual host.
+ *
+ * @param compiled Compiled log format.
+ *
+ */
+void columns_init(const logformat_t &compiled)
+{
+	format = &compiled;
+	
+	for (size_t i = 0; i < compiled.items.size(); i++) {
+		if (compiled.items[i].field != FIELD_VHOST)
+			items_exported.push_back(i);
+	}
+	
+	enabled = true;
+	last_check = monotonic_ms();
+}
+
+/** Encode column
+ *
+ * @param column Column.
+ * @param buf    Output buffer.
+ *
+ */
+static void encode_column(const column_t &column, string &buf)
+{
+	if (column.encoding == COLUMN_STRING) {
+		put_varint(buf, column.dict.size());
+		
+		for (size_t i = 0; i < column.dict.size(); i++) {
+			put_varint(buf, column.dict[i]->length());
+			buf += *column.dict[i];
+		}
+	}
+	
+	/* Run-length encoding */
+	int64_t previous = 0;
+	size_t pos = 0;
+	
+	while (pos < column.values.size()) {
+		int64_t value = column.values[pos];
+		size_t run = 1;
+		
+		while ((pos + run < column.values.size()) &&
+		    (column.values[pos + run] == value))
+			run++;
+		
+		if (column.encoding == COLUMN_INT) {
+			/* Wrapping difference, zigzag-encoded */
+			uint64_t delta = (uint64_t) value - (uint64_t) previous;
+			put_varint(buf, (delta << 1) ^ -(delta >> 63));
+			previous = value;
+		} else
+			put_varint(buf, value);
+		
+		put_varint(buf, run);
+		pos += run;
+	}
+}
+
+/** Append row group to the columnar file and reset it
+ *
+ * @param dir   Month directory of the columnar file (NULL
+ *              to look it up by the path of the group).
+ * @param group Row group.
+ *
+ */
+static void flush_group(logdir_t *dir, row_group_t &group)
+{
+	if (group.rows == 0)
+		return;
+	
+	string buf;
+	
+	columns_group_t header;
+	header.magic = COLUMNS_MAGIC;
+	header.version = COLUMNS_VERSION;
+	header.rows = group.rows;
+	header.columns = group.columns.size();
+	buf.append((const char *) &header, sizeof(header));
+	
+	string data;
+	for (size_t i = 0; i < group.columns.size(); i++) {
+		column_t &column = group.columns[i];
+		
+		data.clear();
+		encode_column(column, data);
+		
+		columns_column_t column_header;
+		column_header.field = column.field;
+		column_header.encoding = column.encoding;
+		column_header.item = column.item;
+		column_header.size = data.length();
+		
+		buf.append((const char *) &column_header, sizeof(column_header));
+		buf += data;
+		
+		column.values.clear();
+		column.index.clear();
+		column.dict.clear();
+	}
+	
+	if (dir == NULL)
+		dir = logdir_lookup(group.dir);
+	
+	int fd = (dir != NULL) ? logdir_open(dir, group.name, O_APPEND) : -1;
+	if (fd >= 0) {
+		write_long(fd, buf.c_str(), buf.length());
+		close(fd);
+	}
+	
+	group.rows = 0;
+}
+
+/** Create row group
+ *
+ * @param domain Domain of the log entries (located).
+ *
+ * @return Empty row group with the exported columns.
+ *
+ */
+static row_group_t *create_group(domain_t *domain)
+{
+	row_group_t *group = new row_group_t;
+	group->rows = 0;
+	group->dir = domain->dir->relative;
+	group->name = domain->name + COLUMNS_SUFFIX;
+	group->columns.resize(items_exported.size());
+	
+	for (size_t i = 0; i < items_exported.size(); i++) {
+		column_t &column = group->columns[i];
+		column.item = items_exported[i];
+		column.field = format->items[column.item].field;
+		
+		switch (column.field) {
+		case FIELD_TIME:
+		case FIELD_STATUS:
+		case FIELD_BYTES:
+		case FIELD_DURATION:
+		case FIELD_BYTES_IN:
+		case FIELD_BYTES_OUT:
+			column.encoding = COLUMN_INT;
+			break;
+		default:
+			column.encoding = COLUMN_STRING;
+		}
+	}
+	
+	return group;
+}
+
+/** Add log entry to the row group of its domain log
+ *
+ * @param domain Domain of the log entry (located).
+ * @param line   Log entry as stored.
+ * @param length Length of the log entry.
+ * @param time   Log entry date & time.
+ *
+ */
+void columns_entry(domain_t *domain, const char *line, size_t length,
+    const datetime &time)
+{
+	if (!enabled)
+		return;
+	
+	row_group_t *&group = groups[domain->log_path];
+	if (group == NULL)
+		group = create_group(domain);
+	
+	uint64_t now = monotonic_ms();
+	if (group->rows == 0)
+		group->started = now;
+	
+	group->touched = now;
+	
+	logformat_split(*format, line, length, spans);
+	
+	for (size_t i = 0; i < group->columns.size(); i++) {
+		column_t &column = group->columns[i];
+		const field_span_t &span = spans[column.item];
+		
+		if (column.field == FIELD_TIME) {
+			column.values.push_back(datetime_epoch(time));
+			continue;
+		}
+		
+		if (column.encoding == COLUMN_INT) {
+			uint64_t value;
+			
+			if ((span.start != FIELD_ABSENT) &&
+			    (span_decode(line + span.start, span.length, value)))
+				column.values.push_back(value);
+			else
+				column.values.push_back(COLUMNS_NULL);
+			
+			continue;
+		}
+		
+		if (span.start == FIELD_ABSENT) {
+			column.values.push_back(0);
+			continue;
+		}
+		
+		pair< unordered_map< string, uint32_t>::iterator, bool> res =
+		    column.index.insert(make_pair(string(line + span.start,
+		    span.length), column.dict.size()));
+		if (res.second)
+			column.dict.push_back(&res.first->first);
+		
+		column.values.push_back(res.first->second + 1);
+	}
+	
+	group->rows++;
+	if (group->rows >= COLUMNS_ROWS)
+		flush_group(domain->dir, *group);
+}
+
+/** Flush idle and old row groups periodically
+ *
+ * The row groups of the past months become idle
+ * and are flushed and released after the rollover.
+ * Does nothing until the check interval elapses,
+ * thus it is cheap to call per line.
+ *
+ */
+void columns_tick(void)
+{
+	if (!enabled)
+		return;
+	
+	uint64_t now = monotonic_ms();
+	if (now - last_check < COLUMNS_INTERVAL)
+		return;
+	
+	for (row_group_map::iterator it = groups.begin(); it != groups.end(); ) {
+		row_group_t *group = it->second;
+		
+		if (now - group->touched > COLUMNS_IDLE) {
+			flush_group(NULL, *group);
+			delete group;
+			it = groups.erase(it);
+			continue;
+		}
+		
+		if ((group->rows > 0) && (now - group->started > COLUMNS_AGE))
+			flush_group(NULL, *group);
+		
+		++it;
+	}
+	
+	last_check = now;
+}
+
+/** Flush all row groups */
+void columns_done(void)
+{
+	if (!enabled)
+		return;
+	
+	for (row_group_map::iterator it = groups.begin(); it != groups.end();
+	    ++it) {
+		flush_group(NULL, *it->second);
+		delete it->second;
+	}
+	
+	groups.clear();
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef COLUMNS_H_
+#define COLUMNS_H_
+
+#include <stdint.h>
+#include <string>
+#include "domains.h"
+#include "logformat.h"
+#include "util.h"
+
+/** Suffix of the columnar file (appended to the domain log path) */
+#define COLUMNS_SUFFIX  ".columns"
+
+/** Row group magic number ("ALCG") */
+#define COLUMNS_MAGIC  UINT32_C(0x47434c41)
+
+/** Columnar layout version */
+#define COLUMNS_VERSION  2
+
+/** Value of the missing numeric fields (e.g. "-" size) */
+#define COLUMNS_NULL  INT64_MIN
+
+/** Column encodings
+ *
+ * The columnar file is a sequence of row groups appended in
+ * the host byte order, each consisting of the row group
+ * header and one column per LogFormat directive (except the
+ * virtual host) in the format order. All varints are LEB128,
+ * the signed ones zigzag-encoded.
+ *
+ * COLUMN_INT (time as Unix time, status, sizes, duration):
+ * runs of (varint delta from the value of the previous run,
+ * varint run length), missing values are COLUMNS_NULL.
+ *
+ * COLUMN_STRING (all other directives, e.g. client address,
+ * identity, user, request line, referer, user agent, as
+ * logged including the escapes): varint dictionary size,
+ * dictionary strings (varint length and bytes), then runs
+ * of (varint dictionary index plus one, varint run length),
+ * zero meaning a missing value.
+ *
+ */
+typedef enum {
+	COLUMN_INT,
+	COLUMN_STRING
+} column_encoding_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t rows;
+	uint32_t columns;
+} columns_group_t; /**< Row group header */
+
+typedef struct {
+	/* LogFormat field (field_t, FIELD_NONE if not interpreted) */
+	uint8_t field;
+	
+	/* Encoding (column_encoding_t) */
+	uint8_t encoding;
+	
+	/* Index of the directive in the LogFormat */
+	uint16_t item;
+	
+	/* Size of the encoded column following */
+	uint32_t size;
+} columns_column_t; /**< Column header */
+
+extern void columns_init(const logformat_t &);
+extern void columns_entry(domain_t *, const char *, size_t,
+    const datetime &);
+extern void columns_tick(void);
+extern void columns_done(void);
+
+#endif
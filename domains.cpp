@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/random.h>
+#include <string.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "domains.h"
+#include "hash.h"
+#include "logdir.h"
+#include "psl.h"
+
+using namespace std;
+
+/** Initial number of hash table slots (power of two) */
+#define SLOTS_INITIAL  1024
+
+/** Empty hash table slot */
+#define SLOT_EMPTY  UINT32_MAX
+
+typedef struct {
+	/* Hash of the domain name */
+	uint64_t hash;
+	
+	/* Domain identifier (SLOT_EMPTY if the slot is empty) */
+	uint32_t id;
+} slot_t; /**< Hash table slot */
+
+/** Interned domains (indexed by the identifier, stable addresses) */
+static deque< domain_t> domains;
+
+/** Open addressing hash table (linear probing) */
+static vector< slot_t> slots;
+
+/** Derive the registrable domains from the Public Suffix List */
+static bool public_suffix = false;
+
+/**
+ * Hash key (the domain names come from the clients,
+ * thus the hash must not be predictable)
+ */
+static uint8_t key[SIPHASH_KEY_LENGTH];
+
+/** Reset the table
+ *
+ * @param size Number of hash table slots (power of two).
+ *
+ */
+static void reset(size_t size)
+{
+	slot_t empty;
+	empty.hash = 0;
+	empty.id = SLOT_EMPTY;
+	
+	slots.assign(size, empty);
+}
+
+/** Double the number of hash table slots
+ *
+ */
+static void grow(void)
+{
+	size_t mask = 2 * slots.size() - 1;
+	vector< slot_t> old;
+	old.swap(slots);
+	reset(mask + 1);
+	
+	for (size_t i = 0; i < old.size(); i++) {
+		if (old[i].id == SLOT_EMPTY)
+			continue;
+		
+		size_t pos = old[i].hash & mask;
+		while (slots[pos].id != SLOT_EMPTY)
+			pos = (pos + 1) & mask;
+		
+		slots[pos] = old[i];
+	}
+}
+
+/** Initialize the domain table
+ *
+ * @param registrable Store the logs under the registrable domain
+ *                    (Public Suffix List) instead of the last two
+ *                    parts of the domain name.
+ *
+ */
+void domains_init(bool registrable)
+{
+	public_suffix = registrable;
+	
+	/* A fixed key still works, just without the protection */
+	if (getrandom(key, sizeof(key), GRND_NONBLOCK) != sizeof(key))
+		memset(key, 0, sizeof(key));
+	
+	reset(SLOTS_INITIAL);
+}
+
+/** Intern a domain name
+ *
+ * Once a domain is interned, its lookup is a single hash
+ * table probe without any allocation. The second-level
+ * domain (the last two parts of the name or the registrable
+ * domain) is derived just once.
+ *
+ * @param name   Domain name.
+ * @param length Length of the domain name.
+ *
+ * @return Interned domain (valid until the table is reset
+ *         after DOMAINS_MAX domains).
+ *
+ */
+domain_t *domains_intern(const char *name, size_t length)
+{
+	uint64_t hash = siphash(key, name, length);
+	size_t mask = slots.size() - 1;
+	size_t pos = hash & mask;
+	
+	while (slots[pos].id != SLOT_EMPTY) {
+		if (slots[pos].hash == hash) {
+			domain_t &domain = domains[slots[pos].id];
+			if ((domain.name.length() == length) &&
+			    (memcmp(domain.name.data(), name, length) == 0))
+				return &domain;
+		}
+		
+		pos = (pos + 1) & mask;
+	}
+	
+	/* Keep the memory bounded (e.g. on random host names) */
+	if (domains.size() >= DOMAINS_MAX) {
+		domains.clear();
+		reset(SLOTS_INITIAL);
+		return domains_intern(name, length);
+	}
+	
+	uint32_t id = domains.size();
+	domains.push_back(domain_t());
+	
+	domain_t &domain = domains.back();
+	domain.id = id;
+	domain.name.assign(name, length);
+	domain.dir = NULL;
+	domain.generation = 0;
+	domain.year = 0;
+	domain.month = 0;
+	domain.anonymize = -1;
+	
+	/* Registrable domain or the last two parts of the domain name */
+	const char *last = (const char *) memrchr(name, '.', length);
+	size_t start;
+	
+	if ((public_suffix) && (last != NULL) &&
+	    (psl_registrable(name, length, start)))
+		domain.sld.assign(name + start, length - start);
+	else if (last != NULL) {
+		const char *second = (const char *) memrchr(name, '.', last - name);
+		start = (second != NULL) ? second - name + 1 : 0;
+		domain.sld.assign(name + start, length - start);
+	}
+	
+	slots[pos].hash = hash;
+	slots[pos].id = id;
+	
+	/* Keep the load factor under 3/4 */
+	if (4 * domains.size() >= 3 * slots.size())
+		grow();
+	
+	return &domain;
+}
+
+/** Locate the domain log
+ *
+ * The domain log path is cached in the domain and only
+ * rendered again when the month or the suffix changes.
+ *
+ * @param domain Interned domain.
+ * @param year   Year.
+ * @param month  Month (1-based).
+ * @param suffix Suffix of the domain directories.
+ *
+ * @return True if the month directory of the domain log
+ *         is available (domain->dir and domain->log_path).
+ *
+ */
+bool domains_locate(domain_t *domain, long int year, long int month,
+    const string &suffix)
+{
+	if ((domain->dir != NULL) && (domain->year == year) &&
+	    (domain->month == month) &&
+	    (domain->generation == logdir_generation()) &&
+	    (domain->suffix == suffix))
+		return true;
+	
+	domain->dir = logdir_get(domain->sld, year, month, suffix);
+	if (domain->dir == NULL)
+		return false;
+	
+	domain->generation = logdir_generation();
+	domain->year = year;
+	domain->month = month;
+	domain->suffix = suffix;
+	
+	domain->log_path.reserve(domain->dir->path.length() +
+	    domain->name.length() + 1);
+	domain->log_path.assign(domain->dir->path);
+	domain->log_path.push_back('/');
+	domain->log_path.append(domain->name);
+	
+	return true;
+}
+
+/** Release the domain table
+ *
+ */
+void domains_done(void)
+{
+	domains.clear();
+	slots.clear();
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DOMAINS_H_
+#define DOMAINS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "logdir.h"
+
+/** Maximal number of interned domains (the table is reset when full) */
+#define DOMAINS_MAX  (1 << 20)
+
+typedef struct {
+	/* Dense identifier (0, 1, 2, ...) */
+	uint32_t id;
+	
+	/* Domain name */
+	std::string name;
+	
+	/*
+	 * Second-level domain or the registrable domain
+	 * (empty if the name has a single part)
+	 */
+	std::string sld;
+	
+	/* Month directory of the domain log (NULL if not located yet) */
+	logdir_t *dir;
+	
+	/* Month directory cache generation of the directory */
+	uint64_t generation;
+	
+	/* Year and month of the domain log */
+	long int year;
+	long int month;
+	
+	/* Suffix of the domain directories */
+	std::string suffix;
+	
+	/* Domain log path */
+	std::string log_path;
+	
+	/* Anonymization mode (cached by anonymize_entry(), -1 if unknown) */
+	int anonymize;
+} domain_t; /**< Interned domain */
+
+extern void domains_init(bool);
+extern domain_t *domains_intern(const char *, size_t);
+extern bool domains_locate(domain_t *, long int, long int,
+    const std::string &);
+extern void domains_done(void);
+
+#endif
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <iostream>
+#include <string>
+#include "errors.h"
+#include "stats.h"
+#include "timer.h"
+
+using namespace std;
+
+/** Error summary interval (ms) */
+#define ERRORS_INTERVAL  10000
+
+/** Maximal length of the sample entry in the summary */
+#define SAMPLE_LENGTH  160
+
+/** Quarantine file buffer size */
+#define QUARANTINE_BUFFER  65536
+
+typedef struct {
+	uint64_t count;
+	string sample;
+	string detail;
+} error_summary_t; /**< Error class summary in the current interval */
+
+/** Descriptions of the error classes */
+static const char *descriptions[ERROR_CLASSES] = {
+	"lines without domain name",
+	"lines with invalid domain name",
+	"lines missing timestamp",
+	"lines with invalid timestamp",
+	"lines failed to be processed"
+};
+
+/** Error summaries in the current interval */
+static error_summary_t summaries[ERROR_CLASSES];
+
+/** Start of the current interval (ms) */
+static uint64_t interval_start;
+
+/** Quarantine file for the rejected entries (NULL if none) */
+static FILE *quarantine = NULL;
+
+/** Initialize error reporting
+ *
+ * @param path Quarantine file for the raw rejected entries
+ *             (NULL if the entries should not be kept).
+ *
+ * @return True on success.
+ *
+ */
+bool errors_init(const char *path)
+{
+	interval_start = monotonic_ms();
+	
+	if (path != NULL) {
+		quarantine = fopen(path, "a");
+		if (quarantine == NULL)
+			return false;
+		
+		setvbuf(quarantine, NULL, _IOFBF, QUARANTINE_BUFFER);
+	}
+	
+	return true;
+}
+
+/** Print the summary of the current interval
+ *
+ * @param elapsed Length of the current interval (ms).
+ *
+ */
+static void summarize(uint64_t elapsed)
+{
+	for (unsigned int i = 0; i < ERROR_CLASSES; i++) {
+		error_summary_t &summary = summaries[i];
+		
+		if (summary.count == 0)
+			continue;
+		
+		cerr << "accesslog: " << summary.count << " " <<
+		    descriptions[i] << " in last " << (elapsed + 500) / 1000 <<
+		    " s";
+		
+		if (!summary.detail.empty())
+			cerr << " (" << summary.detail << ")";
+		
+		cerr << ", sample: " << summary.sample << endl;
+		
+		summary.count = 0;
+		summary.sample.clear();
+		summary.detail.clear();
+	}
+	
+	if (quarantine != NULL)
+		fflush(quarantine);
+}
+
+/** Finish error reporting
+ *
+ * Print the summary of the last interval
+ * and close the quarantine file.
+ *
+ */
+void errors_done(void)
+{
+	summarize(monotonic_ms() - interval_start);
+	
+	if (quarantine != NULL) {
+		fclose(quarantine);
+		quarantine = NULL;
+	}
+}
+
+/** Report a rejected log entry
+ *
+ * The entry is only accounted, the error is
+ * reported in the periodic summary.
+ *
+ * @param error  Error class.
+ * @param entry  Rejected log entry.
+ * @param length Length of the rejected log entry.
+ * @param detail Error detail (NULL if none).
+ *
+ */
+void error_report(error_class_t error, const char *entry, size_t length,
+    const char *detail)
+{
+	error_summary_t &summary = summaries[error];
+	
+	/* Keep the first entry of the interval as a sample */
+	if (summary.count == 0) {
+		summary.sample.assign(entry,
+		    (length < SAMPLE_LENGTH) ? length : SAMPLE_LENGTH);
+		
+		if (detail != NULL)
+			summary.detail = detail;
+	}
+	
+	summary.count++;
+	stats_error(error);
+	
+	if (quarantine != NULL) {
+		fwrite(entry, 1, length, quarantine);
+		fputc('\n', quarantine);
+	}
+}
+
+/** Print the error summary periodically
+ *
+ * Does nothing until the summary interval
+ * elapses, thus it is cheap to call per line.
+ *
+ */
+void errors_tick(void)
+{
+	uint64_t now = monotonic_ms();
+	uint64_t elapsed = now - interval_start;
+	if (elapsed < ERRORS_INTERVAL)
+		return;
+	
+	summarize(elapsed);
+	interval_start = now;
+}
@@ -0,0 +1,687 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "filter.h"
+#include "ahocorasick.h"
+#include "hash.h"
+#include "util.h"
+
+using namespace std;
+
+/** Maximal length of a host name (for the case folding) */
+#define HOST_LENGTH  256
+
+typedef struct {
+	filter_action_t action;
+	unsigned int conditions;
+} rule_t; /**< Filter rule (all its conditions have to be satisfied) */
+
+typedef struct {
+	string pattern;
+	uint32_t condition;
+} pattern_t; /**< Literal pattern of a condition */
+
+/** Literal patterns indexed by their hash */
+typedef unordered_map< uint64_t, vector< pattern_t> > pattern_map;
+
+typedef struct {
+	uint32_t child[2];
+	vector< uint32_t> conditions;
+} cidr_node_t; /**< Binary trie node of network prefixes */
+
+/** Rules (in the order of precedence) */
+static vector< rule_t> rules;
+
+/** Rule of each condition */
+static vector< uint32_t> condition_rules;
+
+/** User agent substrings */
+static vector< string> agent_patterns;
+static vector< uint32_t> agent_conditions;
+static ahocorasick_t agent_automaton;
+
+/** Request path prefixes and their distinct lengths */
+static pattern_map path_prefixes;
+static vector< size_t> path_lengths;
+
+/** Host names (exact, '*.suffix', 'prefix.*' and other globs) */
+static pattern_map host_exact;
+static pattern_map host_suffixes;
+static pattern_map host_prefixes;
+static vector< pattern_t> host_globs;
+
+/** Client network prefixes */
+static vector< cidr_node_t> cidr_trie;
+
+/** Status codes (exact and classes) */
+static unordered_map< unsigned int, vector< uint32_t> > status_codes;
+static vector< uint32_t> status_classes[10];
+
+/** Per-entry matching state (valid in the current generation) */
+static uint32_t generation = 0;
+static vector< uint32_t> condition_stamps;
+static vector< uint32_t> rule_stamps;
+static vector< uint32_t> rule_hits;
+static vector< uint32_t> matches;
+static uint32_t best_rule;
+
+/** Filtering enabled */
+static bool enabled = false;
+
+/** Add condition to the current rule
+ *
+ * @return Condition identifier.
+ *
+ */
+static uint32_t add_condition(void)
+{
+	rules.back().conditions++;
+	condition_rules.push_back(rules.size() - 1);
+	
+	return condition_rules.size() - 1;
+}
+
+/** Add literal pattern
+ *
+ * @param map       Pattern map.
+ * @param pattern   Pattern.
+ * @param condition Condition identifier.
+ *
+ */
+static void add_pattern(pattern_map &map, const string &pattern,
+    uint32_t condition)
+{
+	pattern_t entry;
+	entry.pattern = pattern;
+	entry.condition = condition;
+	
+	map[hash_bytes(pattern.c_str(), pattern.length())].push_back(entry);
+}
+
+/** Add host glob condition
+ *
+ * @param glob Host glob.
+ *
+ */
+static void add_host(string glob)
+{
+	uint32_t condition = add_condition();
+	
+	for (size_t i = 0; i < glob.length(); i++)
+		glob[i] = tolower(glob[i]);
+	
+	size_t wildcards = glob.find_first_of("*?[");
+	
+	if (wildcards == string::npos) {
+		add_pattern(host_exact, glob, condition);
+		return;
+	}
+	
+	if ((glob.compare(0, 2, "*.") == 0) &&
+	    (glob.find_first_of("*?[", 1) == string::npos)) {
+		add_pattern(host_suffixes, glob.substr(1), condition);
+		return;
+	}
+	
+	if ((glob.length() > 2) && (glob.compare(glob.length() - 2, 2, ".*") == 0) &&
+	    (wildcards == glob.length() - 1)) {
+		add_pattern(host_prefixes, glob.substr(0, glob.length() - 1),
+		    condition);
+		return;
+	}
+	
+	pattern_t entry;
+	entry.pattern = glob;
+	entry.condition = condition;
+	host_globs.push_back(entry);
+}
+
+/** Add client network condition
+ *
+ * @param cidr Network prefix (address[/length]).
+ *
+ * @return True on success.
+ *
+ */
+static bool add_client(const string &cidr)
+{
+	string address = cidr;
+	long int length = -1;
+	
+	string::size_type slash = cidr.find('/');
+	if (slash != string::npos) {
+		address = cidr.substr(0, slash);
+		
+		char *err;
+		length = strtol(cidr.c_str() + slash + 1, &err, 10);
+		if ((*err != 0) || (slash + 1 == cidr.length()))
+			return false;
+	}
+	
+	uint8_t addr[ADDRESS_LENGTH];
+	if (!address_decode(address.c_str(), address.length(), addr))
+		return false;
+	
+	bool ipv4 = (address.find(':') == string::npos);
+	long int max = ipv4 ? 32 : 128;
+	
+	if (length < 0)
+		length = max;
+	
+	if (length > max)
+		return false;
+	
+	if (ipv4)
+		length += 96;
+	
+	uint32_t node = 0;
+	for (long int bit = 0; bit < length; bit++) {
+		unsigned int dir = (addr[bit / 8] >> (7 - bit % 8)) & 1;
+		
+		if (cidr_trie[node].child[dir] == 0) {
+			cidr_trie[node].child[dir] = cidr_trie.size();
+			cidr_trie.push_back(cidr_node_t());
+			cidr_trie.back().child[0] = 0;
+			cidr_trie.back().child[1] = 0;
+		}
+		
+		node = cidr_trie[node].child[dir];
+	}
+	
+	cidr_trie[node].conditions.push_back(add_condition());
+	return true;
+}
+
+/** Add status condition
+ *
+ * @param status Status code (e.g. 404) or class (e.g. 4xx).
+ *
+ * @return True on success.
+ *
+ */
+static bool add_status(const string &status)
+{
+	if ((status.length() != 3) || (status[0] < '1') || (status[0] > '9'))
+		return false;
+	
+	if ((tolower(status[1]) == 'x') && (tolower(status[2]) == 'x')) {
+		status_classes[status[0] - '0'].push_back(add_condition());
+		return true;
+	}
+	
+	uint64_t code;
+	if (!span_decode(status.c_str(), status.length(), code))
+		return false;
+	
+	status_codes[code].push_back(add_condition());
+	return true;
+}
+
+/** Split rule into words
+ *
+ * Words are separated by white space, double
+ * quotes can be used for values with spaces.
+ *
+ * @param line  Rule.
+ * @param words Words of the rule.
+ *
+ * @return True on success.
+ *
+ */
+static bool split_rule(const string &line, vector< string> &words)
+{
+	string word;
+	bool in_word = false;
+	bool quoted = false;
+	
+	for (size_t i = 0; i < line.length(); i++) {
+		char chr = line[i];
+		
+		if (chr == '"') {
+			quoted = !quoted;
+			in_word = true;
+			continue;
+		}
+		
+		if ((!quoted) && (isspace(chr))) {
+			if (in_word)
+				words.push_back(word);
+			
+			word.clear();
+			in_word = false;
+			continue;
+		}
+		
+		word += chr;
+		in_word = true;
+	}
+	
+	if (in_word)
+		words.push_back(word);
+	
+	return !quoted;
+}
+
+/** Parse filter rule
+ *
+ * @param line   Rule.
+ * @param format Compiled log format.
+ * @param error  Error description on failure.
+ *
+ * @return True on success.
+ *
+ */
+static bool parse_rule(const string &line, logformat_t &format, string &error)
+{
+	vector< string> words;
+	if (!split_rule(line, words)) {
+		error = "Unterminated quotes";
+		return false;
+	}
+	
+	/* Empty line or comment */
+	if ((words.empty()) || (words[0][0] == '#'))
+		return true;
+	
+	rule_t rule;
+	rule.conditions = 0;
+	
+	if (words[0] == "keep")
+		rule.action = FILTER_KEEP;
+	else if (words[0] == "drop")
+		rule.action = FILTER_DROP;
+	else if (words[0] == "divert")
+		rule.action = FILTER_DIVERT;
+	else {
+		error = "Unknown action '" + words[0] + "'";
+		return false;
+	}
+	
+	if (words.size() < 2) {
+		error = "Rule without conditions";
+		return false;
+	}
+	
+	rules.push_back(rule);
+	
+	for (size_t i = 1; i < words.size(); i++) {
+		string::size_type equals = words[i].find('=');
+		if ((equals == string::npos) || (equals + 1 == words[i].length())) {
+			error = "Invalid condition '" + words[i] + "'";
+			return false;
+		}
+		
+		string key = words[i].substr(0, equals);
+		string value = words[i].substr(equals + 1);
+		
+		if (key == "host")
+			add_host(value);
+		else if (key == "path") {
+			if (!logformat_require(format, FIELD_REQUEST)) {
+				error = "Format does not contain request line (%r)";
+				return false;
+			}
+			
+			add_pattern(path_prefixes, value, add_condition());
+			path_lengths.push_back(value.length());
+		} else if (key == "ua") {
+			if (!logformat_require(format, FIELD_USER_AGENT)) {
+				error = "Format does not contain user agent";
+				return false;
+			}
+			
+			agent_patterns.push_back(value);
+			agent_conditions.push_back(add_condition());
+		} else if (key == "client") {
+			if (!logformat_require(format, FIELD_HOST)) {
+				error = "Format does not contain client address (%h)";
+				return false;
+			}
+			
+			if (!add_client(value)) {
+				error = "Invalid client network '" + value + "'";
+				return false;
+			}
+		} else if (key == "status") {
+			if (!logformat_require(format, FIELD_STATUS)) {
+				error = "Format does not contain status (%s)";
+				return false;
+			}
+			
+			if (!add_status(value)) {
+				error = "Invalid status '" + value + "'";
+				return false;
+			}
+		} else {
+			error = "Unknown condition '" + key + "'";
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+/** Load and compile filter rules
+ *
+ * Each line of the rules file contains an action (keep,
+ * drop or divert) followed by conditions (host=GLOB,
+ * path=PREFIX, ua=SUBSTRING, client=CIDR, status=CODE).
+ * The first rule with all conditions satisfied decides.
+ *
+ * @param path   Rules file path.
+ * @param format Compiled log format (the fields used by
+ *               the rules are required).
+ * @param error  Error description on failure.
+ *
+ * @return True on success.
+ *
+ */
+bool filter_init(const char *path, logformat_t &format, string &error)
+{
+	ifstream file(path);
+	if (!file) {
+		error = string("Unable to open ") + path;
+		return false;
+	}
+	
+	cidr_trie.resize(1);
+	cidr_trie[0].child[0] = 0;
+	cidr_trie[0].child[1] = 0;
+	
+	string line;
+	unsigned int number = 0;
+	
+	while (getline(file, line)) {
+		number++;
+		
+		if (!parse_rule(line, format, error)) {
+			ostringstream stream;
+			stream << path << ":" << number << ": " << error;
+			error = stream.str();
+			return false;
+		}
+	}
+	
+	ahocorasick_build(agent_automaton, agent_patterns, true);
+	
+	sort(path_lengths.begin(), path_lengths.end());
+	path_lengths.erase(unique(path_lengths.begin(), path_lengths.end()),
+	    path_lengths.end());
+	
+	condition_stamps.assign(condition_rules.size(), 0);
+	rule_stamps.assign(rules.size(), 0);
+	rule_hits.assign(rules.size(), 0);
+	
+	enabled = !rules.empty();
+	return true;
+}
+
+/** Mark condition as satisfied
+ *
+ * @param condition Condition identifier.
+ *
+ */
+static inline void satisfy(uint32_t condition)
+{
+	/* Each condition is counted only once */
+	if (condition_stamps[condition] == generation)
+		return;
+	
+	condition_stamps[condition] = generation;
+	
+	uint32_t rule = condition_rules[condition];
+	if (rule_stamps[rule] != generation) {
+		rule_stamps[rule] = generation;
+		rule_hits[rule] = 0;
+	}
+	
+	rule_hits[rule]++;
+	if ((rule_hits[rule] == rules[rule].conditions) && (rule < best_rule))
+		best_rule = rule;
+}
+
+/** Mark literal pattern conditions as satisfied
+ *
+ * @param map    Pattern map.
+ * @param str    Matched string.
+ * @param length Length of the matched string.
+ *
+ */
+static void satisfy_patterns(const pattern_map &map, const char *str,
+    size_t length)
+{
+	pattern_map::const_iterator it = map.find(hash_bytes(str, length));
+	if (it == map.end())
+		return;
+	
+	for (size_t i = 0; i < it->second.size(); i++) {
+		const pattern_t &pattern = it->second[i];
+		
+		if ((pattern.pattern.length() == length) &&
+		    (memcmp(pattern.pattern.c_str(), str, length) == 0))
+			satisfy(pattern.condition);
+	}
+}
+
+/** Match host name conditions
+ *
+ * @param domain Host name.
+ *
+ */
+static void match_host(const string &domain)
+{
+	char host[HOST_LENGTH];
+	size_t length = min(domain.length(), (size_t) HOST_LENGTH - 1);
+	
+	for (size_t i = 0; i < length; i++)
+		host[i] = tolower(domain[i]);
+	
+	host[length] = 0;
+	
+	if (!host_exact.empty())
+		satisfy_patterns(host_exact, host, length);
+	
+	if ((!host_suffixes.empty()) || (!host_prefixes.empty())) {
+		for (size_t pos = 0; pos < length; pos++) {
+			if (host[pos] != '.')
+				continue;
+			
+			if (!host_suffixes.empty())
+				satisfy_patterns(host_suffixes, host + pos, length - pos);
+			
+			if (!host_prefixes.empty())
+				satisfy_patterns(host_prefixes, host, pos + 1);
+		}
+	}
+	
+	for (size_t i = 0; i < host_globs.size(); i++) {
+		if (fnmatch(host_globs[i].pattern.c_str(), host, 0) == 0)
+			satisfy(host_globs[i].condition);
+	}
+}
+
+/** Match request path conditions
+ *
+ * @param line Log entry.
+ * @param span Request line position.
+ *
+ */
+static void match_path(const char *line, const field_span_t &span)
+{
+	if (span.start == FIELD_ABSENT)
+		return;
+	
+	const char *request = line + span.start;
+	const char *path = (const char *) memchr(request, ' ', span.length);
+	if (path == NULL)
+		return;
+	
+	path++;
+	
+	const char *end = (const char *) memchr(path, ' ',
+	    request + span.length - path);
+	if (end == NULL)
+		end = request + span.length;
+	
+	size_t length = end - path;
+	
+	for (size_t i = 0; i < path_lengths.size(); i++) {
+		if (path_lengths[i] > length)
+			break;
+		
+		satisfy_patterns(path_prefixes, path, path_lengths[i]);
+	}
+}
+
+/** Match client network conditions
+ *
+ * @param line Log entry.
+ * @param span Client address position.
+ *
+ */
+static void match_client(const char *line, const field_span_t &span)
+{
+	uint8_t addr[ADDRESS_LENGTH];
+	
+	if ((span.start == FIELD_ABSENT) ||
+	    (!address_decode(line + span.start, span.length, addr)))
+		return;
+	
+	uint32_t node = 0;
+	for (unsigned int bit = 0; bit <= ADDRESS_LENGTH * 8; bit++) {
+		const cidr_node_t &current = cidr_trie[node];
+		
+		for (size_t i = 0; i < current.conditions.size(); i++)
+			satisfy(current.conditions[i]);
+		
+		if (bit == ADDRESS_LENGTH * 8)
+			break;
+		
+		node = current.child[(addr[bit / 8] >> (7 - bit % 8)) & 1];
+		if (node == 0)
+			break;
+	}
+}
+
+/** Match status conditions
+ *
+ * @param line Log entry.
+ * @param span Status position.
+ *
+ */
+static void match_status(const char *line, const field_span_t &span)
+{
+	uint64_t code;
+	
+	if ((span.start == FIELD_ABSENT) || (span.length != 3) ||
+	    (!span_decode(line + span.start, span.length, code)))
+		return;
+	
+	const vector< uint32_t> &classes = status_classes[code / 100];
+	for (size_t i = 0; i < classes.size(); i++)
+		satisfy(classes[i]);
+	
+	unordered_map< unsigned int, vector< uint32_t> >::const_iterator it =
+	    status_codes.find(code);
+	if (it != status_codes.end()) {
+		for (size_t i = 0; i < it->second.size(); i++)
+			satisfy(it->second[i]);
+	}
+}
+
+/** Decide log entry
+ *
+ * All conditions of all rules are evaluated in a single
+ * pass over each field used by the rules.
+ *
+ * @param line   Log entry.
+ * @param fields Parsed log entry.
+ * @param domain Domain name.
+ *
+ * @return Action of the first rule with all conditions satisfied.
+ * @return FILTER_KEEP if there is no such rule.
+ *
+ */
+filter_action_t filter_entry(const char *line, const log_fields_t &fields,
+    const string &domain)
+{
+	if (!enabled)
+		return FILTER_KEEP;
+	
+	generation++;
+	best_rule = rules.size();
+	
+	if ((!host_exact.empty()) || (!host_suffixes.empty()) ||
+	    (!host_prefixes.empty()) || (!host_globs.empty()))
+		match_host(domain);
+	
+	if (!path_lengths.empty())
+		match_path(line, fields.field[FIELD_REQUEST]);
+	
+	if (!agent_patterns.empty()) {
+		const field_span_t &agent = fields.field[FIELD_USER_AGENT];
+		
+		if (agent.start != FIELD_ABSENT) {
+			matches.clear();
+			ahocorasick_match(agent_automaton, line + agent.start,
+			    agent.length, matches);
+			
+			for (size_t i = 0; i < matches.size(); i++)
+				satisfy(agent_conditions[matches[i]]);
+		}
+	}
+	
+	if (cidr_trie.size() > 1)
+		match_client(line, fields.field[FIELD_HOST]);
+	
+	if (!status_codes.empty())
+		match_status(line, fields.field[FIELD_STATUS]);
+	else {
+		for (unsigned int i = 0; i < 10; i++) {
+			if (!status_classes[i].empty()) {
+				match_status(line, fields.field[FIELD_STATUS]);
+				break;
+			}
+		}
+	}
+	
+	if (best_rule < rules.size())
+		return rules[best_rule].action;
+	
+	return FILTER_KEEP;
+}
@@ -0,0 +1,997 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include "forward.h"
+#include "lz4.h"
+#include "strindex.h"
+#include "timer.h"
+#include "util.h"
+
+using namespace std;
+
+/** Batch size to send as a frame */
+#define BATCH_SIZE  (1 << 16)
+
+/** Maximal delay of a batch (ms) */
+#define BATCH_DELAY  200
+
+/** Maximal raw length of a frame */
+#define FRAME_MAX  (1 << 22)
+
+/** Frames kept for resending until acknowledged (bytes) */
+#define BUFFER_SIZE  (1 << 26)
+
+/** Interval of the reconnection attempts (ms) */
+#define RETRY_INTERVAL  1000
+
+/** Maximal wait for the acknowledgements on exit (ms) */
+#define LINGER  5000
+
+/** Interval of the summaries of the dropped entries (ms) */
+#define SUMMARY_INTERVAL  10000
+
+/** Idle time after which a session is forgotten (ms) */
+#define SESSION_IDLE  3600000
+
+/** Initial receive buffer size of a forwarder connection */
+#define PEER_BUFFER  65536
+
+typedef struct {
+	uint64_t sequence;
+	size_t lines;
+	
+	/* Frame header, suffix and payload */
+	vector< char> data;
+} frame_t; /**< Frame kept for resending */
+
+typedef struct {
+	int fd;
+	
+	/* Received data */
+	vector< char> buffer;
+	size_t length;
+	
+	bool hello;
+	uint64_t session;
+} peer_t; /**< Forwarder connected to the collector */
+
+typedef struct {
+	/* Last frame processed */
+	uint64_t sequence;
+	
+	/* Monotonic time of the last activity */
+	uint64_t seen;
+} session_t; /**< Forwarder session */
+
+/** Forwarding enabled */
+static bool forwarding = false;
+
+/** Collector address */
+static string target;
+static struct sockaddr_storage target_addr;
+static socklen_t target_length;
+
+/** Compress the frames */
+static bool compress = false;
+
+/** Connection to the collector (-1 if none) */
+static int target_fd = -1;
+
+/** Connection to the collector in progress */
+static bool connecting = false;
+
+/** Connection failure reported */
+static bool reported = false;
+
+/** Monotonic time of the next connection attempt */
+static uint64_t retry_time = 0;
+
+/** Session identifier */
+static uint64_t session;
+
+/** Sequence number of the last frame */
+static uint64_t sequence = 0;
+
+/** Log entries to be sent as the next frame */
+static string batch;
+static size_t batch_lines = 0;
+static uint64_t batch_time = 0;
+
+/** Suffix of the domain directories of the batch */
+static string batch_suffix;
+
+/** Frames not acknowledged */
+static deque< frame_t *> frames;
+static size_t frames_size = 0;
+
+/** Frames sent completely over the current connection */
+static size_t sent_frames = 0;
+
+/** Bytes of the next frame sent over the current connection */
+static size_t sent_offset = 0;
+
+/** Partial acknowledgement */
+static char ack[sizeof(uint64_t)];
+static size_t ack_length = 0;
+
+/** Log entries dropped since the last summary */
+static uint64_t dropped = 0;
+static uint64_t summary_time = 0;
+
+/** Listening socket of the collector (-1 if none) */
+static int listen_fd = -1;
+
+/** Listening Unix socket path */
+static string listen_path;
+
+/** Handler of the log entries received */
+static line_handler_t handler;
+
+/** Connected forwarders */
+static vector< peer_t *> peers;
+
+/** Forwarder sessions */
+static unordered_map< uint64_t, session_t> sessions;
+
+/** Structural index of the frames received */
+static strindex_t frame_index;
+
+/** Decompressed frame */
+static vector< char> raw;
+
+/** Suffix of the domain directories of the frame delivered */
+static string frame_suffix;
+
+/** Layout of the poll structures */
+static bool poll_target = false;
+static bool poll_listen = false;
+
+/** Close the connection to the collector
+ *
+ * @param err Error number of the failure.
+ *
+ */
+static void target_close(int err)
+{
+	close(target_fd);
+	target_fd = -1;
+	connecting = false;
+	sent_frames = 0;
+	sent_offset = 0;
+	retry_time = monotonic_ms() + RETRY_INTERVAL;
+	
+	if (!reported) {
+		cerr << "accesslog: forwarding to " << target << " failed: " <<
+		    strerror(err) << endl;
+		reported = true;
+	}
+}
+
+/** Send pending frames to the collector
+ *
+ */
+static void target_flush(void)
+{
+	while ((target_fd >= 0) && (!connecting) &&
+	    (sent_frames < frames.size())) {
+		const vector< char> &data = frames[sent_frames]->data;
+		
+		ssize_t sent = send(target_fd, &data[sent_offset],
+		    data.size() - sent_offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+				target_close(errno);
+			
+			return;
+		}
+		
+		sent_offset += sent;
+		if (sent_offset == data.size()) {
+			sent_frames++;
+			sent_offset = 0;
+		}
+	}
+}
+
+/** Start sending over established connection
+ *
+ * The hello is sent first and all the frames not
+ * acknowledged are sent again.
+ *
+ */
+static void target_established(void)
+{
+	connecting = false;
+	ack_length = 0;
+	
+	forward_hello_t hello;
+	hello.magic = htole32(FORWARD_MAGIC);
+	hello.version = htole32(FORWARD_VERSION);
+	hello.session = htole64(session);
+	
+	/* Fits into the empty socket buffer */
+	if (send(target_fd, &hello, sizeof(hello), MSG_DONTWAIT | MSG_NOSIGNAL)
+	    != sizeof(hello)) {
+		target_close(errno);
+		return;
+	}
+	
+	if (reported) {
+		cerr << "accesslog: forwarding to " << target << " resumed" << endl;
+		reported = false;
+	}
+	
+	target_flush();
+}
+
+/** Connect to the collector
+ *
+ */
+static void target_connect(void)
+{
+	target_fd = socket(target_addr.ss_family,
+	    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (target_fd < 0) {
+		retry_time = monotonic_ms() + RETRY_INTERVAL;
+		return;
+	}
+	
+	if (target_addr.ss_family != AF_UNIX) {
+		int one = 1;
+		setsockopt(target_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	
+	if (connect(target_fd, (struct sockaddr *) &target_addr,
+	    target_length) == 0)
+		target_established();
+	else if (errno == EINPROGRESS)
+		connecting = true;
+	else
+		target_close(errno);
+}
+
+/** Drop the frames acknowledged by the collector
+ *
+ * @param acknowledged Sequence number of the last frame
+ *                     processed by the collector.
+ *
+ */
+static void target_acknowledged(uint64_t acknowledged)
+{
+	while ((!frames.empty()) &&
+	    (frames.front()->sequence <= acknowledged)) {
+		/* Frame partially sent over the current connection */
+		if ((sent_frames == 0) && (sent_offset > 0))
+			break;
+		
+		frames_size -= frames.front()->data.size();
+		delete frames.front();
+		frames.pop_front();
+		
+		if (sent_frames > 0)
+			sent_frames--;
+	}
+}
+
+/** Receive acknowledgements from the collector
+ *
+ */
+static void target_receive(void)
+{
+	while (target_fd >= 0) {
+		ssize_t count = recv(target_fd, ack + ack_length,
+		    sizeof(ack) - ack_length, MSG_DONTWAIT);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+				target_close(errno);
+			
+			return;
+		}
+		
+		if (count == 0) {
+			target_close(ECONNRESET);
+			return;
+		}
+		
+		ack_length += count;
+		if (ack_length == sizeof(ack)) {
+			uint64_t acknowledged;
+			memcpy(&acknowledged, ack, sizeof(acknowledged));
+			target_acknowledged(le64toh(acknowledged));
+			ack_length = 0;
+		}
+	}
+}
+
+/** Handle the polled events of the connection to the collector
+ *
+ * @param revents Events returned.
+ *
+ */
+static void target_events(short revents)
+{
+	if (connecting) {
+		if ((revents & (POLLOUT | POLLERR | POLLHUP)) == 0)
+			return;
+		
+		int err = 0;
+		socklen_t length = sizeof(err);
+		getsockopt(target_fd, SOL_SOCKET, SO_ERROR, &err, &length);
+		
+		if (err != 0)
+			target_close(err);
+		else
+			target_established();
+		
+		return;
+	}
+	
+	if (revents & (POLLIN | POLLERR | POLLHUP))
+		target_receive();
+	
+	if ((target_fd >= 0) && (revents & POLLOUT))
+		target_flush();
+}
+
+/** Turn the batch into a frame and send it
+ *
+ * If the frames not acknowledged exceed the buffer size,
+ * the oldest ones are dropped.
+ *
+ */
+static void seal(void)
+{
+	if (batch.empty())
+		return;
+	
+	frame_t *frame = new frame_t;
+	frame->sequence = ++sequence;
+	frame->lines = batch_lines;
+	
+	size_t start = sizeof(forward_frame_t) + batch_suffix.length();
+	size_t length = batch.length();
+	frame->data.resize(start + (compress ? lz4_bound(length) : length));
+	
+	memcpy(&frame->data[sizeof(forward_frame_t)], batch_suffix.data(),
+	    batch_suffix.length());
+	
+	char *payload = &frame->data[start];
+	
+	if (compress) {
+		size_t compressed = lz4_compress(batch.data(), length, payload);
+		
+		/* Incompressible batch is sent as it is */
+		if (compressed < length)
+			length = compressed;
+		else
+			memcpy(payload, batch.data(), length);
+	} else
+		memcpy(payload, batch.data(), length);
+	
+	frame->data.resize(start + length);
+	
+	forward_frame_t header;
+	header.sequence = htole64(frame->sequence);
+	header.length = htole32(length);
+	header.raw_length = htole32(batch.length());
+	header.suffix_length = htole32(batch_suffix.length());
+	header.reserved = 0;
+	memcpy(&frame->data[0], &header, sizeof(header));
+	
+	frames.push_back(frame);
+	frames_size += frame->data.size();
+	
+	batch.clear();
+	batch_lines = 0;
+	
+	while ((frames_size > BUFFER_SIZE) && (frames.size() > 1)) {
+		/* Frame partially sent cannot be dropped from the stream */
+		if ((sent_frames == 0) && (sent_offset > 0))
+			target_close(ENOBUFS);
+		
+		dropped += frames.front()->lines;
+		frames_size -= frames.front()->data.size();
+		delete frames.front();
+		frames.pop_front();
+		
+		if (sent_frames > 0)
+			sent_frames--;
+	}
+	
+	target_flush();
+}
+
+/** Initialize forwarding to the collector
+ *
+ * @param address         Collector address (see socket_address()).
+ * @param compress_frames Compress the frames.
+ * @param error           Error message.
+ *
+ * @return True on success.
+ *
+ */
+bool forward_init(const char *address, bool compress_frames, string &error)
+{
+	if (!socket_address(address, SOCK_STREAM, false, target_addr,
+	    target_length, error))
+		return false;
+	
+	if (getrandom(&session, sizeof(session), 0) != sizeof(session)) {
+		error = "Unable to generate session identifier";
+		return false;
+	}
+	
+	target = address;
+	compress = compress_frames;
+	forwarding = true;
+	summary_time = monotonic_ms();
+	
+	target_connect();
+	return true;
+}
+
+/** Listen for the forwarders
+ *
+ * @param address       Address to listen on (see socket_address()).
+ * @param entry_handler Handler of the log entries received.
+ * @param error         Error message.
+ *
+ * @return True on success.
+ *
+ */
+bool forward_listen(const char *address, line_handler_t entry_handler,
+    string &error)
+{
+	struct sockaddr_storage addr;
+	socklen_t length;
+	
+	if (!socket_address(address, SOCK_STREAM, true, addr, length, error))
+		return false;
+	
+	listen_fd = socket(addr.ss_family,
+	    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0) {
+		error = strerror(errno);
+		return false;
+	}
+	
+	if (addr.ss_family == AF_UNIX) {
+		/* Remove the stale socket of a previous instance */
+		listen_path = ((struct sockaddr_un *) &addr)->sun_path;
+		unlink(listen_path.c_str());
+	} else {
+		int one = 1;
+		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	}
+	
+	if ((bind(listen_fd, (struct sockaddr *) &addr, length) != 0) ||
+	    (listen(listen_fd, FORWARD_PEERS) != 0)) {
+		error = strerror(errno);
+		close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+	
+	handler = entry_handler;
+	return true;
+}
+
+/** Forward log entry to the collector
+ *
+ * The entry is added to the current batch, which is
+ * sent once it is large enough or old enough. All the
+ * entries of a batch share the suffix of the domain
+ * directories, thus the batch is sent whenever the
+ * suffix changes.
+ *
+ * @param entry  Log entry (without the newline).
+ * @param size   Length of the log entry.
+ * @param suffix Suffix of the domain directories of the entry.
+ *
+ */
+void forward_line(const char *entry, size_t size, const string &suffix)
+{
+	if (!forwarding)
+		return;
+	
+	if ((size >= FRAME_MAX) || (suffix.length() > FORWARD_SUFFIX_MAX)) {
+		dropped++;
+		return;
+	}
+	
+	if ((batch.length() + size + 1 > FRAME_MAX) || (suffix != batch_suffix))
+		seal();
+	
+	if (batch.empty()) {
+		batch_time = monotonic_ms();
+		batch_suffix = suffix;
+	}
+	
+	batch.append(entry, size);
+	batch += '\n';
+	batch_lines++;
+	
+	if (batch.length() >= BATCH_SIZE)
+		seal();
+}
+
+/** Disconnect forwarder
+ *
+ * @param index Forwarder index.
+ *
+ */
+static void peer_disconnect(size_t index)
+{
+	close(peers[index]->fd);
+	delete peers[index];
+	
+	peers.erase(peers.begin() + index);
+}
+
+/** Acknowledge the frames processed to a forwarder
+ *
+ * Lost acknowledgement (full socket buffer) only
+ * causes the frames to be resent and skipped.
+ *
+ * @param peer Forwarder.
+ *
+ */
+static void peer_acknowledge(peer_t &peer)
+{
+	uint64_t acknowledged = htole64(sessions[peer.session].sequence);
+	send(peer.fd, &acknowledged, sizeof(acknowledged),
+	    MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+/** Check the suffix of the domain directories of a frame
+ *
+ * @param suffix Suffix (empty or a dot followed by lower
+ *               case letters, as given on the forwarder).
+ * @param length Length of the suffix.
+ *
+ * @return True if the suffix is valid.
+ *
+ */
+static bool valid_suffix(const char *suffix, size_t length)
+{
+	if (length == 0)
+		return true;
+	
+	if ((length > FORWARD_SUFFIX_MAX) || (suffix[0] != '.'))
+		return false;
+	
+	for (size_t i = 1; i < length; i++) {
+		if ((suffix[i] < 'a') || (suffix[i] > 'z'))
+			return false;
+	}
+	
+	return true;
+}
+
+/** Pass the log entries of a frame to the handler
+ *
+ * The handler argument is the suffix of the domain
+ * directories of the frame (NULL for an empty suffix,
+ * i.e. the default suffix of the collector).
+ *
+ * @param data   Payload.
+ * @param length Length of the payload.
+ *
+ */
+static void deliver(const char *data, size_t length)
+{
+	void *arg = frame_suffix.empty() ? NULL : &frame_suffix;
+	size_t pos = reader_split(frame_index, data, length, handler, arg);
+	
+	/* Last entry without the terminating newline */
+	if (pos < length) {
+		strindex_build(frame_index, data + pos, length - pos);
+		handler(data + pos, length - pos, frame_index, 0, arg);
+	}
+}
+
+/** Process the hello and the complete frames received
+ *
+ * @param peer Forwarder.
+ *
+ * @return False on protocol violation.
+ *
+ */
+static bool peer_process(peer_t &peer)
+{
+	size_t pos = 0;
+	bool processed = false;
+	
+	if (!peer.hello) {
+		if (peer.length < sizeof(forward_hello_t))
+			return true;
+		
+		forward_hello_t hello;
+		memcpy(&hello, &peer.buffer[0], sizeof(hello));
+		
+		if ((le32toh(hello.magic) != FORWARD_MAGIC) ||
+		    (le32toh(hello.version) != FORWARD_VERSION))
+			return false;
+		
+		peer.hello = true;
+		peer.session = le64toh(hello.session);
+		
+		/* Creates new session */
+		sessions[peer.session].seen = monotonic_ms();
+		
+		pos = sizeof(hello);
+		processed = true;
+	}
+	
+	while (peer.length - pos >= sizeof(forward_frame_t)) {
+		forward_frame_t header;
+		memcpy(&header, &peer.buffer[pos], sizeof(header));
+		
+		uint64_t frame_sequence = le64toh(header.sequence);
+		size_t length = le32toh(header.length);
+		size_t raw_length = le32toh(header.raw_length);
+		size_t suffix_length = le32toh(header.suffix_length);
+		
+		if ((raw_length > FRAME_MAX) || (length > raw_length) ||
+		    (suffix_length > FORWARD_SUFFIX_MAX))
+			return false;
+		
+		size_t size = sizeof(header) + suffix_length + length;
+		if (peer.length - pos < size) {
+			if (peer.buffer.size() < size)
+				peer.buffer.resize(size);
+			
+			break;
+		}
+		
+		const char *suffix = &peer.buffer[pos + sizeof(header)];
+		const char *payload = suffix + suffix_length;
+		session_t &state = sessions[peer.session];
+		
+		if (!valid_suffix(suffix, suffix_length))
+			return false;
+		
+		if (frame_sequence > state.sequence) {
+			frame_suffix.assign(suffix, suffix_length);
+			
+			if (length < raw_length) {
+				raw.resize(raw_length);
+				if (!lz4_decompress(payload, length, &raw[0], raw_length))
+					return false;
+				
+				deliver(&raw[0], raw_length);
+			} else
+				deliver(payload, length);
+			
+			state.sequence = frame_sequence;
+		}
+		
+		state.seen = monotonic_ms();
+		pos += size;
+		processed = true;
+	}
+	
+	if (pos > 0) {
+		memmove(&peer.buffer[0], &peer.buffer[pos], peer.length - pos);
+		peer.length -= pos;
+	}
+	
+	if (processed)
+		peer_acknowledge(peer);
+	
+	return true;
+}
+
+/** Receive data from a forwarder
+ *
+ * @param peer Forwarder.
+ *
+ * @return False if the forwarder has disconnected
+ *         or violated the protocol.
+ *
+ */
+static bool peer_receive(peer_t &peer)
+{
+	ssize_t count = recv(peer.fd, &peer.buffer[peer.length],
+	    peer.buffer.size() - peer.length, MSG_DONTWAIT);
+	if (count < 0)
+		return ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+		    (errno == EINTR));
+	
+	/* Disconnected */
+	if (count == 0)
+		return false;
+	
+	peer.length += count;
+	
+	if (!peer_process(peer)) {
+		cerr << "accesslog: invalid data from forwarder, disconnected" <<
+		    endl;
+		return false;
+	}
+	
+	return true;
+}
+
+/** Accept new forwarders
+ *
+ */
+static void peer_accept(void)
+{
+	while (true) {
+		int fd = accept4(listen_fd, NULL, NULL,
+		    SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			break;
+		
+		if (peers.size() >= FORWARD_PEERS) {
+			close(fd);
+			continue;
+		}
+		
+		peer_t *peer = new peer_t;
+		peer->fd = fd;
+		peer->buffer.resize(PEER_BUFFER);
+		peer->length = 0;
+		peer->hello = false;
+		peer->session = 0;
+		
+		peers.push_back(peer);
+	}
+}
+
+/** Get the file descriptors to poll
+ *
+ * @param fds Poll structures to fill (at least
+ *            FORWARD_POLLFDS entries).
+ *
+ * @return Number of poll structures filled.
+ *
+ */
+size_t forward_pollfds(struct pollfd *fds)
+{
+	size_t count = 0;
+	
+	poll_target = (target_fd >= 0);
+	if (poll_target) {
+		fds[count].fd = target_fd;
+		fds[count].events = POLLIN;
+		fds[count].revents = 0;
+		
+		if ((connecting) || (sent_frames < frames.size()))
+			fds[count].events |= POLLOUT;
+		
+		count++;
+	}
+	
+	poll_listen = (listen_fd >= 0);
+	if (poll_listen) {
+		fds[count].fd = listen_fd;
+		fds[count].events = POLLIN;
+		fds[count].revents = 0;
+		count++;
+		
+		for (size_t i = 0; i < peers.size(); i++) {
+			fds[count].fd = peers[i]->fd;
+			fds[count].events = POLLIN;
+			fds[count].revents = 0;
+			count++;
+		}
+	}
+	
+	return count;
+}
+
+/** Handle the polled events
+ *
+ * @param fds   Poll structures filled by forward_pollfds().
+ * @param count Number of the poll structures.
+ *
+ */
+void forward_events(const struct pollfd *fds, size_t count)
+{
+	if (poll_target) {
+		target_events(fds[0].revents);
+		fds++;
+		count--;
+	}
+	
+	if (!poll_listen)
+		return;
+	
+	/* Iterate backwards as the disconnected forwarders are removed */
+	for (size_t i = count - 1; i > 0; i--) {
+		bool alive = true;
+		
+		if (fds[i].revents & POLLIN)
+			alive = peer_receive(*peers[i - 1]);
+		else if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+			alive = false;
+		
+		if (!alive)
+			peer_disconnect(i - 1);
+	}
+	
+	if (fds[0].revents & POLLIN)
+		peer_accept();
+}
+
+/** Limit the poll timeout to the batch deadline
+ *
+ * The pending batch has to be sent at most BATCH_DELAY
+ * after its first entry, even if no other event occurs.
+ *
+ * @param timeout Poll timeout (ms).
+ *
+ * @return Poll timeout not exceeding the batch deadline (ms).
+ *
+ */
+int forward_timeout(int timeout)
+{
+	if ((!forwarding) || (batch.empty()))
+		return timeout;
+	
+	uint64_t age = monotonic_ms() - batch_time;
+	if (age >= BATCH_DELAY)
+		return 0;
+	
+	uint64_t remaining = BATCH_DELAY - age;
+	if (remaining < (uint64_t) timeout)
+		return (int) remaining;
+	
+	return timeout;
+}
+
+/** Periodic forwarding tasks
+ *
+ * Send the batch once it is old enough, reconnect
+ * to the collector, report the dropped entries and
+ * forget the idle sessions.
+ *
+ */
+void forward_tick(void)
+{
+	uint64_t now = monotonic_ms();
+	
+	if (forwarding) {
+		if ((!batch.empty()) && (now - batch_time >= BATCH_DELAY))
+			seal();
+		
+		if ((target_fd < 0) && (now >= retry_time))
+			target_connect();
+		
+		if ((dropped > 0) && (now - summary_time >= SUMMARY_INTERVAL)) {
+			cerr << "accesslog: forwarding buffer full, " << dropped <<
+			    " log entries dropped" << endl;
+			dropped = 0;
+			summary_time = now;
+		}
+	}
+	
+	if (listen_fd >= 0) {
+		for (size_t i = 0; i < peers.size(); i++) {
+			if (peers[i]->hello)
+				sessions[peers[i]->session].seen = now;
+		}
+		
+		for (unordered_map< uint64_t, session_t>::iterator it =
+		    sessions.begin(); it != sessions.end(); ) {
+			if (now - it->second.seen > SESSION_IDLE)
+				it = sessions.erase(it);
+			else
+				++it;
+		}
+	}
+}
+
+/** Finish forwarding
+ *
+ * Send the last batch and wait (for a limited time)
+ * until the collector acknowledges all the frames.
+ * Disconnect the forwarders.
+ *
+ */
+void forward_done(void)
+{
+	if (forwarding) {
+		seal();
+		
+		uint64_t deadline = monotonic_ms() + LINGER;
+		
+		while ((!frames.empty()) && (monotonic_ms() < deadline)) {
+			if ((target_fd < 0) && (monotonic_ms() >= retry_time))
+				target_connect();
+			
+			struct pollfd pfd;
+			size_t count = 0;
+			
+			if (target_fd >= 0) {
+				pfd.fd = target_fd;
+				pfd.events = POLLIN;
+				pfd.revents = 0;
+				
+				if ((connecting) || (sent_frames < frames.size()))
+					pfd.events |= POLLOUT;
+				
+				count = 1;
+			}
+			
+			if ((poll(&pfd, count, 100) > 0) && (count > 0))
+				target_events(pfd.revents);
+		}
+		
+		size_t lines = 0;
+		while (!frames.empty()) {
+			lines += frames.front()->lines;
+			delete frames.front();
+			frames.pop_front();
+		}
+		
+		if (lines > 0)
+			cerr << "accesslog: " << lines << " log entries not "
+			    "acknowledged by " << target << endl;
+		
+		if (target_fd >= 0)
+			close(target_fd);
+		
+		target_fd = -1;
+		forwarding = false;
+	}
+	
+	if (listen_fd >= 0) {
+		while (!peers.empty())
+			peer_disconnect(peers.size() - 1);
+		
+		close(listen_fd);
+		listen_fd = -1;
+		
+		if (!listen_path.empty())
+			unlink(listen_path.c_str());
+	}
+}
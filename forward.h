@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FORWARD_H_
+#define FORWARD_H_
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "reader.h"
+
+/** Connection hello magic number ("ALFW") */
+#define FORWARD_MAGIC  UINT32_C(0x57464c41)
+
+/** Forwarding protocol version */
+#define FORWARD_VERSION  2
+
+/** Maximal length of the suffix of the domain directories of a frame */
+#define FORWARD_SUFFIX_MAX  64
+
+/** Maximal number of forwarders connected to the collector */
+#define FORWARD_PEERS  64
+
+/** Maximal number of poll structures of the forwarding */
+#define FORWARD_POLLFDS  (FORWARD_PEERS + 2)
+
+/** Forwarding protocol
+ *
+ * All integers are little-endian. The forwarder starts
+ * each connection with the hello carrying a random session
+ * identifier of the process, followed by the frames. Each
+ * frame consists of the frame header, the suffix of the
+ * domain directories of its log entries (e.g. ".ssl",
+ * empty for the default suffix of the collector) and the
+ * payload: a batch of log entries (each terminated by a
+ * newline), LZ4-compressed (block format) if the length
+ * differs from the raw length. The entries of different
+ * inputs are sent in different frames if their suffixes
+ * differ. The frames of a session are numbered from 1.
+ *
+ * The collector answers the hello and each batch of
+ * frames processed by the sequence number of the last
+ * frame of the session processed (uint64_t). The frames
+ * not acknowledged are resent after reconnection and the
+ * collector skips the frames it has already processed.
+ *
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t session;
+} forward_hello_t; /**< Connection hello */
+
+typedef struct {
+	uint64_t sequence;
+	uint32_t length;
+	uint32_t raw_length;
+	uint32_t suffix_length;
+	uint32_t reserved;
+} forward_frame_t; /**< Frame header */
+
+extern bool forward_init(const char *, bool, std::string &);
+extern bool forward_listen(const char *, line_handler_t, std::string &);
+extern void forward_line(const char *, size_t, const std::string &);
+extern size_t forward_pollfds(struct pollfd *);
+extern void forward_events(const struct pollfd *, size_t);
+extern int forward_timeout(int);
+extern void forward_tick(void);
+extern void forward_done(void);
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/** SipHash key length */
+#define SIPHASH_KEY_LENGTH  16
+
+#define SIPHASH_ROTL(val, bits)  (((val) << (bits)) | ((val) >> (64 - (bits))))
+
+#define SIPHASH_ROUND(v0, v1, v2, v3) \
+	do { \
+		v0 += v1; v1 = SIPHASH_ROTL(v1, 13); v1 ^= v0; \
+		v0 = SIPHASH_ROTL(v0, 32); \
+		v2 += v3; v3 = SIPHASH_ROTL(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = SIPHASH_ROTL(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = SIPHASH_ROTL(v1, 17); v1 ^= v2; \
+		v2 = SIPHASH_ROTL(v2, 32); \
+	} while (0)
+
+/** Hash byte string (64 bits)
+ *
+ * FNV-1a followed by the MurmurHash3 finalizer, which
+ * gives all output bits a good avalanche even for short
+ * and similar keys (e.g. IP addresses).
+ *
+ * @param data   Data to hash.
+ * @param length Length of the data.
+ *
+ * @return Hash value.
+ *
+ */
+static inline uint64_t hash_bytes(const char *data, size_t length)
+{
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (uint8_t) data[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+	
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xff51afd7ed558ccd);
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+	hash ^= hash >> 33;
+	
+	return hash;
+}
+
+/** Keyed hash of byte string (SipHash-2-4, 64 bits)
+ *
+ * Unlike hash_bytes(), the output cannot be predicted
+ * or inverted (e.g. by enumerating all IPv4 addresses)
+ * without the knowledge of the key.
+ *
+ * @param key    Key (SIPHASH_KEY_LENGTH bytes).
+ * @param data   Data to hash.
+ * @param length Length of the data.
+ *
+ * @return Hash value.
+ *
+ */
+static inline uint64_t siphash(const uint8_t *key, const void *data,
+    size_t length)
+{
+	const uint8_t *bytes = (const uint8_t *) data;
+	uint64_t k0;
+	uint64_t k1;
+	
+	/* The key and the data are little-endian (x86) */
+	memcpy(&k0, key, sizeof(k0));
+	memcpy(&k1, key + sizeof(k0), sizeof(k1));
+	
+	uint64_t v0 = k0 ^ UINT64_C(0x736f6d6570736575);
+	uint64_t v1 = k1 ^ UINT64_C(0x646f72616e646f6d);
+	uint64_t v2 = k0 ^ UINT64_C(0x6c7967656e657261);
+	uint64_t v3 = k1 ^ UINT64_C(0x7465646279746573);
+	
+	size_t pos = 0;
+	for (; pos + sizeof(uint64_t) <= length; pos += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, bytes + pos, sizeof(word));
+		
+		v3 ^= word;
+		SIPHASH_ROUND(v0, v1, v2, v3);
+		SIPHASH_ROUND(v0, v1, v2, v3);
+		v0 ^= word;
+	}
+	
+	uint64_t last = ((uint64_t) length) << 56;
+	for (size_t i = 0; pos + i < length; i++)
+		last |= ((uint64_t) bytes[pos + i]) << (8 * i);
+	
+	v3 ^= last;
+	SIPHASH_ROUND(v0, v1, v2, v3);
+	SIPHASH_ROUND(v0, v1, v2, v3);
+	v0 ^= last;
+	
+	v2 ^= 0xff;
+	SIPHASH_ROUND(v0, v1, v2, v3);
+	SIPHASH_ROUND(v0, v1, v2, v3);
+	SIPHASH_ROUND(v0, v1, v2, v3);
+	SIPHASH_ROUND(v0, v1, v2, v3);
+	
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "hll.h"
+
+using namespace std;
+
+/** Maximal number of sparse entries (then the dense array is smaller) */
+#define HLL_SPARSE_MAX  (HLL_REGISTERS / sizeof(uint32_t))
+
+/** Bits of the sparse entry holding the register value */
+#define HLL_VALUE_BITS  8
+
+/** Convert sketch to the dense representation
+ *
+ * @param hll Sketch.
+ *
+ */
+static void densify(hll_t &hll)
+{
+	hll.dense.assign(HLL_REGISTERS, 0);
+	
+	for (size_t i = 0; i < hll.sparse.size(); i++) {
+		uint32_t entry = hll.sparse[i];
+		hll.dense[entry >> HLL_VALUE_BITS] =
+		    entry & ((1 << HLL_VALUE_BITS) - 1);
+	}
+	
+	vector< uint32_t>().swap(hll.sparse);
+}
+
+/** Update register
+ *
+ * @param hll   Sketch.
+ * @param index Register index.
+ * @param value Register value candidate.
+ *
+ */
+static void update(hll_t &hll, uint32_t index, uint8_t value)
+{
+	if (!hll.dense.empty()) {
+		if (hll.dense[index] < value)
+			hll.dense[index] = value;
+		
+		return;
+	}
+	
+	uint32_t key = index << HLL_VALUE_BITS;
+	vector< uint32_t>::iterator it = lower_bound(hll.sparse.begin(),
+	    hll.sparse.end(), key);
+	
+	if ((it != hll.sparse.end()) && ((*it >> HLL_VALUE_BITS) == index)) {
+		if ((*it & ((1 << HLL_VALUE_BITS) - 1)) < value)
+			*it = key | value;
+		
+		return;
+	}
+	
+	hll.sparse.insert(it, key | value);
+	
+	if (hll.sparse.size() > HLL_SPARSE_MAX)
+		densify(hll);
+}
+
+/** Add hashed element to sketch
+ *
+ * @param hll  Sketch.
+ * @param hash 64-bit hash of the element.
+ *
+ */
+void hll_add(hll_t &hll, uint64_t hash)
+{
+	uint32_t index = hash >> (64 - HLL_PRECISION);
+	uint64_t rest = hash << HLL_PRECISION;
+	
+	/* Position of the first set bit in the rest of the hash */
+	uint8_t value = (rest == 0) ? (64 - HLL_PRECISION + 1) :
+	    (__builtin_clzll(rest) + 1);
+	
+	update(hll, index, value);
+}
+
+/** Merge registers into sketch
+ *
+ * @param hll       Sketch.
+ * @param registers Registers to merge (HLL_REGISTERS).
+ *
+ */
+void hll_merge(hll_t &hll, const uint8_t *registers)
+{
+	for (uint32_t i = 0; i < HLL_REGISTERS; i++) {
+		if (registers[i] != 0)
+			update(hll, i, registers[i]);
+	}
+}
+
+/** Export registers of sketch
+ *
+ * @param hll       Sketch.
+ * @param registers Registers (HLL_REGISTERS).
+ *
+ */
+void hll_registers(const hll_t &hll, uint8_t *registers)
+{
+	if (!hll.dense.empty()) {
+		memcpy(registers, &hll.dense[0], HLL_REGISTERS);
+		return;
+	}
+	
+	memset(registers, 0, HLL_REGISTERS);
+	
+	for (size_t i = 0; i < hll.sparse.size(); i++) {
+		uint32_t entry = hll.sparse[i];
+		registers[entry >> HLL_VALUE_BITS] =
+		    entry & ((1 << HLL_VALUE_BITS) - 1);
+	}
+}
+
+/** Estimate cardinality
+ *
+ * The raw HyperLogLog estimate with the linear counting
+ * correction for small cardinalities. No large range
+ * correction is needed with 64-bit hashes.
+ *
+ * @param registers Registers (HLL_REGISTERS).
+ *
+ * @return Estimated number of distinct elements.
+ *
+ */
+uint64_t hll_estimate(const uint8_t *registers)
+{
+	const double m = HLL_REGISTERS;
+	const double alpha = 0.7213 / (1 + 1.079 / m);
+	
+	double sum = 0;
+	unsigned int zeros = 0;
+	
+	for (uint32_t i = 0; i < HLL_REGISTERS; i++) {
+		sum += ldexp(1.0, -registers[i]);
+		
+		if (registers[i] == 0)
+			zeros++;
+	}
+	
+	double estimate = alpha * m * m / sum;
+	
+	if ((estimate <= 2.5 * m) && (zeros > 0))
+		estimate = m * log(m / zeros);
+	
+	return (uint64_t) (estimate + 0.5);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HLL_H_
+#define HLL_H_
+
+#include <stdint.h>
+#include <vector>
+
+/** Number of index bits */
+#define HLL_PRECISION  12
+
+/** Number of registers (standard error 1.04 / sqrt(4096) = 1.6 %) */
+#define HLL_REGISTERS  (1 << HLL_PRECISION)
+
+/** HyperLogLog sketch
+ *
+ * Small sets are kept in the sparse representation (sorted
+ * register index and value pairs), which is converted to
+ * the dense array of registers once it would not be smaller.
+ *
+ */
+typedef struct {
+	std::vector< uint32_t> sparse;
+	std::vector< uint8_t> dense;
+} hll_t;
+
+extern void hll_add(hll_t &, uint64_t);
+extern void hll_merge(hll_t &, const uint8_t *);
+extern void hll_registers(const hll_t &, uint8_t *);
+extern uint64_t hll_estimate(const uint8_t *);
+
+#endif
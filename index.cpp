@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string>
+#include <unordered_map>
+#include "index.h"
+#include "timer.h"
+
+using namespace std;
+
+/** Maximal number of entries between the index records */
+#define INDEX_LINES  1024
+
+/** Maximal log time between the index records (seconds) */
+#define INDEX_SECONDS  60
+
+/** Eviction check interval (ms) */
+#define INDEX_INTERVAL  60000
+
+/** Index state idle for longer is evicted (ms) */
+#define INDEX_IDLE  3600000
+
+typedef struct {
+	/* Entries since the last record */
+	unsigned int lines;
+	
+	/* Time of the last record */
+	int64_t time;
+	
+	/* Last use (ms) */
+	uint64_t touched;
+} index_state_t; /**< Time index state of a domain log */
+
+/** Index states indexed by the domain log path */
+typedef unordered_map< string, index_state_t> index_map;
+
+/** Time indices enabled */
+static bool enabled = false;
+
+/** Index states */
+static index_map states;
+
+/** Time of the last eviction check (ms) */
+static uint64_t last_check;
+
+/** Enable time indices */
+void index_init(void)
+{
+	enabled = true;
+	last_check = monotonic_ms();
+}
+
+/** Decide whether to index log entry
+ *
+ * The first entry stored by this process into each
+ * domain log is always indexed, since the entries
+ * stored before might be far apart.
+ *
+ * @param log_path Domain log path.
+ * @param time     Log entry date & time.
+ *
+ * @return True if the offset of the entry should be
+ *         passed to index_entry().
+ *
+ */
+bool index_wanted(const string &log_path, const datetime &time)
+{
+	if (!enabled)
+		return false;
+	
+	int64_t epoch = datetime_epoch(time);
+	
+	pair< index_map::iterator, bool> res =
+	    states.insert(make_pair(log_path, index_state_t()));
+	index_state_t &state = res.first->second;
+	
+	state.touched = monotonic_ms();
+	
+	if ((!res.second) && (state.lines < INDEX_LINES) &&
+	    (epoch - state.time < INDEX_SECONDS)) {
+		state.lines++;
+		return false;
+	}
+	
+	state.lines = 1;
+	state.time = epoch;
+	return true;
+}
+
+/** Append index record
+ *
+ * @param domain Domain of the log entry (located).
+ * @param time   Log entry date & time.
+ * @param offset Offset of the log entry in the domain log.
+ *
+ */
+void index_entry(domain_t *domain, const datetime &time, uint64_t offset)
+{
+	static string name;
+	
+	index_record_t record;
+	record.time = datetime_epoch(time);
+	record.offset = offset;
+	
+	name.assign(domain->name);
+	name.append(INDEX_SUFFIX);
+	
+	int fd = logdir_open(domain->dir, name, O_APPEND);
+	if (fd >= 0) {
+		write_long(fd, &record, sizeof(record));
+		close(fd);
+	}
+}
+
+/** Evict idle index states periodically
+ *
+ * Does nothing until the check interval
+ * elapses, thus it is cheap to call per line.
+ *
+ */
+void index_tick(void)
+{
+	if (!enabled)
+		return;
+	
+	uint64_t now = monotonic_ms();
+	if (now - last_check < INDEX_INTERVAL)
+		return;
+	
+	for (index_map::iterator it = states.begin(); it != states.end(); ) {
+		if (now - it->second.touched > INDEX_IDLE)
+			it = states.erase(it);
+		else
+			++it;
+	}
+	
+	last_check = now;
+}
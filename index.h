@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INDEX_H_
+#define INDEX_H_
+
+#include <stdint.h>
+#include <string>
+#include "domains.h"
+#include "util.h"
+
+/** Suffix of the time index file (appended to the domain log path) */
+#define INDEX_SUFFIX  ".index"
+
+/** Time index record
+ *
+ * The records are appended in the host byte order every
+ * INDEX_LINES entries or INDEX_SECONDS of the log time,
+ * each points to the start of an entry in the domain log.
+ * Since the entries are only roughly ordered by time, the
+ * readers should allow for some slack.
+ *
+ */
+typedef struct {
+	/* Time of the entry (Unix time) */
+	int64_t time;
+	
+	/* Offset of the entry in the domain log */
+	uint64_t offset;
+} index_record_t;
+
+extern void index_init(void);
+extern bool index_wanted(const std::string &, const datetime &);
+extern void index_entry(domain_t *, const datetime &, uint64_t);
+extern void index_tick(void);
+
+#endif
@@ -0,0 +1,513 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "errors.h"
+#include "inputs.h"
+#include "stats.h"
+#include "strindex.h"
+#include "syslogmsg.h"
+#include "util.h"
+
+using namespace std;
+
+/** Maximal datagram size (larger ones are rejected as truncated) */
+#define DATAGRAM_SIZE  8192
+
+/** Maximal number of datagrams received at once */
+#define DATAGRAM_BATCH  256
+
+/** Maximal number of batches received per event */
+#define DATAGRAM_ROUNDS  4
+
+/** Maximal number of events handled at once */
+#define EVENTS  64
+
+typedef enum {
+	INPUT_STREAM,
+	INPUT_LISTEN,
+	INPUT_DATAGRAM
+} input_type_t; /**< Input type */
+
+typedef struct {
+	input_type_t type;
+	int fd;
+	
+	/* Suffix of the domain directories */
+	string suffix;
+	
+	/* Stream reader (INPUT_STREAM) */
+	reader_t reader;
+	
+	/* Socket path to remove (INPUT_LISTEN, INPUT_DATAGRAM) */
+	string path;
+	
+	/* Datagrams dropped by the kernel so far (INPUT_DATAGRAM) */
+	uint32_t drops;
+} input_t; /**< Input stream */
+
+/** Event polling instance (-1 if none) */
+static int epoll_fd = -1;
+
+/** Handler of the log entries */
+static line_handler_t handler;
+
+/** Inputs */
+static vector< input_t *> inputs;
+
+/** Receive buffer size of the datagram sockets (0 for default) */
+static int receive_buffer = 0;
+
+/** Datagram buffers */
+static vector< char> datagrams;
+
+/** Datagram receiving structures */
+static struct mmsghdr datagram_headers[DATAGRAM_BATCH];
+static struct iovec datagram_vectors[DATAGRAM_BATCH];
+static char datagram_controls[DATAGRAM_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+
+/** Structural index of the datagrams */
+static strindex_t datagram_index;
+
+/** Register input
+ *
+ * @param type   Input type.
+ * @param fd     File descriptor.
+ * @param suffix Suffix of the domain directories.
+ * @param path   Socket path to remove on exit.
+ * @param error  Error message.
+ *
+ * @return True on success.
+ *
+ */
+static bool input_add(input_type_t type, int fd, const string &suffix,
+    const string &path, string &error)
+{
+	if (inputs.size() >= INPUTS_MAX) {
+		error = "Too many inputs";
+		return false;
+	}
+	
+	input_t *input = new input_t;
+	input->type = type;
+	input->fd = fd;
+	input->suffix = suffix;
+	input->path = path;
+	input->drops = 0;
+	
+	if (type == INPUT_STREAM)
+		reader_init(input->reader, fd, handler, &input->suffix);
+	
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = input;
+	
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+		error = strerror(errno);
+		delete input;
+		return false;
+	}
+	
+	inputs.push_back(input);
+	return true;
+}
+
+/** Unregister and close input
+ *
+ * @param input Input.
+ *
+ */
+static void input_remove(input_t *input)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, input->fd, NULL);
+	
+	if (input->fd != STDIN_FILENO)
+		close(input->fd);
+	
+	if (!input->path.empty())
+		unlink(input->path.c_str());
+	
+	inputs.erase(find(inputs.begin(), inputs.end(), input));
+	delete input;
+}
+
+/** Create listening or datagram socket
+ *
+ * @param address Socket address (see socket_address()).
+ * @param type    Socket type.
+ * @param error   Error message.
+ *
+ * @return Socket or -1 on error.
+ *
+ */
+static int bound_socket(const string &address, int type, string &error)
+{
+	struct sockaddr_storage addr;
+	socklen_t length;
+	
+	if (!socket_address(address.c_str(), type, true, addr, length, error))
+		return -1;
+	
+	int fd = socket(addr.ss_family, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		error = address + ": " + strerror(errno);
+		return -1;
+	}
+	
+	if (addr.ss_family == AF_UNIX) {
+		/* Remove the stale socket of a previous instance */
+		unlink(((struct sockaddr_un *) &addr)->sun_path);
+	} else {
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	}
+	
+	if (type == SOCK_DGRAM) {
+		/* Report the datagrams dropped by the kernel */
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+		
+		if ((receive_buffer > 0) &&
+		    (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &receive_buffer,
+		    sizeof(receive_buffer)) != 0))
+			setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer,
+			    sizeof(receive_buffer));
+	}
+	
+	if ((bind(fd, (struct sockaddr *) &addr, length) != 0) ||
+	    ((type == SOCK_STREAM) && (listen(fd, SOMAXCONN) != 0))) {
+		error = address + ": " + strerror(errno);
+		close(fd);
+		return -1;
+	}
+	
+	return fd;
+}
+
+/** Set the receive buffer size of the datagram sockets
+ *
+ * Applies to the inputs added afterwards. Without the
+ * privilege to override the system limit, the size is
+ * capped by net.core.rmem_max.
+ *
+ * @param size Receive buffer size (bytes).
+ *
+ */
+void inputs_receive_buffer(int size)
+{
+	receive_buffer = size;
+}
+
+/** Add input
+ *
+ * The source is either "-" (standard input), a FIFO
+ * path (created if missing), "unix:PATH" (Unix stream
+ * socket accepting connections, each an input stream),
+ * "unixgram:PATH" (Unix datagram socket) or "udp:HOST:PORT"
+ * (UDP socket). Each datagram holds one or more log entries
+ * or a single syslog message with the log entry.
+ *
+ * @param source        Input source.
+ * @param suffix        Suffix of the domain directories of the input.
+ * @param entry_handler Log entry handler (called with the suffix
+ *                      as the argument).
+ * @param error         Error message.
+ *
+ * @return True on success.
+ *
+ */
+bool inputs_add(const char *source, const string &suffix,
+    line_handler_t entry_handler, string &error)
+{
+	if (epoll_fd < 0) {
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0) {
+			error = strerror(errno);
+			return false;
+		}
+	}
+	
+	handler = entry_handler;
+	
+	string str = source;
+	input_type_t type = INPUT_STREAM;
+	string path;
+	int fd;
+	
+	if (str == "-") {
+		/* Regular files and directories cannot be polled */
+		struct stat st;
+		if ((fstat(STDIN_FILENO, &st) == 0) && (!S_ISFIFO(st.st_mode)) &&
+		    (!S_ISSOCK(st.st_mode)) && (!S_ISCHR(st.st_mode))) {
+			error = str + ": Not a pipe, socket or terminal "
+			    "(read files without --input)";
+			return false;
+		}
+		
+		fd = STDIN_FILENO;
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	} else if (str.compare(0, 5, "unix:") == 0) {
+		type = INPUT_LISTEN;
+		path = str.substr(5);
+		fd = bound_socket("unix:" + path, SOCK_STREAM, error);
+	} else if (str.compare(0, 9, "unixgram:") == 0) {
+		type = INPUT_DATAGRAM;
+		path = str.substr(9);
+		fd = bound_socket("unix:" + path, SOCK_DGRAM, error);
+	} else if (str.compare(0, 4, "udp:") == 0) {
+		type = INPUT_DATAGRAM;
+		fd = bound_socket(str.substr(4), SOCK_DGRAM, error);
+	} else {
+		if ((mkfifo(source, S_IRUSR | S_IWUSR) != 0) && (errno != EEXIST)) {
+			error = str + ": " + strerror(errno);
+			return false;
+		}
+		
+		/* Opened also for writing not to get EOF when the writers exit */
+		fd = open(source, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		
+		if (fd < 0) {
+			error = str + ": " + strerror(errno);
+			return false;
+		}
+		
+		struct stat st;
+		if ((fstat(fd, &st) != 0) || (!S_ISFIFO(st.st_mode))) {
+			close(fd);
+			error = str + ": Not a FIFO";
+			return false;
+		}
+	}
+	
+	if (fd < 0)
+		return false;
+	
+	if (!input_add(type, fd, suffix, path, error)) {
+		error = str + ": " + error;
+		
+		if (fd != STDIN_FILENO)
+			close(fd);
+		
+		return false;
+	}
+	
+	return true;
+}
+
+/** Get the event polling file descriptor
+ *
+ * @return File descriptor to poll for input or -1
+ *         if there are no inputs.
+ *
+ */
+int inputs_fd(void)
+{
+	return epoll_fd;
+}
+
+/** Accept new input stream connections
+ *
+ * @param listener Listening input.
+ *
+ */
+static void accept_streams(input_t *listener)
+{
+	string error;
+	
+	while (true) {
+		int fd = accept4(listener->fd, NULL, NULL,
+		    SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			break;
+		
+		if (!input_add(INPUT_STREAM, fd, listener->suffix, string(),
+		    error))
+			close(fd);
+	}
+}
+
+/** Account the datagrams dropped by the kernel
+ *
+ * @param input   Datagram input.
+ * @param message Received message.
+ *
+ */
+static void account_drops(input_t *input, struct msghdr &message)
+{
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL;
+	    cmsg = CMSG_NXTHDR(&message, cmsg)) {
+		if ((cmsg->cmsg_level != SOL_SOCKET) ||
+		    (cmsg->cmsg_type != SO_RXQ_OVFL))
+			continue;
+		
+		/* Running count of the socket */
+		uint32_t drops;
+		memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+		
+		if (drops != input->drops) {
+			stats_drops(drops - input->drops);
+			input->drops = drops;
+		}
+	}
+}
+
+/** Pass the log entries of a datagram to the handler
+ *
+ * @param input  Datagram input.
+ * @param data   Datagram.
+ * @param length Length of the datagram.
+ *
+ */
+static void deliver(input_t *input, const char *data, size_t length)
+{
+	syslogmsg_strip(data, length);
+	if (length == 0)
+		return;
+	
+	size_t pos = reader_split(datagram_index, data, length, handler,
+	    &input->suffix);
+	
+	/* Last entry without the terminating newline */
+	if (pos < length) {
+		strindex_build(datagram_index, data + pos, length - pos);
+		handler(data + pos, length - pos, datagram_index, 0,
+		    &input->suffix);
+	}
+}
+
+/** Receive pending datagrams
+ *
+ * The datagrams are received in batches by a single
+ * system call each.
+ *
+ * @param input Datagram input.
+ *
+ */
+static void receive_datagrams(input_t *input)
+{
+	if (datagrams.empty()) {
+		datagrams.resize(DATAGRAM_BATCH * DATAGRAM_SIZE);
+		
+		for (unsigned int i = 0; i < DATAGRAM_BATCH; i++) {
+			datagram_vectors[i].iov_base = &datagrams[i * DATAGRAM_SIZE];
+			datagram_vectors[i].iov_len = DATAGRAM_SIZE;
+		}
+	}
+	
+	/* Limited not to starve the other inputs */
+	for (unsigned int round = 0; round < DATAGRAM_ROUNDS; round++) {
+		memset(datagram_headers, 0, sizeof(datagram_headers));
+		
+		for (unsigned int i = 0; i < DATAGRAM_BATCH; i++) {
+			datagram_headers[i].msg_hdr.msg_iov = &datagram_vectors[i];
+			datagram_headers[i].msg_hdr.msg_iovlen = 1;
+			datagram_headers[i].msg_hdr.msg_control = datagram_controls[i];
+			datagram_headers[i].msg_hdr.msg_controllen = sizeof(datagram_controls[i]);
+		}
+		
+		int count = recvmmsg(input->fd, datagram_headers, DATAGRAM_BATCH,
+		    MSG_DONTWAIT, NULL);
+		if (count <= 0)
+			break;
+		
+		for (int i = 0; i < count; i++) {
+			struct msghdr &message = datagram_headers[i].msg_hdr;
+			const char *data = &datagrams[i * DATAGRAM_SIZE];
+			size_t length = datagram_headers[i].msg_len;
+			
+			account_drops(input, message);
+			
+			if (message.msg_flags & MSG_TRUNC) {
+				error_report(ERROR_OTHER, data, length,
+				    "Truncated datagram");
+				continue;
+			}
+			
+			deliver(input, data, length);
+		}
+		
+		if (count < DATAGRAM_BATCH)
+			break;
+	}
+}
+
+/** Handle the ready inputs
+ *
+ * Each ready stream is read once (at most a block)
+ * to share the time fairly among the inputs. Closed
+ * streams are removed.
+ *
+ */
+void inputs_events(void)
+{
+	struct epoll_event events[EVENTS];
+	
+	int count = epoll_wait(epoll_fd, events, EVENTS, 0);
+	
+	for (int i = 0; i < count; i++) {
+		input_t *input = (input_t *) events[i].data.ptr;
+		
+		switch (input->type) {
+		case INPUT_STREAM:
+			if (!reader_read(input->reader))
+				input_remove(input);
+			break;
+		case INPUT_LISTEN:
+			accept_streams(input);
+			break;
+		case INPUT_DATAGRAM:
+			receive_datagrams(input);
+			break;
+		}
+	}
+}
+
+/** Close all inputs
+ *
+ */
+void inputs_done(void)
+{
+	while (!inputs.empty())
+		input_remove(inputs.back());
+	
+	if (epoll_fd >= 0) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+}
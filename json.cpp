@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string>
+#include "json.h"
+#include "stats.h"
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+/** JSON-lines output enabled */
+static bool enabled = false;
+
+/** Append escaped character
+ *
+ * @param out Output.
+ * @param chr Character to escape (quote, backslash or control).
+ *
+ */
+static inline void escape_char(string &out, unsigned char chr)
+{
+	static const char *hex = "0123456789abcdef";
+	
+	switch (chr) {
+	case '"':
+		out += "\\\"";
+		break;
+	case '\\':
+		out += "\\\\";
+		break;
+	case '\n':
+		out += "\\n";
+		break;
+	case '\r':
+		out += "\\r";
+		break;
+	case '\t':
+		out += "\\t";
+		break;
+	default:
+		out += "\\u00";
+		out += hex[chr >> 4];
+		out += hex[chr & 0x0f];
+	}
+}
+
+/** Check whether character needs escaping in JSON string */
+static inline bool needs_escape(unsigned char chr)
+{
+	return ((chr < 0x20) || (chr == '"') || (chr == '\\'));
+}
+
+/** Find next character which needs escaping
+ *
+ * @param str    String.
+ * @param pos    Starting position.
+ * @param length Length of the string.
+ *
+ * @return Position of the character or length if there is none.
+ *
+ */
+static inline size_t escape_scan(const char *str, size_t pos, size_t length)
+{
+#ifdef __SSE2__
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1f);
+	
+	while (pos + 16 <= length) {
+		__m128i vec = _mm_loadu_si128((const __m128i *) (str + pos));
+		
+		/* Unsigned vec <= 0x1f iff max(vec, 0x1f) == 0x1f */
+		__m128i special = _mm_or_si128(
+		    _mm_or_si128(_mm_cmpeq_epi8(vec, quote),
+		    _mm_cmpeq_epi8(vec, backslash)),
+		    _mm_cmpeq_epi8(_mm_max_epu8(vec, control), control));
+		
+		unsigned int mask = _mm_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+		
+		pos += 16;
+	}
+#endif
+	
+	for (; pos < length; pos++) {
+		if (needs_escape(str[pos]))
+			break;
+	}
+	
+	return pos;
+}
+
+/** Append string escaped for JSON
+ *
+ * Runs of characters which need no escaping (i.e. almost
+ * all of them) are found 16 bytes at a time and copied
+ * at once.
+ *
+ * @param out    Output.
+ * @param str    String to escape.
+ * @param length Length of the string.
+ *
+ */
+void json_escape(string &out, const char *str, size_t length)
+{
+	size_t start = 0;
+	
+	while (true) {
+		size_t pos = escape_scan(str, start, length);
+		out.append(str + start, pos - start);
+		
+		if (pos == length)
+			break;
+		
+		escape_char(out, str[pos]);
+		start = pos + 1;
+	}
+}
+
+/** Append string member
+ *
+ * @param out    Output.
+ * @param name   Member name.
+ * @param str    String.
+ * @param length Length of the string.
+ *
+ */
+static void put_string(string &out, const char *name, const char *str,
+    size_t length)
+{
+	out += ",\"";
+	out += name;
+	out += "\":\"";
+	json_escape(out, str, length);
+	out += '"';
+}
+
+/** Append numeric member of a field
+ *
+ * @param out    Output.
+ * @param name   Member name.
+ * @param line   Log entry.
+ * @param span   Field position.
+ *
+ */
+static void put_number(string &out, const char *name, const char *line,
+    const field_span_t &span)
+{
+	if (span.start == FIELD_ABSENT)
+		return;
+	
+	out += ",\"";
+	out += name;
+	out += "\":";
+	
+	uint64_t value;
+	if (span_decode(line + span.start, span.length, value)) {
+		char buf[24];
+		snprintf(buf, sizeof(buf), "%llu", (unsigned long long) value);
+		out += buf;
+	} else
+		out += "null";
+}
+
+/** Enable JSON-lines output
+ *
+ * @param format Compiled log format (all fields present
+ *               are required).
+ *
+ */
+void json_init(logformat_t &format)
+{
+	for (unsigned int field = FIELD_HOST; field < FIELDS; field++)
+		logformat_require(format, (field_t) field);
+	
+	enabled = true;
+}
+
+/** Append log entry to the JSON-lines log
+ *
+ * The string values are stored as logged (i.e. including
+ * the escapes of Apache), escaped for JSON. The entry has
+ * to be the one stored to the domain log, so that the
+ * client address of an anonymized domain is never exported.
+ * The log is opened relative to the cached month directory
+ * of the domain log and the entries which cannot be written
+ * are counted in the statistics.
+ *
+ * @param domain Located domain.
+ * @param line   Log entry as stored (after the anonymization).
+ * @param fields Parsed log entry (describing the entry as stored).
+ * @param time   Log entry date & time.
+ *
+ */
+void json_entry(domain_t *domain, const char *line,
+    const log_fields_t &fields, const datetime &time)
+{
+	static string out;
+	static string name;
+	
+	if (!enabled)
+		return;
+	
+	long int offset = (time.offset < 0) ? -time.offset : time.offset;
+	char timestamp[128];
+	snprintf(timestamp, sizeof(timestamp),
+	    "{\"time\":\"%04ld-%02ld-%02ldT%02ld:%02ld:%02ld%c%02ld:%02ld\","
+	    "\"epoch\":%lld", time.year, time.month, time.day, time.hour,
+	    time.minute, time.second, (time.offset < 0) ? '-' : '+',
+	    offset / 100, offset % 100, (long long) datetime_epoch(time));
+	
+	out = timestamp;
+	put_string(out, "vhost", domain->name.c_str(), domain->name.length());
+	
+	const field_span_t &host = fields.field[FIELD_HOST];
+	if (host.start != FIELD_ABSENT)
+		put_string(out, "host", line + host.start, host.length);
+	
+	const field_span_t &request = fields.field[FIELD_REQUEST];
+	if (request.start != FIELD_ABSENT) {
+		const char *str = line + request.start;
+		put_string(out, "request", str, request.length);
+		
+		const char *first = (const char *) memchr(str, ' ', request.length);
+		const char *last = (const char *) memrchr(str, ' ', request.length);
+		
+		if ((first != NULL) && (first != last)) {
+			put_string(out, "method", str, first - str);
+			put_string(out, "path", first + 1, last - first - 1);
+			put_string(out, "protocol", last + 1,
+			    str + request.length - last - 1);
+		}
+	}
+	
+	put_number(out, "status", line, fields.field[FIELD_STATUS]);
+	put_number(out, "bytes", line, fields.field[FIELD_BYTES]);
+	
+	const field_span_t &referer = fields.field[FIELD_REFERER];
+	if (referer.start != FIELD_ABSENT)
+		put_string(out, "referer", line + referer.start, referer.length);
+	
+	const field_span_t &agent = fields.field[FIELD_USER_AGENT];
+	if (agent.start != FIELD_ABSENT)
+		put_string(out, "user_agent", line + agent.start, agent.length);
+	
+	put_number(out, "duration", line, fields.field[FIELD_DURATION]);
+	put_number(out, "bytes_in", line, fields.field[FIELD_BYTES_IN]);
+	put_number(out, "bytes_out", line, fields.field[FIELD_BYTES_OUT]);
+	
+	out += "}\n";
+	
+	name = domain->name;
+	name += JSON_SUFFIX;
+	
+	int fd = logdir_open(domain->dir, name, O_APPEND);
+	if (fd < 0) {
+		stats_failed();
+		return;
+	}
+	
+	if (!write_long(fd, out.c_str(), out.length()))
+		stats_failed();
+	
+	close(fd);
+}
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <unordered_map>
+#include "logdir.h"
+#include "timer.h"
+
+using namespace std;
+
+/** Revalidation interval of the cached directories (ms) */
+#define LOGDIR_INTERVAL  1000
+
+/** Cached month directories (keyed by the path relative to the prefix) */
+static unordered_map< string, logdir_t> dirs;
+
+/** Cache generation (incremented whenever the cache is flushed) */
+static uint64_t generation = 1;
+
+/** Prefix of the domain directories */
+static string prefix;
+
+/** Prefix directory (O_PATH) file descriptor */
+static int prefix_fd = -1;
+
+/** Time of the last revalidation (ms) */
+static uint64_t last_check;
+
+/** Open the month directory
+ *
+ * The directory is created if it does not exist yet (but
+ * not its parents, thus only the domains with the logs
+ * directory are stored).
+ *
+ * @param relative Directory path relative to the prefix.
+ *
+ * @return Directory file descriptor.
+ * @return Negative value if the directory cannot be opened.
+ *
+ */
+static int open_dir(const string &relative)
+{
+	/* The prefix might be created after the start */
+	if (prefix_fd < 0) {
+		prefix_fd = open(prefix.c_str(),
+		    O_PATH | O_DIRECTORY | O_CLOEXEC);
+		if (prefix_fd < 0)
+			return -1;
+	}
+	
+	/* Make sure the {YYYY}-{MM} directory exists */
+	mkdirat(prefix_fd, relative.c_str(), S_IRUSR | S_IWUSR | S_IXUSR |
+	    S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+	
+	return openat(prefix_fd, relative.c_str(),
+	    O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+/** Initialize the month directory cache
+ *
+ * @param path Prefix of the domain directories.
+ *
+ */
+void logdir_init(const string &path)
+{
+	prefix = path;
+	dirs.reserve(LOGDIR_CACHE);
+	last_check = monotonic_ms();
+}
+
+/** Get a month directory by its relative path
+ *
+ * Getting a directory which is not cached might flush
+ * the cache, thus the directories returned before are
+ * only valid while the generation does not change.
+ *
+ * @param relative Directory path relative to the prefix.
+ *
+ * @return Month directory.
+ * @return NULL if the directory cannot be opened.
+ *
+ */
+logdir_t *logdir_lookup(const string &relative)
+{
+	unordered_map< string, logdir_t>::iterator it = dirs.find(relative);
+	if (it != dirs.end())
+		return &it->second;
+	
+	int fd = open_dir(relative);
+	if (fd < 0)
+		return NULL;
+	
+	/* Keep the number of open descriptors bounded */
+	if (dirs.size() >= LOGDIR_CACHE)
+		logdir_done();
+	
+	logdir_t &dir = dirs[relative];
+	dir.fd = fd;
+	dir.relative = relative;
+	dir.path = prefix + "/" + relative;
+	
+	return &dir;
+}
+
+/** Get the month directory of a second-level domain
+ *
+ * The directory path is
+ * ${PREFIX}/${2ND_LEVEL_DOMAIN}/logs/${YYYY}-${MM}${SUFFIX}
+ *
+ * @param sld    Second-level domain.
+ * @param year   Year.
+ * @param month  Month (1-based).
+ * @param suffix Suffix of the domain directories.
+ *
+ * @return Month directory (valid until the cache generation
+ *         changes).
+ * @return NULL if the directory cannot be opened.
+ *
+ */
+logdir_t *logdir_get(const string &sld, long int year,
+    long int month, const string &suffix)
+{
+	char date[] = "/logs/YYYY-MM";
+	
+	date[6] = '0' + (year / 1000) % 10;
+	date[7] = '0' + (year / 100) % 10;
+	date[8] = '0' + (year / 10) % 10;
+	date[9] = '0' + year % 10;
+	date[11] = '0' + (month / 10) % 10;
+	date[12] = '0' + month % 10;
+	
+	string relative;
+	relative.reserve(sld.length() + sizeof(date) + suffix.length());
+	relative.append(sld);
+	relative.append(date, sizeof(date) - 1);
+	relative.append(suffix);
+	
+	return logdir_lookup(relative);
+}
+
+/** Open a log file in the month directory for appending
+ *
+ * If the month directory has been removed meanwhile,
+ * it is created again.
+ *
+ * @param dir   Month directory.
+ * @param name  Log file name.
+ * @param flags Extra open flags (e.g. O_APPEND).
+ *
+ * @return Log file descriptor.
+ * @return Negative value on error.
+ *
+ */
+int logdir_open(logdir_t *dir, const string &name, int flags)
+{
+	int fd = openat(dir->fd, name.c_str(),
+	    O_WRONLY | O_CREAT | O_LARGEFILE | O_CLOEXEC | flags,
+	    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if ((fd >= 0) || (errno != ENOENT))
+		return fd;
+	
+	int dir_fd = open_dir(dir->relative);
+	if (dir_fd < 0)
+		return -1;
+	
+	close(dir->fd);
+	dir->fd = dir_fd;
+	
+	return openat(dir_fd, name.c_str(),
+	    O_WRONLY | O_CREAT | O_LARGEFILE | O_CLOEXEC | flags,
+	    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+}
+
+/** Get the cache generation
+ *
+ * The month directories returned by logdir_get() stay
+ * valid while the generation does not change.
+ *
+ * @return Cache generation.
+ *
+ */
+uint64_t logdir_generation(void)
+{
+	return generation;
+}
+
+/** Check whether a cached directory is still at its path
+ *
+ * @param fd       Directory file descriptor.
+ * @param at       Directory file descriptor the path is relative to.
+ * @param relative Directory path.
+ *
+ * @return True if the path names the same directory.
+ *
+ */
+static bool same_dir(int fd, int at, const string &relative)
+{
+	struct stat cached;
+	struct stat current;
+	
+	return ((fstat(fd, &cached) == 0) &&
+	    (fstatat(at, relative.c_str(), &current, 0) == 0) &&
+	    (cached.st_dev == current.st_dev) &&
+	    (cached.st_ino == current.st_ino));
+}
+
+/** Revalidate the cached month directories periodically
+ *
+ * The directories renamed or replaced meanwhile (e.g. by
+ * the log rotation) would otherwise keep receiving the
+ * entries. If any of them (or the prefix) is no longer
+ * at its path, the cache is flushed. Does nothing until
+ * the check interval elapses, thus it is cheap to call
+ * per line.
+ *
+ */
+void logdir_tick(void)
+{
+	uint64_t now = monotonic_ms();
+	if (now - last_check < LOGDIR_INTERVAL)
+		return;
+	
+	last_check = now;
+	
+	if (prefix_fd < 0)
+		return;
+	
+	if (!same_dir(prefix_fd, AT_FDCWD, prefix)) {
+		close(prefix_fd);
+		prefix_fd = -1;
+		logdir_done();
+		return;
+	}
+	
+	for (unordered_map< string, logdir_t>::iterator it = dirs.begin();
+	    it != dirs.end(); ++it) {
+		if (!same_dir(it->second.fd, prefix_fd, it->first)) {
+			logdir_done();
+			return;
+		}
+	}
+}
+
+/** Close the cached month directories
+ *
+ */
+void logdir_done(void)
+{
+	for (unordered_map< string, logdir_t>::iterator it = dirs.begin();
+	    it != dirs.end(); ++it)
+		close(it->second.fd);
+	
+	dirs.clear();
+	generation++;
+}
@@ -0,0 +1,501 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include <vector>
+#include "logformat.h"
+
+using namespace std;
+
+/** Map LogFormat directive to field
+ *
+ * @param directive Directive character.
+ * @param argument  Directive argument (in curly braces).
+ *
+ * @return Interpreted field or FIELD_NONE.
+ *
+ */
+static field_t directive_field(const char directive, const string &argument)
+{
+	if (argument.empty()) {
+		switch (directive) {
+		case 'V':
+		case 'v':
+			return FIELD_VHOST;
+		case 'h':
+		case 'a':
+			return FIELD_HOST;
+		case 't':
+			return FIELD_TIME;
+		case 'r':
+			return FIELD_REQUEST;
+		case 's':
+			return FIELD_STATUS;
+		case 'b':
+		case 'B':
+			return FIELD_BYTES;
+		case 'D':
+			return FIELD_DURATION;
+		case 'I':
+			return FIELD_BYTES_IN;
+		case 'O':
+			return FIELD_BYTES_OUT;
+		}
+		
+		return FIELD_NONE;
+	}
+	
+	if (directive == 'i') {
+		if (strcasecmp(argument.c_str(), "Referer") == 0)
+			return FIELD_REFERER;
+		
+		if (strcasecmp(argument.c_str(), "User-agent") == 0)
+			return FIELD_USER_AGENT;
+	}
+	
+	return FIELD_NONE;
+}
+
+/** Check whether a character is a directive modifier
+ *
+ * Status code conditions (e.g. %400,501{User-agent}i) and
+ * original/final request selectors (e.g. %>s) do not change
+ * the format of the field.
+ *
+ * @param chr Character to check.
+ *
+ * @return True if the character is a directive modifier.
+ *
+ */
+static bool is_modifier(const char chr)
+{
+	return (((chr >= '0') && (chr <= '9')) || (chr == ',') ||
+	    (chr == '!') || (chr == '<') || (chr == '>'));
+}
+
+/** Compile LogFormat
+ *
+ * The format is compiled into a sequence of directives, each
+ * followed by the literal text delimiting it from the next
+ * directive. The format has to contain the virtual host
+ * (%V or %v) and the time (%t) directives.
+ *
+ * @param format   Apache LogFormat string (as in the configuration,
+ *                 backslash escapes are interpreted).
+ * @param compiled Compiled format.
+ * @param error    Error description on failure.
+ *
+ * @return True on success.
+ *
+ */
+bool logformat_compile(const string &format, logformat_t &compiled,
+    string &error)
+{
+	compiled.leader.clear();
+	compiled.items.clear();
+	compiled.needed = 0;
+	compiled.vhost_prefix = false;
+	
+	string literal;
+	unsigned int seen = 0;
+	string::size_type pos = 0;
+	
+	while (pos < format.length()) {
+		char chr = format[pos];
+		
+		/* Backslash escapes */
+		if ((chr == '\\') && (pos + 1 < format.length())) {
+			switch (format[pos + 1]) {
+			case 'n':
+				literal += '\n';
+				break;
+			case 't':
+				literal += '\t';
+				break;
+			default:
+				literal += format[pos + 1];
+			}
+			
+			pos += 2;
+			continue;
+		}
+		
+		/* Literal text */
+		if (chr != '%') {
+			literal += chr;
+			pos++;
+			continue;
+		}
+		
+		pos++;
+		
+		/* Literal percent sign */
+		if ((pos < format.length()) && (format[pos] == '%')) {
+			literal += '%';
+			pos++;
+			continue;
+		}
+		
+		while ((pos < format.length()) && (is_modifier(format[pos])))
+			pos++;
+		
+		string argument;
+		if ((pos < format.length()) && (format[pos] == '{')) {
+			string::size_type end = format.find('}', pos);
+			if (end == string::npos) {
+				error = "Unterminated directive argument";
+				return false;
+			}
+			
+			argument = format.substr(pos + 1, end - pos - 1);
+			pos = end + 1;
+		}
+		
+		if (pos >= format.length()) {
+			error = "Incomplete directive at the end of format";
+			return false;
+		}
+		
+		field_t field = directive_field(format[pos], argument);
+		pos++;
+		
+		/* Only the first occurence of a field is interpreted */
+		if (field != FIELD_NONE) {
+			if ((seen & (1 << field)) != 0)
+				field = FIELD_NONE;
+			else
+				seen |= 1 << field;
+		}
+		
+		if (compiled.items.empty())
+			compiled.leader = literal;
+		else {
+			if (literal.empty()) {
+				error = "Directives not separated by literal text";
+				return false;
+			}
+			
+			compiled.items.back().delimiter = literal;
+		}
+		
+		logformat_item_t item;
+		item.field = field;
+		item.escaped = ((!literal.empty()) &&
+		    (literal[literal.length() - 1] == '"'));
+		
+		compiled.items.push_back(item);
+		literal.clear();
+	}
+	
+	if (compiled.items.empty())
+		compiled.leader = literal;
+	else
+		compiled.items.back().delimiter = literal;
+	
+	for (size_t i = 0; i < compiled.items.size(); i++) {
+		logformat_item_t &item = compiled.items[i];
+		
+		if (item.delimiter.empty())
+			item.delimiter_class = -1;
+		else
+			item.delimiter_class = strindex_class(item.delimiter[0]);
+	}
+	
+	if (!logformat_require(compiled, FIELD_VHOST)) {
+		error = "Format does not contain virtual host (%V or %v)";
+		return false;
+	}
+	
+	if (!logformat_require(compiled, FIELD_TIME)) {
+		error = "Format does not contain time (%t)";
+		return false;
+	}
+	
+	compiled.vhost_prefix = ((compiled.leader.empty()) &&
+	    (compiled.items[0].field == FIELD_VHOST));
+	
+	return true;
+}
+
+/** Require field to be parsed
+ *
+ * Only the directives up to the last required field
+ * are parsed, the rest of the log entry is skipped.
+ *
+ * @param compiled Compiled format.
+ * @param field    Required field.
+ *
+ * @return True if the format contains the field.
+ *
+ */
+bool logformat_require(logformat_t &compiled, field_t field)
+{
+	for (size_t i = 0; i < compiled.items.size(); i++) {
+		if (compiled.items[i].field == field) {
+			if (compiled.needed < i + 1)
+				compiled.needed = i + 1;
+			
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+/** Find next occurence of a character
+ *
+ * The structural index of the block is used if the character
+ * is structural, otherwise the entry is searched directly.
+ *
+ * @param line    Log entry.
+ * @param length  Length of the log entry.
+ * @param index   Structural index of the block (NULL if none).
+ * @param base    Offset of the log entry within the block.
+ * @param chr     Character to search.
+ * @param cls     Structural class of the character (or -1).
+ * @param escaped Skip characters escaped by a backslash.
+ * @param pos     Position to start searching from.
+ *
+ * @return Position of the character.
+ * @return FIELD_ABSENT if the character is not found.
+ *
+ */
+static size_t find_char(const char *line, size_t length,
+    const strindex_t *index, size_t base, const char chr, int cls,
+    bool escaped, size_t pos)
+{
+	if ((index != NULL) && (cls >= 0)) {
+		size_t found = strindex_next(*index, (strindex_class_t) cls,
+		    base + pos, base + length, escaped) - base;
+		
+		return (found < length) ? found : FIELD_ABSENT;
+	}
+	
+	if (escaped) {
+		/* Skip escaped characters */
+		while ((pos < length) && (line[pos] != chr)) {
+			if (line[pos] == '\\')
+				pos++;
+			
+			pos++;
+		}
+		
+		return (pos < length) ? pos : FIELD_ABSENT;
+	}
+	
+	const char *found = (const char *) memchr(line + pos, chr, length - pos);
+	return (found != NULL) ? (size_t) (found - line) : FIELD_ABSENT;
+}
+
+/** Find the end of a field
+ *
+ * @param item   Compiled directive.
+ * @param line   Log entry.
+ * @param length Length of the log entry.
+ * @param index  Structural index of the block (NULL if none).
+ * @param base   Offset of the log entry within the block.
+ * @param pos    Start of the field.
+ *
+ * @return Index of the delimiter following the field.
+ * @return FIELD_ABSENT if the delimiter is not found.
+ *
+ */
+static size_t find_delimiter(const logformat_item_t &item, const char *line,
+    size_t length, const strindex_t *index, size_t base, size_t pos)
+{
+	const string &delimiter = item.delimiter;
+	
+	/* Bracketed time (including the space between date and zone) */
+	if ((item.field == FIELD_TIME) && (pos < length) && (line[pos] == '[')) {
+		size_t close = find_char(line, length, index, base, ']',
+		    STRINDEX_CLOSE, false, pos);
+		if (close == FIELD_ABSENT)
+			return FIELD_ABSENT;
+		
+		pos = close + 1;
+		if ((pos + delimiter.length() <= length) &&
+		    (memcmp(line + pos, delimiter.c_str(), delimiter.length()) == 0))
+			return pos;
+		
+		return FIELD_ABSENT;
+	}
+	
+	/* Last field spans till the end of the entry */
+	if (delimiter.empty())
+		return length;
+	
+	while (pos < length) {
+		pos = find_char(line, length, index, base, delimiter[0],
+		    item.delimiter_class, item.escaped, pos);
+		if (pos == FIELD_ABSENT)
+			return FIELD_ABSENT;
+		
+		if ((pos + delimiter.length() <= length) &&
+		    (memcmp(line + pos, delimiter.c_str(), delimiter.length()) == 0))
+			return pos;
+		
+		pos++;
+	}
+	
+	return FIELD_ABSENT;
+}
+
+/** Parse log entry according to the compiled format
+ *
+ * The fields which are successfully parsed before a mismatch
+ * is encountered are still stored.
+ *
+ * @param compiled Compiled format.
+ * @param line     Log entry.
+ * @param length   Length of the log entry.
+ * @param index    Structural index of the block containing
+ *                 the log entry (NULL if none).
+ * @param base     Offset of the log entry within the block.
+ * @param fields   Parsed fields.
+ *
+ * @return True if all required fields have been parsed.
+ *
+ */
+bool logformat_parse(const logformat_t &compiled, const char *line,
+    size_t length, const strindex_t *index, size_t base, log_fields_t &fields)
+{
+	for (unsigned int i = 0; i < FIELDS; i++) {
+		fields.field[i].start = FIELD_ABSENT;
+		fields.field[i].length = 0;
+	}
+	
+	fields.payload = 0;
+	
+	const string &leader = compiled.leader;
+	if ((leader.length() > length) ||
+	    (memcmp(line, leader.c_str(), leader.length()) != 0))
+		return false;
+	
+	size_t pos = leader.length();
+	
+	for (size_t i = 0; i < compiled.needed; i++) {
+		const logformat_item_t &item = compiled.items[i];
+		
+		size_t end = find_delimiter(item, line, length, index, base, pos);
+		if (end == FIELD_ABSENT)
+			return false;
+		
+		if (item.field != FIELD_NONE) {
+			fields.field[item.field].start = pos;
+			fields.field[item.field].length = end - pos;
+		}
+		
+		/* Strip the virtual host and the following spaces */
+		if ((i == 0) && (compiled.vhost_prefix)) {
+			fields.payload = end;
+			while ((fields.payload < length) &&
+			    (line[fields.payload] == ' '))
+				fields.payload++;
+		}
+		
+		pos = end + item.delimiter.length();
+	}
+	
+	return true;
+}
+
+/** Make the parsed fields relative to the payload
+ *
+ * The fields then describe the log entry as stored
+ * (without the virtual host prefix), which is absent.
+ *
+ * @param fields Parsed fields.
+ *
+ */
+void logformat_rebase(log_fields_t &fields)
+{
+	for (unsigned int i = 0; i < FIELDS; i++) {
+		field_span_t &span = fields.field[i];
+		
+		if (span.start == FIELD_ABSENT)
+			continue;
+		
+		if (span.start < fields.payload) {
+			span.start = FIELD_ABSENT;
+			span.length = 0;
+		} else
+			span.start -= fields.payload;
+	}
+	
+	fields.payload = 0;
+}
+
+/** Split log entry into the spans of all directives
+ *
+ * Unlike logformat_parse(), all the directives are parsed
+ * (including those not interpreted) and the structural
+ * index is not used. The spans of the directives which
+ * cannot be parsed are FIELD_ABSENT. The log entry is the
+ * one stored, thus the virtual host prefix (if any) is
+ * absent.
+ *
+ * @param compiled Compiled format.
+ * @param line     Log entry as stored.
+ * @param length   Length of the log entry.
+ * @param spans    Spans of the directives (in the format order).
+ *
+ */
+void logformat_split(const logformat_t &compiled, const char *line,
+    size_t length, vector< field_span_t> &spans)
+{
+	field_span_t absent;
+	absent.start = FIELD_ABSENT;
+	absent.length = 0;
+	
+	spans.assign(compiled.items.size(), absent);
+	
+	const string &leader = compiled.leader;
+	if ((leader.length() > length) ||
+	    (memcmp(line, leader.c_str(), leader.length()) != 0))
+		return;
+	
+	size_t pos = leader.length();
+	
+	/* The virtual host prefix is not stored */
+	size_t first = compiled.vhost_prefix ? 1 : 0;
+	
+	for (size_t i = first; i < compiled.items.size(); i++) {
+		const logformat_item_t &item = compiled.items[i];
+		
+		size_t end = find_delimiter(item, line, length, NULL, 0, pos);
+		if (end == FIELD_ABSENT)
+			return;
+		
+		spans[i].start = pos;
+		spans[i].length = end - pos;
+		
+		pos = end + item.delimiter.length();
+	}
+}
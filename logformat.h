@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LOGFORMAT_H_
+#define LOGFORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "strindex.h"
+
+typedef enum {
+	FIELD_NONE,        /**< Directive not interpreted */
+	FIELD_VHOST,       /**< %V, %v */
+	FIELD_HOST,        /**< %h, %a */
+	FIELD_TIME,        /**< %t */
+	FIELD_REQUEST,     /**< %r */
+	FIELD_STATUS,      /**< %s, %>s */
+	FIELD_BYTES,       /**< %b, %B */
+	FIELD_REFERER,     /**< %{Referer}i */
+	FIELD_USER_AGENT,  /**< %{User-agent}i */
+	FIELD_DURATION,    /**< %D */
+	FIELD_BYTES_IN,    /**< %I */
+	FIELD_BYTES_OUT,   /**< %O */
+	FIELDS
+} field_t; /**< Interpreted LogFormat directives */
+
+/** Offset of a field which is not present */
+#define FIELD_ABSENT  ((size_t) -1)
+
+typedef struct {
+	size_t start;
+	size_t length;
+} field_span_t; /**< Field position within the log entry */
+
+typedef struct {
+	field_span_t field[FIELDS];
+	
+	/* Start of the part of the entry stored to the domain log */
+	size_t payload;
+} log_fields_t; /**< Parsed log entry */
+
+typedef struct {
+	field_t field;
+	
+	/* Field may contain backslash escapes (quoted field) */
+	bool escaped;
+	
+	/* Literal text following the field */
+	std::string delimiter;
+	
+	/* Structural class of the first delimiter character (or -1) */
+	int delimiter_class;
+} logformat_item_t; /**< Compiled LogFormat directive */
+
+typedef struct {
+	/* Literal text preceding the first directive */
+	std::string leader;
+	
+	std::vector< logformat_item_t> items;
+	
+	/* Number of items which need to be parsed */
+	size_t needed;
+	
+	/* The virtual host is the first field (stripped from the log) */
+	bool vhost_prefix;
+} logformat_t; /**< Compiled LogFormat */
+
+/** Default LogFormat (combined with virtual host) */
+#define LOGFORMAT_DEFAULT \
+	"%V %h %l %u %t \"%r\" %>s %b \"%{Referer}i\" \"%{User-agent}i\""
+
+extern bool logformat_compile(const std::string &, logformat_t &,
+    std::string &);
+extern bool logformat_require(logformat_t &, field_t);
+extern bool logformat_parse(const logformat_t &, const char *, size_t,
+    const strindex_t *, size_t, log_fields_t &);
+extern void logformat_rebase(log_fields_t &);
+extern void logformat_split(const logformat_t &, const char *, size_t,
+    std::vector< field_span_t> &);
+
+/** Check whether a field has been parsed
+ *
+ * @param fields Parsed log entry.
+ * @param field  Field to check.
+ *
+ * @return True if the field is present.
+ *
+ */
+static inline bool field_present(const log_fields_t &fields, field_t field)
+{
+	return (fields.field[field].start != FIELD_ABSENT);
+}
+
+#endif
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "lz4.h"
+
+/*
+ * Compressor and decompressor of the LZ4 block format
+ * (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md).
+ * The compressor is the greedy single-probe variant, which
+ * trades some compression ratio for speed.
+ */
+
+/** Minimal match length */
+#define MIN_MATCH  4
+
+/** The last bytes are always literals */
+#define LAST_LITERALS  5
+
+/** The last match must start this far from the end */
+#define MATCH_LIMIT  12
+
+/** Maximal match offset */
+#define MAX_OFFSET  65535
+
+/** Size of the match finder hash table (log2) */
+#define HASH_BITS  12
+
+/** Load 4 bytes (unaligned) */
+static inline uint32_t load32(const uint8_t *data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+/** Hash 4 bytes into the match finder table */
+static inline uint32_t hash32(uint32_t value)
+{
+	return (value * UINT32_C(2654435761)) >> (32 - HASH_BITS);
+}
+
+/** Store length continuation bytes
+ *
+ * @param out    Output position.
+ * @param length Length above the 4-bit token part.
+ *
+ * @return Output position after the continuation bytes.
+ *
+ */
+static inline uint8_t *put_length(uint8_t *out, size_t length)
+{
+	while (length >= 255) {
+		*out++ = 255;
+		length -= 255;
+	}
+	
+	*out++ = length;
+	return out;
+}
+
+/** Store sequence
+ *
+ * @param out      Output position.
+ * @param literals Literals.
+ * @param count    Number of literals.
+ * @param offset   Match offset (0 for the last sequence).
+ * @param match    Match length.
+ *
+ * @return Output position after the sequence.
+ *
+ */
+static uint8_t *put_sequence(uint8_t *out, const uint8_t *literals,
+    size_t count, size_t offset, size_t match)
+{
+	uint8_t *token = out++;
+	
+	if (count >= 15) {
+		*token = 15 << 4;
+		out = put_length(out, count - 15);
+	} else
+		*token = count << 4;
+	
+	memcpy(out, literals, count);
+	out += count;
+	
+	if (offset == 0)
+		return out;
+	
+	*out++ = offset & 0xff;
+	*out++ = offset >> 8;
+	
+	match -= MIN_MATCH;
+	if (match >= 15) {
+		*token |= 15;
+		out = put_length(out, match - 15);
+	} else
+		*token |= match;
+	
+	return out;
+}
+
+/** Compress data
+ *
+ * @param src    Data to compress.
+ * @param length Length of the data.
+ * @param dst    Output buffer (at least lz4_bound(length) bytes).
+ *
+ * @return Length of the compressed data.
+ *
+ */
+size_t lz4_compress(const char *src, size_t length, char *dst)
+{
+	const uint8_t *data = (const uint8_t *) src;
+	uint8_t *out = (uint8_t *) dst;
+	uint32_t table[1 << HASH_BITS];
+	
+	size_t anchor = 0;
+	
+	if (length > MATCH_LIMIT) {
+		memset(table, 0, sizeof(table));
+		
+		size_t limit = length - MATCH_LIMIT;
+		size_t pos = 1;
+		
+		while (pos < limit) {
+			uint32_t sequence = load32(data + pos);
+			uint32_t hash = hash32(sequence);
+			size_t ref = table[hash];
+			table[hash] = pos;
+			
+			if ((pos - ref > MAX_OFFSET) || (load32(data + ref) != sequence)) {
+				/* Skip faster over incompressible data */
+				pos += 1 + ((pos - anchor) >> 6);
+				continue;
+			}
+			
+			while ((pos > anchor) && (ref > 0) &&
+			    (data[pos - 1] == data[ref - 1])) {
+				pos--;
+				ref--;
+			}
+			
+			size_t match = MIN_MATCH;
+			while ((pos + match < length - LAST_LITERALS) &&
+			    (data[pos + match] == data[ref + match]))
+				match++;
+			
+			out = put_sequence(out, data + anchor, pos - anchor,
+			    pos - ref, match);
+			
+			pos += match;
+			anchor = pos;
+		}
+	}
+	
+	out = put_sequence(out, data + anchor, length - anchor, 0, 0);
+	return out - (uint8_t *) dst;
+}
+
+/** Load length continuation bytes
+ *
+ * @param in     Input position.
+ * @param end    End of the input.
+ * @param length Length to increase.
+ *
+ * @return False on truncated input.
+ *
+ */
+static inline bool get_length(const uint8_t *&in, const uint8_t *end,
+    size_t &length)
+{
+	uint8_t byte;
+	
+	do {
+		if (in >= end)
+			return false;
+		
+		byte = *in++;
+		length += byte;
+	} while (byte == 255);
+	
+	return true;
+}
+
+/** Decompress data
+ *
+ * @param src    Compressed data.
+ * @param length Length of the compressed data.
+ * @param dst    Output buffer.
+ * @param size   Exact length of the decompressed data.
+ *
+ * @return False if the compressed data are corrupted.
+ *
+ */
+bool lz4_decompress(const char *src, size_t length, char *dst, size_t size)
+{
+	const uint8_t *in = (const uint8_t *) src;
+	const uint8_t *end = in + length;
+	uint8_t *out = (uint8_t *) dst;
+	uint8_t *out_end = out + size;
+	
+	while (in < end) {
+		uint8_t token = *in++;
+		
+		size_t count = token >> 4;
+		if ((count == 15) && (!get_length(in, end, count)))
+			return false;
+		
+		if ((count > (size_t) (end - in)) ||
+		    (count > (size_t) (out_end - out)))
+			return false;
+		
+		memcpy(out, in, count);
+		in += count;
+		out += count;
+		
+		/* Last sequence */
+		if (in == end)
+			break;
+		
+		if (end - in < 2)
+			return false;
+		
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		
+		if ((offset == 0) || (offset > (size_t) (out - (uint8_t *) dst)))
+			return false;
+		
+		size_t match = token & 15;
+		if ((match == 15) && (!get_length(in, end, match)))
+			return false;
+		
+		match += MIN_MATCH;
+		if (match > (size_t) (out_end - out))
+			return false;
+		
+		/* The match may overlap the output */
+		const uint8_t *ref = out - offset;
+		if (offset >= match)
+			memcpy(out, ref, match);
+		else {
+			for (size_t i = 0; i < match; i++)
+				out[i] = ref[i];
+		}
+		
+		out += match;
+	}
+	
+	return (out == out_end);
+}
@@ -0,0 +1,523 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Build-time compiler of the Public Suffix List
+ *
+ * Reads the list (public_suffix_list.dat) and writes the C++
+ * table used by psl.cpp (see psl_edge_t) to the standard output.
+ * Only the ICANN section of the list is compiled, the private
+ * section lists the suffixes operated by hosting providers.
+ * Without the list, an empty table is written (accesslog then
+ * refuses to route by the registrable domain).
+ */
+
+#include <stdint.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "psl.h"
+
+using namespace std;
+
+/** Maximal number of tree nodes (node identifiers are 16 bits) */
+#define NODES_MAX  UINT16_MAX
+
+/** Maximal size of the label pool (label offsets are 16 bits) */
+#define POOL_MAX  UINT16_MAX
+
+typedef struct {
+	/* Child nodes by label */
+	map< string, uint16_t> children;
+	
+	/* Flags of the node (PSL_RULE, PSL_WILDCARD, PSL_EXCEPTION) */
+	uint8_t flags;
+} tree_node_t; /**< Node of the suffix tree */
+
+/** Nodes of the suffix tree (the root is 0) */
+static vector< tree_node_t> nodes(1);
+
+/** Punycode parameters (RFC 3492) */
+#define PUNYCODE_BASE          36
+#define PUNYCODE_TMIN          1
+#define PUNYCODE_TMAX          26
+#define PUNYCODE_SKEW          38
+#define PUNYCODE_DAMP          700
+#define PUNYCODE_INITIAL_BIAS  72
+#define PUNYCODE_INITIAL_N     128
+
+/** Adapt the Punycode bias (RFC 3492 section 6.1)
+ *
+ * @param delta     Delta.
+ * @param points    Number of code points encoded so far.
+ * @param first     First delta.
+ *
+ * @return New bias.
+ *
+ */
+static uint32_t punycode_adapt(uint32_t delta, uint32_t points, bool first)
+{
+	delta = first ? delta / PUNYCODE_DAMP : delta / 2;
+	delta += delta / points;
+	
+	uint32_t k = 0;
+	while (delta > ((PUNYCODE_BASE - PUNYCODE_TMIN) * PUNYCODE_TMAX) / 2) {
+		delta /= PUNYCODE_BASE - PUNYCODE_TMIN;
+		k += PUNYCODE_BASE;
+	}
+	
+	return k + (PUNYCODE_BASE - PUNYCODE_TMIN + 1) * delta /
+	    (delta + PUNYCODE_SKEW);
+}
+
+/** Encode Punycode digit
+ *
+ * @param digit Digit (0 to 35).
+ *
+ * @return Encoded digit.
+ *
+ */
+static char punycode_digit(uint32_t digit)
+{
+	return (digit < 26) ? 'a' + digit : '0' + digit - 26;
+}
+
+/** Convert UTF-8 label into its ASCII form (RFC 3492)
+ *
+ * @param label UTF-8 label.
+ *
+ * @return ASCII label ("xn--" and Punycode if the label is
+ *         not ASCII, the label itself otherwise).
+ *
+ */
+static string ascii_label(const string &label)
+{
+	vector< uint32_t> points;
+	bool ascii = true;
+	
+	for (size_t i = 0; i < label.length(); ) {
+		uint8_t byte = label[i];
+		uint32_t point;
+		size_t extra;
+		
+		if (byte < 0x80) {
+			point = byte;
+			extra = 0;
+		} else if ((byte & 0xe0) == 0xc0) {
+			point = byte & 0x1f;
+			extra = 1;
+		} else if ((byte & 0xf0) == 0xe0) {
+			point = byte & 0x0f;
+			extra = 2;
+		} else {
+			point = byte & 0x07;
+			extra = 3;
+		}
+		
+		i++;
+		for (; (extra > 0) && (i < label.length()); extra--, i++)
+			point = (point << 6) | (label[i] & 0x3f);
+		
+		if (point >= 0x80)
+			ascii = false;
+		
+		points.push_back(point);
+	}
+	
+	if (ascii)
+		return label;
+	
+	string output;
+	for (size_t i = 0; i < points.size(); i++) {
+		if (points[i] < 0x80)
+			output.push_back(points[i]);
+	}
+	
+	uint32_t basic = output.length();
+	uint32_t handled = basic;
+	if (basic > 0)
+		output.push_back('-');
+	
+	uint32_t n = PUNYCODE_INITIAL_N;
+	uint32_t delta = 0;
+	uint32_t bias = PUNYCODE_INITIAL_BIAS;
+	
+	while (handled < points.size()) {
+		uint32_t m = UINT32_MAX;
+		for (size_t i = 0; i < points.size(); i++) {
+			if ((points[i] >= n) && (points[i] < m))
+				m = points[i];
+		}
+		
+		delta += (m - n) * (handled + 1);
+		n = m;
+		
+		for (size_t i = 0; i < points.size(); i++) {
+			if (points[i] < n)
+				delta++;
+			
+			if (points[i] != n)
+				continue;
+			
+			uint32_t q = delta;
+			for (uint32_t k = PUNYCODE_BASE; ; k += PUNYCODE_BASE) {
+				uint32_t t = (k <= bias) ? PUNYCODE_TMIN :
+				    ((k >= bias + PUNYCODE_TMAX) ? PUNYCODE_TMAX : k - bias);
+				if (q < t)
+					break;
+				
+				output.push_back(punycode_digit(t + (q - t) %
+				    (PUNYCODE_BASE - t)));
+				q = (q - t) / (PUNYCODE_BASE - t);
+			}
+			
+			output.push_back(punycode_digit(q));
+			bias = punycode_adapt(delta, handled + 1, handled == basic);
+			delta = 0;
+			handled++;
+		}
+		
+		delta++;
+		n++;
+	}
+	
+	return "xn--" + output;
+}
+
+/** Add rule to the suffix tree
+ *
+ * @param labels Labels of the rule (from the top-level domain).
+ * @param flags  Flag of the rule (PSL_RULE, PSL_WILDCARD
+ *               or PSL_EXCEPTION).
+ *
+ * @return True on success.
+ * @return False if the tree is too large.
+ *
+ */
+static bool add_rule(const vector< string> &labels, uint8_t flags)
+{
+	uint16_t node = 0;
+	
+	for (size_t i = 0; i < labels.size(); i++) {
+		map< string, uint16_t>::iterator it =
+		    nodes[node].children.find(labels[i]);
+		
+		if (it == nodes[node].children.end()) {
+			if (nodes.size() >= NODES_MAX)
+				return false;
+			
+			uint16_t child = nodes.size();
+			nodes[node].children[labels[i]] = child;
+			nodes.push_back(tree_node_t());
+			nodes[child].flags = 0;
+			node = child;
+		} else
+			node = it->second;
+	}
+	
+	nodes[node].flags |= flags;
+	return true;
+}
+
+/** Parse rule and add it to the suffix tree
+ *
+ * Labels which are not ASCII are added both as UTF-8
+ * and in the ASCII (Punycode) form, since the host
+ * names are logged in either form.
+ *
+ * @param rule Rule from the list.
+ *
+ * @return True on success.
+ * @return False on an invalid rule or if the tree is too large.
+ *
+ */
+static bool parse_rule(string rule)
+{
+	uint8_t flags = PSL_RULE;
+	
+	if (rule[0] == '!') {
+		flags = PSL_EXCEPTION;
+		rule.erase(0, 1);
+	} else if (rule.compare(0, 2, "*.") == 0) {
+		flags = PSL_WILDCARD;
+		rule.erase(0, 2);
+	}
+	
+	vector< string> labels;
+	vector< string> ascii_labels;
+	bool ascii = true;
+	
+	size_t end = rule.length();
+	while (true) {
+		size_t dot = rule.rfind('.', end - 1);
+		size_t start = (dot == string::npos) ? 0 : dot + 1;
+		string label = rule.substr(start, end - start);
+		
+		if ((label.empty()) || (label.length() > PSL_LABEL_MAX) ||
+		    (label == "*"))
+			return false;
+		
+		string ascii_form = ascii_label(label);
+		if (ascii_form != label)
+			ascii = false;
+		
+		labels.push_back(label);
+		ascii_labels.push_back(ascii_form);
+		
+		if (dot == string::npos)
+			break;
+		
+		end = dot;
+	}
+	
+	if (!add_rule(labels, flags))
+		return false;
+	
+	if (!ascii)
+		return add_rule(ascii_labels, flags);
+	
+	return true;
+}
+
+/** Write label pool as C++ string literal lines
+ *
+ * @param pool Label pool.
+ *
+ */
+static void write_pool(const string &pool)
+{
+	cout << "static const char psl_labels[] =";
+	
+	/* Empty table */
+	if (pool.empty())
+		cout << " \"\"";
+	
+	for (size_t i = 0; i < pool.length(); i += 16) {
+		cout << endl << "\t\"";
+		
+		for (size_t j = i; (j < i + 16) && (j < pool.length()); j++) {
+			uint8_t byte = pool[j];
+			char octal[5];
+			
+			octal[0] = '\\';
+			octal[1] = '0' + ((byte >> 6) & 7);
+			octal[2] = '0' + ((byte >> 3) & 7);
+			octal[3] = '0' + (byte & 7);
+			octal[4] = 0;
+			
+			/* Octal escapes have always three digits */
+			if (((byte >= 'a') && (byte <= 'z')) ||
+			    ((byte >= '0') && (byte <= '9')) || (byte == '-'))
+				cout << (char) byte;
+			else
+				cout << octal;
+		}
+		
+		cout << "\"";
+	}
+	
+	cout << ";" << endl << endl;
+}
+
+/** Compile the suffix tree into the edge hash table
+ *
+ * @param source Name of the list (empty if there is no list).
+ *
+ * @return True on success.
+ * @return False if the label pool is too large.
+ *
+ */
+static bool write_table(const string &source)
+{
+	size_t edges = nodes.size() - 1;
+	
+	/* Keep the load factor under 1/2 */
+	size_t size = 1;
+	while (size < 2 * edges)
+		size *= 2;
+	
+	vector< psl_edge_t> table(size);
+	for (size_t i = 0; i < size; i++) {
+		table[i].label = 0;
+		table[i].parent = 0;
+		table[i].node = 0;
+		table[i].length = 0;
+		table[i].flags = 0;
+	}
+	
+	string pool;
+	map< string, uint32_t> offsets;
+	size_t probes_max = 0;
+	size_t probes_total = 0;
+	
+	for (size_t parent = 0; parent < nodes.size(); parent++) {
+		for (map< string, uint16_t>::iterator it =
+		    nodes[parent].children.begin();
+		    it != nodes[parent].children.end(); ++it) {
+			const string &label = it->first;
+			
+			map< string, uint32_t>::iterator offset = offsets.find(label);
+			if (offset == offsets.end()) {
+				if (pool.length() + label.length() > POOL_MAX) {
+					cerr << source << ": Label pool too large" << endl;
+					return false;
+				}
+				
+				offset = offsets.insert(make_pair(label,
+				    (uint32_t) pool.length())).first;
+				pool.append(label);
+			}
+			
+			size_t pos = psl_hash(parent, label.c_str(), label.length()) &
+			    (size - 1);
+			size_t probes = 1;
+			
+			while (table[pos].length != 0) {
+				pos = (pos + 1) & (size - 1);
+				probes++;
+			}
+			
+			if (probes > probes_max)
+				probes_max = probes;
+			
+			probes_total += probes;
+			
+			table[pos].label = offset->second;
+			table[pos].parent = parent;
+			table[pos].node = it->second;
+			table[pos].length = label.length();
+			table[pos].flags = nodes[it->second].flags;
+		}
+	}
+	
+	cout << "/*" << endl;
+	
+	if (source.empty())
+		cout << " * Generated by psl-compile without the list (empty)." <<
+		    endl;
+	else {
+		cout << " * Generated by psl-compile from " << source << endl;
+		cout << " * (" << edges << " edges, " << pool.length() <<
+		    " bytes of labels, " << (double) probes_total / edges <<
+		    " probes on average, " << probes_max << " at most)." << endl;
+	}
+	
+	cout << " * Do not edit." << endl;
+	cout << " */" << endl << endl;
+	cout << "#define PSL_EDGES  " << size << endl;
+	cout << "#define PSL_LOADED  " << ((edges > 0) ? 1 : 0) << endl << endl;
+	
+	write_pool(pool);
+	
+	cout << "static const psl_edge_t psl_edges[PSL_EDGES] = {" << endl;
+	for (size_t i = 0; i < size; i++) {
+		cout << "\t{ " << table[i].label << ", " << table[i].parent <<
+		    ", " << table[i].node << ", " << (unsigned int) table[i].length <<
+		    ", " << (unsigned int) table[i].flags << " }" <<
+		    ((i + 1 < size) ? "," : "") << endl;
+	}
+	cout << "};" << endl;
+	
+	return true;
+}
+
+/** Print usage information
+ *
+ * @param name Program name.
+ *
+ */
+static void usage(const char *name)
+{
+	cerr << "Usage: " << name << " [public_suffix_list.dat]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 2) {
+		usage(argv[0]);
+		return 1;
+	}
+	
+	/* No list, empty table */
+	if (argc == 1) {
+		cerr << "Public Suffix List not found, --public-suffix will not "
+		    "be available" << endl;
+		return write_table("") ? 0 : 1;
+	}
+	
+	ifstream list(argv[1]);
+	if (!list.is_open()) {
+		cerr << "Unable to open " << argv[1] << endl;
+		return 1;
+	}
+	
+	bool icann = false;
+	string line;
+	size_t line_number = 0;
+	
+	while (getline(list, line)) {
+		line_number++;
+		
+		if (line.find("===BEGIN ICANN DOMAINS===") != string::npos)
+			icann = true;
+		
+		if (line.find("===END ICANN DOMAINS===") != string::npos)
+			icann = false;
+		
+		/* The rule is the first word of the line */
+		size_t end = line.find_first_of(" \t\r");
+		if (end != string::npos)
+			line.erase(end);
+		
+		if ((!icann) || (line.empty()) || (line.compare(0, 2, "//") == 0))
+			continue;
+		
+		for (size_t i = 0; i < line.length(); i++) {
+			if ((line[i] >= 'A') && (line[i] <= 'Z'))
+				line[i] += 'a' - 'A';
+		}
+		
+		if (!parse_rule(line)) {
+			cerr << argv[1] << ":" << line_number << ": Invalid rule "
+			    << line << endl;
+			return 1;
+		}
+	}
+	
+	if (nodes.size() == 1) {
+		cerr << argv[1] << ": No ICANN rules" << endl;
+		return 1;
+	}
+	
+	if (!write_table(argv[1]))
+		return 1;
+	
+	return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "psl.h"
+#include "psl-table.h"
+
+/** Convert ASCII character to lower case
+ *
+ * @param c Character.
+ *
+ * @return Lower case character.
+ *
+ */
+static inline char lower(char c)
+{
+	return ((c >= 'A') && (c <= 'Z')) ? c + 'a' - 'A' : c;
+}
+
+/** Find edge of the suffix tree
+ *
+ * @param parent Parent node.
+ * @param hash   Hash of the edge (see psl_hash()).
+ * @param label  Label (compared in lower case).
+ * @param length Length of the label.
+ *
+ * @return Edge from the parent node with the label.
+ * @return NULL if there is no such edge.
+ *
+ */
+static const psl_edge_t *find_edge(uint16_t parent, uint64_t hash,
+    const char *label, size_t length)
+{
+	size_t pos = hash & (PSL_EDGES - 1);
+	
+	while (psl_edges[pos].length != 0) {
+		const psl_edge_t *edge = &psl_edges[pos];
+		
+		if ((edge->parent == parent) && (edge->length == length)) {
+			/* The labels are short, no need for memcmp() */
+			const char *stored = psl_labels + edge->label;
+			size_t i = 0;
+			
+			while ((i < length) && (stored[i] == lower(label[i])))
+				i++;
+			
+			if (i == length)
+				return edge;
+		}
+		
+		pos = (pos + 1) & (PSL_EDGES - 1);
+	}
+	
+	return NULL;
+}
+
+/** Find the registrable domain of a host name
+ *
+ * The registrable domain is the public suffix (the longest
+ * matching rule of the Public Suffix List, or the top-level
+ * domain if no rule matches) with one more label, e.g.
+ * "example.co.uk" for "shop.example.co.uk". The host name
+ * is matched case-insensitively.
+ *
+ * @param name   Host name.
+ * @param length Length of the host name.
+ * @param start  Where to store the offset of the registrable
+ *               domain in the host name.
+ *
+ * @return True if the host name has a registrable domain.
+ * @return False if the host name is a public suffix itself.
+ *
+ */
+bool psl_registrable(const char *name, size_t length, size_t &start)
+{
+	uint16_t node = 0;
+	uint8_t flags = 0;
+	size_t suffix = length;
+	size_t end = length;
+	
+	while (true) {
+		/* Scan and hash the label backwards at once */
+		uint64_t hash = psl_hash_start(node);
+		size_t label_start = end;
+		
+		while ((label_start > 0) && (name[label_start - 1] != '.')) {
+			label_start--;
+			hash = psl_hash_byte(hash, lower(name[label_start]));
+		}
+		
+		size_t label_length = end - label_start;
+		const psl_edge_t *edge = NULL;
+		
+		if (label_length <= PSL_LABEL_MAX)
+			edge = find_edge(node, psl_hash_end(hash), name + label_start,
+			    label_length);
+		
+		/* Exception, the public suffix is the parent */
+		if ((edge != NULL) && ((edge->flags & PSL_EXCEPTION) != 0)) {
+			suffix = end + 1;
+			break;
+		}
+		
+		/* The top-level domain is always a public suffix */
+		if ((node == 0) || ((flags & PSL_WILDCARD) != 0) ||
+		    ((edge != NULL) && ((edge->flags & PSL_RULE) != 0)))
+			suffix = label_start;
+		
+		if ((edge == NULL) || (label_start == 0))
+			break;
+		
+		node = edge->node;
+		flags = edge->flags;
+		end = label_start - 1;
+	}
+	
+	/* No label before the public suffix */
+	if (suffix == 0)
+		return false;
+	
+	start = suffix - 1;
+	while ((start > 0) && (name[start - 1] != '.'))
+		start--;
+	
+	return true;
+}
+
+/** Check whether the Public Suffix List is available
+ *
+ * The list is compiled in at build time and the table
+ * is empty if the list was not found.
+ *
+ * @return True if the table contains the list.
+ *
+ */
+bool psl_available(void)
+{
+	return (PSL_LOADED != 0);
+}
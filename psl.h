@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PSL_H_
+#define PSL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Maximal length of a domain name label */
+#define PSL_LABEL_MAX  63
+
+/** Node of the suffix tree is a public suffix (e.g. "co.uk") */
+#define PSL_RULE  1
+
+/** Any child of the node is a public suffix (e.g. "*.ck") */
+#define PSL_WILDCARD  2
+
+/** Node is an exception to the wildcard of its parent (e.g. "!www.ck") */
+#define PSL_EXCEPTION  4
+
+/** Compiled Public Suffix List
+ *
+ * The rules form a tree of the domain name labels from the
+ * top-level domain down. Each edge (parent node, label) is
+ * stored in a static open addressing hash table (linear
+ * probing, power-of-two size, empty slots have zero label
+ * length) generated by psl-compile from the list at build
+ * time. The labels are stored in a shared pool of at most
+ * 64 KiB. The root node is 0.
+ *
+ */
+typedef struct {
+	/* Offset of the label in the label pool */
+	uint16_t label;
+	
+	/* Parent node */
+	uint16_t parent;
+	
+	/* Child node */
+	uint16_t node;
+	
+	/* Length of the label (0 for an empty slot) */
+	uint8_t length;
+	
+	/* Flags of the child node (PSL_RULE, PSL_WILDCARD, PSL_EXCEPTION) */
+	uint8_t flags;
+} psl_edge_t; /**< Compiled tree edge */
+
+/** Start hashing a tree edge
+ *
+ * The label is hashed from its last byte backwards (FNV-1a),
+ * so that the host names can be hashed while being scanned
+ * for the label separators.
+ *
+ * @param parent Parent node.
+ *
+ * @return Initial hash value.
+ *
+ */
+static inline uint64_t psl_hash_start(uint16_t parent)
+{
+	return UINT64_C(0xcbf29ce484222325) ^ parent;
+}
+
+/** Hash the previous byte of the label
+ *
+ * @param hash Hash value.
+ * @param byte Byte of the label (lower case).
+ *
+ * @return Updated hash value.
+ *
+ */
+static inline uint64_t psl_hash_byte(uint64_t hash, uint8_t byte)
+{
+	return (hash ^ byte) * UINT64_C(0x100000001b3);
+}
+
+/** Finish hashing a tree edge
+ *
+ * @param hash Hash value.
+ *
+ * @return Final hash value.
+ *
+ */
+static inline uint64_t psl_hash_end(uint64_t hash)
+{
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xff51afd7ed558ccd);
+	hash ^= hash >> 33;
+	
+	return hash;
+}
+
+/** Hash of a tree edge
+ *
+ * @param parent Parent node.
+ * @param label  Label (lower case).
+ * @param length Length of the label.
+ *
+ * @return Hash value.
+ *
+ */
+static inline uint64_t psl_hash(uint16_t parent, const char *label,
+    size_t length)
+{
+	uint64_t hash = psl_hash_start(parent);
+	
+	for (size_t i = length; i > 0; i--)
+		hash = psl_hash_byte(hash, label[i - 1]);
+	
+	return psl_hash_end(hash);
+}
+
+extern bool psl_available(void);
+extern bool psl_registrable(const char *, size_t, size_t &);
+
+#endif
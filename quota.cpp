@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include "quota.h"
+#include "stats.h"
+#include "timer.h"
+
+using namespace std;
+
+/** Over-quota summary interval (ms) */
+#define QUOTA_INTERVAL  10000
+
+/** Default burst (seconds of the rate) */
+#define QUOTA_BURST  10
+
+/** Default sampling of the over-quota lines (1 in N stored) */
+#define QUOTA_SAMPLE  100
+
+typedef struct {
+	/* Rates (per second, 0 for unlimited) */
+	double lines;
+	double bytes;
+	
+	/* Bucket capacity (seconds of the rate) */
+	double burst;
+	
+	/* Store 1 in N over-quota lines (0 for none) */
+	uint64_t sample;
+} quota_limit_t; /**< Limits of a 2nd-level domain */
+
+typedef struct {
+	const quota_limit_t *limit;
+	
+	/* Tokens available */
+	double lines;
+	double bytes;
+	uint64_t updated;
+	
+	/* Over-quota lines in the current interval */
+	uint64_t over;
+	uint64_t dropped;
+} quota_bucket_t; /**< Token buckets of a 2nd-level domain */
+
+/** Limits of the 2nd-level domains */
+static unordered_map< string, quota_limit_t> limits;
+
+/** Limits of all other 2nd-level domains ("*" entry) */
+static quota_limit_t default_limit;
+static bool default_limited = false;
+
+/** Token buckets of the 2nd-level domains */
+static unordered_map< string, quota_bucket_t> buckets;
+
+/** Start of the current interval (ms) */
+static uint64_t interval_start;
+
+/** Quotas enabled */
+static bool enabled = false;
+
+/** Parse positive integer setting
+ *
+ * @param value  Setting value.
+ * @param number Parsed number.
+ *
+ * @return True if the value is a positive decimal integer.
+ *
+ */
+static bool parse_positive(const string &value, uint64_t &number)
+{
+	/* No sign, spaces or fractions */
+	if ((value.empty()) || (value.length() > 18) ||
+	    (value.find_first_not_of("0123456789") != string::npos))
+		return false;
+	
+	number = strtoull(value.c_str(), NULL, 10);
+	return (number > 0);
+}
+
+/** Parse quota limit
+ *
+ * The rates and the burst are positive integers,
+ * the sample is a non-negative integer.
+ *
+ * @param words   Limit settings (lines=N, bytes=N, burst=N, sample=N).
+ * @param limit   Parsed limit.
+ * @param invalid Invalid setting on failure.
+ *
+ * @return True on success.
+ *
+ */
+static bool parse_limit(istringstream &words, quota_limit_t &limit,
+    string &invalid)
+{
+	limit.lines = 0;
+	limit.bytes = 0;
+	limit.burst = QUOTA_BURST;
+	limit.sample = QUOTA_SAMPLE;
+	
+	string word;
+	while (words >> word) {
+		invalid = word;
+		
+		string::size_type equals = word.find('=');
+		if (equals == string::npos)
+			return false;
+		
+		string key = word.substr(0, equals);
+		string value = word.substr(equals + 1);
+		
+		uint64_t number;
+		
+		/* Sampling 0 drops all the over-quota entries */
+		if ((key == "sample") && (value == "0")) {
+			limit.sample = 0;
+			continue;
+		}
+		
+		if (!parse_positive(value, number))
+			return false;
+		
+		if (key == "lines")
+			limit.lines = number;
+		else if (key == "bytes")
+			limit.bytes = number;
+		else if (key == "burst")
+			limit.burst = number;
+		else if (key == "sample")
+			limit.sample = number;
+		else
+			return false;
+	}
+	
+	return true;
+}
+
+/** Initialize per-domain quotas
+ *
+ * Each line of the quota list contains a 2nd-level
+ * domain name or "*" (covering all other domains)
+ * followed by the limits (lines=N and bytes=N per
+ * second, burst=SECONDS and sample=N).
+ *
+ * @param path  Quota list path.
+ * @param error Error description on failure.
+ *
+ * @return True on success.
+ *
+ */
+bool quota_init(const char *path, string &error)
+{
+	ifstream file(path);
+	if (!file) {
+		error = string("Unable to open ") + path;
+		return false;
+	}
+	
+	string line;
+	unsigned int number = 0;
+	
+	while (getline(file, line)) {
+		number++;
+		
+		istringstream words(line);
+		string domain;
+		
+		/* Empty line or comment */
+		if ((!(words >> domain)) || (domain[0] == '#'))
+			continue;
+		
+		quota_limit_t limit;
+		string invalid;
+		if (!parse_limit(words, limit, invalid)) {
+			ostringstream stream;
+			stream << path << ":" << number << ": Invalid limit '" <<
+			    invalid << "'";
+			error = stream.str();
+			return false;
+		}
+		
+		for (size_t i = 0; i < domain.length(); i++)
+			domain[i] = tolower(domain[i]);
+		
+		if (domain == "*") {
+			default_limit = limit;
+			default_limited = true;
+		} else
+			limits[domain] = limit;
+	}
+	
+	interval_start = monotonic_ms();
+	enabled = true;
+	return true;
+}
+
+/** Find token buckets of a 2nd-level domain
+ *
+ * Only the limited domains get the token buckets,
+ * thus random host names do not grow the bucket
+ * map unless there is a default limit (and then
+ * the idle buckets are expired by quota_tick()).
+ *
+ * @param domain 2nd-level domain name.
+ *
+ * @return Token buckets (NULL if the domain is not limited).
+ *
+ */
+static quota_bucket_t *find_bucket(const string &domain)
+{
+	unordered_map< string, quota_bucket_t>::iterator it =
+	    buckets.find(domain);
+	if (it != buckets.end())
+		return &it->second;
+	
+	const quota_limit_t *limit = NULL;
+	
+	if (!limits.empty()) {
+		string name = domain;
+		for (size_t i = 0; i < name.length(); i++)
+			name[i] = tolower(name[i]);
+		
+		unordered_map< string, quota_limit_t>::const_iterator found =
+		    limits.find(name);
+		if (found != limits.end())
+			limit = &found->second;
+	}
+	
+	if ((limit == NULL) && (default_limited))
+		limit = &default_limit;
+	
+	/* No rates (e.g. a domain exempted from the default limit) */
+	if ((limit == NULL) || ((limit->lines == 0) && (limit->bytes == 0)))
+		return NULL;
+	
+	quota_bucket_t &bucket = buckets[domain];
+	bucket.limit = limit;
+	
+	/* Start with full buckets */
+	bucket.lines = limit->lines * limit->burst;
+	bucket.bytes = limit->bytes * limit->burst;
+	bucket.updated = monotonic_ms();
+	bucket.over = 0;
+	bucket.dropped = 0;
+	
+	return &bucket;
+}
+
+/** Account log entry to the quota of its domain
+ *
+ * @param domain 2nd-level domain name.
+ * @param bytes  Number of bytes to be written.
+ *
+ * @return True if the entry should be stored.
+ *
+ */
+bool quota_entry(const string &domain, size_t bytes)
+{
+	if (!enabled)
+		return true;
+	
+	quota_bucket_t *bucket = find_bucket(domain);
+	if (bucket == NULL)
+		return true;
+	
+	const quota_limit_t &limit = *bucket->limit;
+	
+	/* Refill */
+	uint64_t now = monotonic_ms();
+	if (now != bucket->updated) {
+		double elapsed = (now - bucket->updated) / 1000.0;
+		
+		bucket->lines = min(bucket->lines + limit.lines * elapsed,
+		    limit.lines * limit.burst);
+		bucket->bytes = min(bucket->bytes + limit.bytes * elapsed,
+		    limit.bytes * limit.burst);
+		bucket->updated = now;
+	}
+	
+	bool lines_ok = (limit.lines == 0) || (bucket->lines >= 1);
+	bool bytes_ok = (limit.bytes == 0) || (bucket->bytes >= bytes);
+	
+	if ((lines_ok) && (bytes_ok)) {
+		bucket->lines -= 1;
+		bucket->bytes -= bytes;
+		return true;
+	}
+	
+	/* Over quota: store only a sample */
+	bucket->over++;
+	if ((limit.sample != 0) &&
+	    (bucket->over % limit.sample == 1 % limit.sample))
+		return true;
+	
+	bucket->dropped++;
+	stats_throttled();
+	return false;
+}
+
+/** Print the over-quota summary of the current interval
+ *
+ * @param elapsed Length of the current interval (ms).
+ *
+ */
+static void summarize(uint64_t elapsed)
+{
+	for (unordered_map< string, quota_bucket_t>::iterator it =
+	    buckets.begin(); it != buckets.end(); ++it) {
+		quota_bucket_t &bucket = it->second;
+		
+		if (bucket.over == 0)
+			continue;
+		
+		cerr << "accesslog: " << it->first << " over quota with " <<
+		    bucket.over << " lines in last " <<
+		    (elapsed + 500) / 1000 << " s, " << bucket.dropped <<
+		    " dropped" << endl;
+		
+		bucket.over = 0;
+		bucket.dropped = 0;
+	}
+}
+
+/** Expire the idle token buckets
+ *
+ * A bucket idle for its whole burst has been refilled
+ * to the full capacity, thus it is equivalent to a new
+ * bucket and it can be removed.
+ *
+ * @param now Current time (ms).
+ *
+ */
+static void expire(uint64_t now)
+{
+	unordered_map< string, quota_bucket_t>::iterator it = buckets.begin();
+	
+	while (it != buckets.end()) {
+		const quota_bucket_t &bucket = it->second;
+		
+		if ((bucket.over == 0) &&
+		    (now - bucket.updated >= bucket.limit->burst * 1000))
+			it = buckets.erase(it);
+		else
+			++it;
+	}
+}
+
+/** Print the over-quota summary periodically
+ *
+ * Does nothing until the summary interval
+ * elapses, thus it is cheap to call per line.
+ * The idle token buckets are expired after
+ * each summary.
+ *
+ */
+void quota_tick(void)
+{
+	if (!enabled)
+		return;
+	
+	uint64_t now = monotonic_ms();
+	uint64_t elapsed = now - interval_start;
+	if (elapsed < QUOTA_INTERVAL)
+		return;
+	
+	summarize(elapsed);
+	expire(now);
+	interval_start = now;
+}
+
+/** Finish per-domain quotas
+ *
+ * Print the summary of the last interval.
+ *
+ */
+void quota_done(void)
+{
+	if (!enabled)
+		return;
+	
+	summarize(monotonic_ms() - interval_start);
+}
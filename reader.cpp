@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <vector>
+#include "reader.h"
+
+/** Initial size of the input buffer */
+#define READER_BUFFER  262144
+
+/** Initialize reader
+ *
+ * @param reader  Reader to initialize.
+ * @param fd      File descriptor to read from.
+ * @param handler Log entry handler.
+ * @param arg     Argument passed to the handler.
+ *
+ */
+void reader_init(reader_t &reader, int fd, line_handler_t handler, void *arg)
+{
+	reader.fd = fd;
+	reader.buffer.resize(READER_BUFFER);
+	reader.start = 0;
+	reader.end = 0;
+	reader.index.length = 0;
+	reader.handler = handler;
+	reader.arg = arg;
+}
+
+/** Process the complete log entries of a block
+ *
+ * The block is indexed and the log entries are split
+ * by the newline bitmask of the structural index.
+ *
+ * @param index   Structural index to build.
+ * @param data    Block of log entries.
+ * @param length  Length of the block.
+ * @param handler Log entry handler.
+ * @param arg     Argument passed to the handler.
+ *
+ * @return Length of the complete log entries (including
+ *         the newlines) processed.
+ *
+ */
+size_t reader_split(strindex_t &index, const char *data, size_t length,
+    line_handler_t handler, void *arg)
+{
+	strindex_build(index, data, length);
+	
+	size_t pos = 0;
+	while (true) {
+		size_t newline = strindex_next(index, STRINDEX_NEWLINE, pos,
+		    length, false);
+		if (newline == length)
+			break;
+		
+		handler(data + pos, newline - pos, index, pos, arg);
+		pos = newline + 1;
+	}
+	
+	return pos;
+}
+
+/** Read a block of input and process the complete log entries
+ *
+ * The pending data are split into the log entries by
+ * reader_split(). An incomplete entry at the end of the
+ * block is kept in the buffer until the rest of it is
+ * read.
+ *
+ * @param reader Reader.
+ *
+ * @return True if more input can be read.
+ * @return False on end of input or on read error.
+ *
+ */
+bool reader_read(reader_t &reader)
+{
+	/* Make room for more input */
+	if (reader.end == reader.buffer.size()) {
+		if (reader.start > 0) {
+			memmove(&reader.buffer[0], &reader.buffer[reader.start],
+			    reader.end - reader.start);
+			reader.end -= reader.start;
+			reader.start = 0;
+		} else
+			reader.buffer.resize(reader.buffer.size() * 2);
+	}
+	
+	ssize_t count = read(reader.fd, &reader.buffer[reader.end],
+	    reader.buffer.size() - reader.end);
+	
+	if (count < 0)
+		return (errno == EINTR) || (errno == EAGAIN);
+	
+	const char *data = &reader.buffer[reader.start];
+	
+	if (count == 0) {
+		/* Last entry without the terminating newline */
+		size_t length = reader.end - reader.start;
+		if (length > 0) {
+			strindex_build(reader.index, data, length);
+			reader.handler(data, length, reader.index, 0, reader.arg);
+		}
+		
+		reader.start = 0;
+		reader.end = 0;
+		return false;
+	}
+	
+	reader.end += count;
+	
+	size_t length = reader.end - reader.start;
+	reader.start += reader_split(reader.index, data, length, reader.handler,
+	    reader.arg);
+	
+	/* Nothing pending */
+	if (reader.start == reader.end) {
+		reader.start = 0;
+		reader.end = 0;
+	}
+	
+	return true;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef READER_H_
+#define READER_H_
+
+#include <stddef.h>
+#include <vector>
+#include "strindex.h"
+
+/** Log entry handler
+ *
+ * The handler is called with the log entry (without the
+ * terminating newline), its length, the structural index
+ * of the block containing the entry, the offset of the
+ * entry within the block and the reader argument.
+ *
+ */
+typedef void (*line_handler_t)(const char *, size_t, const strindex_t &,
+    size_t, void *);
+
+typedef struct {
+	int fd;
+	
+	/* Input buffer with the data between start and end pending */
+	std::vector< char> buffer;
+	size_t start;
+	size_t end;
+	
+	strindex_t index;
+	
+	line_handler_t handler;
+	void *arg;
+} reader_t; /**< Block reader of log entries */
+
+extern size_t reader_split(strindex_t &, const char *, size_t,
+    line_handler_t, void *);
+extern void reader_init(reader_t &, int, line_handler_t, void *);
+extern bool reader_read(reader_t &);
+
+#endif
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string>
+#include <unordered_map>
+#include "rollup.h"
+#include "timer.h"
+
+using namespace std;
+
+/** Number of minutes kept open for late entries */
+#define ROLLUP_WINDOW  2
+
+/** Check interval for minutes closed by the wall clock (ms) */
+#define ROLLUP_INTERVAL  10000
+
+typedef struct {
+	/* Open minutes (oldest first) */
+	rollup_record_t minutes[ROLLUP_WINDOW];
+	unsigned int count;
+	
+	/* Month directory (relative to the prefix) and rollup file name */
+	string dir;
+	string name;
+} rollup_entry_t; /**< Open minutes of a domain log */
+
+/** Open minutes indexed by the domain log path */
+typedef unordered_map< string, rollup_entry_t> rollup_map;
+
+/** Rollups enabled */
+static bool enabled = false;
+
+/** Open minutes */
+static rollup_map entries;
+
+/** Time of the last check (ms) */
+static uint64_t last_check;
+
+/** Enable rollups
+ *
+ * @param format Compiled log format (the status, size and
+ *               duration fields are required if present).
+ *
+ */
+void rollup_init(logformat_t &format)
+{
+	logformat_require(format, FIELD_STATUS);
+	logformat_require(format, FIELD_BYTES);
+	logformat_require(format, FIELD_DURATION);
+	
+	enabled = true;
+	last_check = monotonic_ms();
+}
+
+/** Append closed minutes to the rollup file
+ *
+ * @param dir   Month directory of the rollup file (NULL
+ *              to look it up by the path of the entry).
+ * @param entry Open minutes.
+ * @param count Number of the oldest minutes to close.
+ *
+ */
+static void close_minutes(logdir_t *dir, rollup_entry_t &entry,
+    unsigned int count)
+{
+	if (count == 0)
+		return;
+	
+	if (dir == NULL)
+		dir = logdir_lookup(entry.dir);
+	
+	int fd = (dir != NULL) ? logdir_open(dir, entry.name, O_APPEND) : -1;
+	if (fd >= 0) {
+		write_long(fd, entry.minutes, count * sizeof(rollup_record_t));
+		close(fd);
+	}
+	
+	memmove(entry.minutes, entry.minutes + count,
+	    (entry.count - count) * sizeof(rollup_record_t));
+	entry.count -= count;
+}
+
+/** Account log entry
+ *
+ * The entry is accounted to its minute if the minute
+ * is still open. Entries older than all open minutes
+ * are accounted to the oldest open minute.
+ *
+ * @param domain Domain of the log entry (located).
+ * @param line   Log entry as stored.
+ * @param fields Parsed log entry.
+ * @param time   Log entry date & time.
+ *
+ */
+void rollup_entry(domain_t *domain, const char *line,
+    const log_fields_t &fields, const datetime &time)
+{
+	if (!enabled)
+		return;
+	
+	int64_t minute = datetime_epoch(time);
+	minute -= ((minute % 60) + 60) % 60;
+	
+	rollup_entry_t &entry = entries[domain->log_path];
+	if (entry.name.empty()) {
+		entry.dir = domain->dir->relative;
+		entry.name = domain->name + ROLLUP_SUFFIX;
+	}
+	
+	/* Find the minute of the entry */
+	unsigned int slot = entry.count;
+	while ((slot > 0) && (entry.minutes[slot - 1].time > minute))
+		slot--;
+	
+	if ((slot > 0) && (entry.minutes[slot - 1].time == minute)) {
+		/* Open minute */
+		slot--;
+	} else if ((slot == 0) && (entry.count > 0)) {
+		/* Older than all open minutes */
+	} else {
+		/* New minute (the oldest open minute might be closed) */
+		if (entry.count == ROLLUP_WINDOW) {
+			close_minutes(domain->dir, entry, 1);
+			slot--;
+		}
+		
+		memmove(entry.minutes + slot + 1, entry.minutes + slot,
+		    (entry.count - slot) * sizeof(rollup_record_t));
+		memset(&entry.minutes[slot], 0, sizeof(rollup_record_t));
+		entry.minutes[slot].time = minute;
+		entry.count++;
+	}
+	
+	rollup_record_t &record = entry.minutes[slot];
+	record.requests++;
+	
+	const field_span_t &bytes = fields.field[FIELD_BYTES];
+	uint64_t size;
+	if ((bytes.start != FIELD_ABSENT) &&
+	    (span_decode(line + bytes.start, bytes.length, size)))
+		record.bytes += size;
+	
+	const field_span_t &status = fields.field[FIELD_STATUS];
+	if ((status.start != FIELD_ABSENT) && (status.length == 3) &&
+	    (line[status.start] >= '2') && (line[status.start] <= '5'))
+		record.status[line[status.start] - '2']++;
+	
+	const field_span_t &duration = fields.field[FIELD_DURATION];
+	uint64_t latency;
+	if ((duration.start != FIELD_ABSENT) &&
+	    (span_decode(line + duration.start, duration.length, latency))) {
+		record.latency_sum += latency;
+		
+		if (latency > UINT32_MAX)
+			latency = UINT32_MAX;
+		
+		if (latency > record.latency_max)
+			record.latency_max = latency;
+	}
+}
+
+/** Close minutes
+ *
+ * @param limit Close the minutes older than this time
+ *              (Unix time).
+ *
+ */
+static void close_all(int64_t limit)
+{
+	rollup_map::iterator it = entries.begin();
+	while (it != entries.end()) {
+		rollup_entry_t &entry = it->second;
+		
+		unsigned int count = 0;
+		while ((count < entry.count) && (entry.minutes[count].time < limit))
+			count++;
+		
+		close_minutes(NULL, entry, count);
+		
+		if (entry.count == 0)
+			it = entries.erase(it);
+		else
+			++it;
+	}
+}
+
+/** Close minutes by the wall clock
+ *
+ * The minutes which ended more than the window
+ * ago are closed even if no further entries of
+ * the domain arrive.
+ *
+ */
+void rollup_tick(void)
+{
+	if (!enabled)
+		return;
+	
+	uint64_t now = monotonic_ms();
+	if (now - last_check < ROLLUP_INTERVAL)
+		return;
+	
+	close_all(time(NULL) - ROLLUP_WINDOW * 60);
+	last_check = now;
+}
+
+/** Close all minutes */
+void rollup_done(void)
+{
+	if (!enabled)
+		return;
+	
+	close_all(INT64_MAX);
+}
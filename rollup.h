@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ROLLUP_H_
+#define ROLLUP_H_
+
+#include <stdint.h>
+#include <string>
+#include "domains.h"
+#include "logformat.h"
+#include "util.h"
+
+/** Suffix of the rollup file (appended to the domain log path) */
+#define ROLLUP_SUFFIX  ".rollup"
+
+/** Per-minute rollup record
+ *
+ * The records are appended in the host byte order as the
+ * minutes close. A minute might be split into more records
+ * (e.g. across restarts), the records with the same time
+ * are to be summed (and the maximum taken for the latency).
+ *
+ */
+typedef struct {
+	/* Start of the minute (Unix time) */
+	int64_t time;
+	
+	uint64_t bytes;
+	
+	/* Request duration sum (microseconds, only with %D) */
+	uint64_t latency_sum;
+	
+	uint32_t requests;
+	
+	/* Requests with status 2xx, 3xx, 4xx, 5xx */
+	uint32_t status[4];
+	
+	/* Maximal request duration (microseconds, only with %D) */
+	uint32_t latency_max;
+} rollup_record_t;
+
+extern void rollup_init(logformat_t &);
+extern void rollup_entry(domain_t *, const char *,
+    const log_fields_t &, const datetime &);
+extern void rollup_tick(void);
+extern void rollup_done(void);
+
+#endif
@@ -0,0 +1,372 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "stats.h"
+#include "timer.h"
+
+using namespace std;
+
+/** Publishing interval of the top domains (ms) */
+#define STATS_INTERVAL  1000
+
+typedef struct {
+	uint64_t lines;
+	uint64_t bytes;
+} traffic_t; /**< Domain traffic counters */
+
+/** Domain traffic table */
+typedef unordered_map< string, traffic_t> traffic_map;
+
+/** Statistics segment (NULL if not available) */
+static stats_segment_t *segment = NULL;
+
+/** Statistics segment name */
+static string segment_name;
+
+/** Domain traffic in the current interval */
+static traffic_map traffic;
+
+/** Start of the current interval (ms) */
+static uint64_t interval_start;
+
+/** Start modifying the segment */
+static inline void write_begin(void)
+{
+	__atomic_store_n(&segment->seq.value, segment->seq.value + 1,
+	    __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/** Finish modifying the segment */
+static inline void write_end(void)
+{
+	__atomic_store_n(&segment->seq.value, segment->seq.value + 1,
+	    __ATOMIC_RELEASE);
+}
+
+/** Store value to the segment
+ *
+ * @param field Field to store to.
+ * @param value Value to store.
+ *
+ */
+static inline void store(uint64_t &field, uint64_t value)
+{
+	__atomic_store_n(&field, value, __ATOMIC_RELAXED);
+}
+
+/** Store counter value
+ *
+ * @param counter Counter to store to.
+ * @param value   Value to store.
+ *
+ */
+static inline void store(stats_counter_t &counter, uint64_t value)
+{
+	store(counter.value, value);
+}
+
+/** Increment counter
+ *
+ * @param counter Counter to increment.
+ *
+ */
+static inline void increment(stats_counter_t &counter)
+{
+	store(counter, counter.value + 1);
+}
+
+/** Compare domains by traffic (descending)
+ *
+ * @param a First domain.
+ * @param b Second domain.
+ *
+ * @return True if the first domain had more traffic.
+ *
+ */
+static bool traffic_greater(const traffic_map::const_iterator &a,
+    const traffic_map::const_iterator &b)
+{
+	return a->second.lines > b->second.lines;
+}
+
+/** Create the statistics segment
+ *
+ * The segment is created as /dev/shm/accesslog.<pid>.
+ * The failure to create the segment is not fatal,
+ * the statistics are just not collected.
+ *
+ * @return True if the segment has been created.
+ *
+ */
+bool stats_init(void)
+{
+	pid_t pid = getpid();
+	segment_name = STATS_NAME + to_string(pid);
+	
+	int fd = shm_open(segment_name.c_str(), O_RDWR | O_CREAT | O_TRUNC,
+	    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		return false;
+	
+	if (ftruncate(fd, sizeof(stats_segment_t)) != 0) {
+		close(fd);
+		shm_unlink(segment_name.c_str());
+		return false;
+	}
+	
+	void *addr = mmap(NULL, sizeof(stats_segment_t),
+	    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	
+	if (addr == MAP_FAILED) {
+		shm_unlink(segment_name.c_str());
+		return false;
+	}
+	
+	segment = (stats_segment_t *) addr;
+	memset(segment, 0, sizeof(stats_segment_t));
+	
+	segment->version = STATS_VERSION;
+	segment->size = sizeof(stats_segment_t);
+	segment->pid = pid;
+	segment->started = time(NULL);
+	
+	/* Publish the magic number last */
+	__atomic_store_n(&segment->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+	
+	interval_start = monotonic_ms();
+	return true;
+}
+
+/** Remove the statistics segment */
+void stats_done(void)
+{
+	if (segment == NULL)
+		return;
+	
+	munmap(segment, sizeof(stats_segment_t));
+	shm_unlink(segment_name.c_str());
+	segment = NULL;
+}
+
+/** Account an input line */
+void stats_line(void)
+{
+	if (segment == NULL)
+		return;
+	
+	write_begin();
+	increment(segment->lines);
+	write_end();
+}
+
+/** Account a line routed to a domain log
+ *
+ * @param domain Domain name.
+ * @param bytes  Number of bytes written.
+ *
+ */
+void stats_routed(const string &domain, size_t bytes)
+{
+	if (segment == NULL)
+		return;
+	
+	traffic_t &entry = traffic[domain];
+	entry.lines++;
+	entry.bytes += bytes;
+	
+	write_begin();
+	increment(segment->routed);
+	write_end();
+}
+
+/** Account a line dropped by the filter rules
+ *
+ */
+void stats_dropped(void)
+{
+	if (segment == NULL)
+		return;
+	
+	write_begin();
+	increment(segment->dropped);
+	write_end();
+}
+
+/** Account a line diverted by the filter rules
+ *
+ */
+void stats_diverted(void)
+{
+	if (segment == NULL)
+		return;
+	
+	write_begin();
+	increment(segment->diverted);
+	write_end();
+}
+
+/** Account a line stored to a bots log
+ *
+ */
+void stats_bots(void)
+{
+	if (segment == NULL)
+		return;
+	
+	write_begin();
+	increment(segment->bots);
+	write_end();
+}
+
+/** Account a line dropped over the domain quota
+ *
+ */
+void stats_throttled(void)
+{
+	if (segment == NULL)
+		return;
+	
+	write_begin();
+	increment(segment->throttled);
+	write_end();
+}
+
+/** Account a log entry not written to an export
+ *
+ */
+void stats_failed(void)
+{
+	if (segment == NULL)
+		return;
+	
+	write_begin();
+	increment(segment->failed);
+	write_end();
+}
+
+/** Account a rejected line
+ *
+ * @param error Error class.
+ *
+ */
+void stats_error(error_class_t error)
+{
+	if (segment == NULL)
+		return;
+	
+	write_begin();
+	increment(segment->errors);
+	increment(segment->error_classes[error]);
+	write_end();
+}
+
+/** Account datagrams dropped by the kernel
+ *
+ * @param count Number of the datagrams dropped.
+ *
+ */
+void stats_drops(uint64_t count)
+{
+	if (segment == NULL)
+		return;
+	
+	write_begin();
+	store(segment->drops, segment->drops.value + count);
+	write_end();
+}
+
+/** Publish the top domains of the last interval
+ *
+ * Does nothing until the publishing interval
+ * elapses, thus it is cheap to call per line.
+ *
+ */
+void stats_tick(void)
+{
+	if (segment == NULL)
+		return;
+	
+	uint64_t now = monotonic_ms();
+	uint64_t elapsed = now - interval_start;
+	if (elapsed < STATS_INTERVAL)
+		return;
+	
+	/* Select the busiest domains */
+	vector< traffic_map::const_iterator> top;
+	top.reserve(traffic.size());
+	
+	for (traffic_map::const_iterator it = traffic.begin();
+	    it != traffic.end(); ++it)
+		top.push_back(it);
+	
+	size_t count = min(top.size(), (size_t) STATS_TOP_DOMAINS);
+	partial_sort(top.begin(), top.begin() + count, top.end(),
+	    traffic_greater);
+	
+	/* Bytes pending in the input pipe */
+	int backlog;
+	if (ioctl(STDIN_FILENO, FIONREAD, &backlog) != 0)
+		backlog = 0;
+	
+	write_begin();
+	
+	for (size_t i = 0; i < count; i++) {
+		stats_domain_t &dst = segment->top[i];
+		const string &domain = top[i]->first;
+		size_t length = min(domain.length(),
+		    (size_t) STATS_DOMAIN_LENGTH - 1);
+		
+		memcpy(dst.domain, domain.c_str(), length);
+		memset(dst.domain + length, 0, STATS_DOMAIN_LENGTH - length);
+		store(dst.lines, top[i]->second.lines);
+		store(dst.bytes, top[i]->second.bytes);
+	}
+	
+	store(segment->top_count, count);
+	store(segment->interval, elapsed);
+	store(segment->updated, time(NULL));
+	store(segment->backlog, backlog);
+	
+	write_end();
+	
+	traffic.clear();
+	interval_start = now;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+#include <string>
+#include "errors.h"
+
+/** Shared memory segment name prefix (followed by the PID) */
+#define STATS_NAME  "/accesslog."
+
+/** Shared memory segment magic number */
+#define STATS_MAGIC  UINT32_C(0x616c6f67)
+
+/** Shared memory segment layout version */
+#define STATS_VERSION  8
+
+/** Cache line size */
+#define STATS_CACHE_LINE  64
+
+/** Number of busiest domains published */
+#define STATS_TOP_DOMAINS  16
+
+/** Maximal length of a published domain name (including NUL) */
+#define STATS_DOMAIN_LENGTH  112
+
+/** Cache-line-aligned counter */
+typedef struct {
+	uint64_t value;
+} __attribute__((aligned(STATS_CACHE_LINE))) stats_counter_t;
+
+typedef struct {
+	char domain[STATS_DOMAIN_LENGTH];
+	uint64_t lines;
+	uint64_t bytes;
+} stats_domain_t; /**< Domain with its traffic in the last interval */
+
+/** Statistics shared memory segment
+ *
+ * The segment is written by a single accesslog process and
+ * read by any number of readers without any synchronization
+ * with the writer. All fields past the header are protected
+ * by the sequence lock: The writer makes the sequence number
+ * odd before it starts modifying the fields and even again
+ * after it is done. A reader copies the fields and retries
+ * if the sequence number was odd or has changed meanwhile.
+ *
+ */
+typedef struct {
+	/* Header (immutable after creation) */
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t pid;
+	uint64_t started;
+	
+	/* Sequence lock */
+	stats_counter_t seq;
+	
+	/* Input lines read */
+	stats_counter_t lines;
+	
+	/* Input lines routed to a domain log */
+	stats_counter_t routed;
+	
+	/* Input lines dropped and diverted by the filter rules */
+	stats_counter_t dropped;
+	stats_counter_t diverted;
+	
+	/* Input lines stored to the bots logs */
+	stats_counter_t bots;
+	
+	/* Input lines dropped over the domain quotas */
+	stats_counter_t throttled;
+	
+	/* Log entries not written to the exports (write errors) */
+	stats_counter_t failed;
+	
+	/* Input lines rejected */
+	stats_counter_t errors;
+	stats_counter_t error_classes[ERROR_CLASSES];
+	
+	/* Datagrams dropped by the kernel (full receive buffer) */
+	stats_counter_t drops;
+	
+	/* Bytes pending in the input pipe (sampled every interval) */
+	stats_counter_t backlog;
+	
+	/* Top domains in the last interval */
+	stats_counter_t updated;
+	stats_counter_t interval;
+	stats_counter_t top_count;
+	stats_domain_t top[STATS_TOP_DOMAINS];
+} __attribute__((aligned(STATS_CACHE_LINE))) stats_segment_t;
+
+extern bool stats_init(void);
+extern void stats_done(void);
+extern void stats_line(void);
+extern void stats_routed(const std::string &, size_t);
+extern void stats_dropped(void);
+extern void stats_diverted(void);
+extern void stats_bots(void);
+extern void stats_throttled(void);
+extern void stats_failed(void);
+extern void stats_error(error_class_t);
+extern void stats_drops(uint64_t);
+extern void stats_tick(void);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <vector>
+#include "strindex.h"
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+/** Characters of the structural classes (except escapes) */
+static const char class_chars[STRINDEX_ESCAPED] = {
+	'\n', ' ', '"', '[', ']'
+};
+
+/** Structural class of a character
+ *
+ * @param chr Character.
+ *
+ * @return Structural class of the character.
+ * @return -1 if the character is not structural.
+ *
+ */
+int strindex_class(const char chr)
+{
+	for (int i = 0; i < STRINDEX_ESCAPED; i++) {
+		if (class_chars[i] == chr)
+			return i;
+	}
+	
+	return -1;
+}
+
+#ifdef __SSE2__
+
+/** Bitmask of a character in a chunk
+ *
+ * @param vec Chunk loaded into four vectors.
+ * @param chr Character to match.
+ *
+ * @return Bitmask of the character positions.
+ *
+ */
+static inline uint64_t chunk_mask(const __m128i vec[4], const char chr)
+{
+	const __m128i needle = _mm_set1_epi8(chr);
+	
+	uint64_t m0 = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(vec[0], needle));
+	uint64_t m1 = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(vec[1], needle));
+	uint64_t m2 = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(vec[2], needle));
+	uint64_t m3 = (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(vec[3], needle));
+	
+	return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+}
+
+/** Classify 64 bytes
+ *
+ * @param data      Chunk data (64 bytes).
+ * @param chunk     Bitmasks of the chunk.
+ * @param backslash Bitmask of the backslashes.
+ *
+ */
+static inline void classify(const char *data, strindex_chunk_t &chunk,
+    uint64_t &backslash)
+{
+	__m128i vec[4];
+	
+	vec[0] = _mm_loadu_si128((const __m128i *) data);
+	vec[1] = _mm_loadu_si128((const __m128i *) (data + 16));
+	vec[2] = _mm_loadu_si128((const __m128i *) (data + 32));
+	vec[3] = _mm_loadu_si128((const __m128i *) (data + 48));
+	
+	for (int i = 0; i < STRINDEX_ESCAPED; i++)
+		chunk.mask[i] = chunk_mask(vec, class_chars[i]);
+	
+	backslash = chunk_mask(vec, '\\');
+}
+
+#else
+
+/** Classify 64 bytes
+ *
+ * @param data      Chunk data (64 bytes).
+ * @param chunk     Bitmasks of the chunk.
+ * @param backslash Bitmask of the backslashes.
+ *
+ */
+static inline void classify(const char *data, strindex_chunk_t &chunk,
+    uint64_t &backslash)
+{
+	for (int i = 0; i < STRINDEX_ESCAPED; i++)
+		chunk.mask[i] = 0;
+	
+	backslash = 0;
+	
+	for (unsigned int pos = 0; pos < STRINDEX_CHUNK; pos++) {
+		uint64_t bit = UINT64_C(1) << pos;
+		
+		if (data[pos] == '\\') {
+			backslash |= bit;
+			continue;
+		}
+		
+		int cls = strindex_class(data[pos]);
+		if (cls >= 0)
+			chunk.mask[cls] |= bit;
+	}
+}
+
+#endif
+
+/** Find characters escaped by a backslash
+ *
+ * A character is escaped if it is preceded by an odd-length
+ * sequence of backslashes. The odd-length sequences are told
+ * apart from the even-length ones by adding the starts of the
+ * sequences on odd positions, which carries over the sequences
+ * and flips the parity of their ends (see simdjson).
+ *
+ * @param backslash    Bitmask of the backslashes.
+ * @param prev_escaped Whether the first character of the chunk
+ *                     is escaped (updated for the next chunk).
+ *
+ * @return Bitmask of the escaped characters.
+ *
+ */
+static inline uint64_t find_escaped(uint64_t backslash,
+    uint64_t &prev_escaped)
+{
+	const uint64_t even_bits = UINT64_C(0x5555555555555555);
+	
+	backslash &= ~prev_escaped;
+	uint64_t follows_escape = (backslash << 1) | prev_escaped;
+	uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+	
+	uint64_t even_starts;
+	prev_escaped = __builtin_add_overflow(odd_starts, backslash,
+	    &even_starts) ? 1 : 0;
+	
+	return (even_bits ^ (even_starts << 1)) & follows_escape;
+}
+
+/** Build structural index of a block
+ *
+ * @param index  Structural index.
+ * @param data   Block data.
+ * @param length Length of the block.
+ *
+ */
+void strindex_build(strindex_t &index, const char *data, size_t length)
+{
+	size_t chunks = (length + STRINDEX_CHUNK - 1) / STRINDEX_CHUNK;
+	if (index.chunks.size() < chunks)
+		index.chunks.resize(chunks);
+	
+	index.length = length;
+	
+	uint64_t prev_escaped = 0;
+	
+	for (size_t i = 0; i < chunks; i++) {
+		const char *chunk_data = data + i * STRINDEX_CHUNK;
+		char tail[STRINDEX_CHUNK];
+		
+		/* Pad the last partial chunk */
+		size_t rest = length - i * STRINDEX_CHUNK;
+		if (rest < STRINDEX_CHUNK) {
+			memcpy(tail, chunk_data, rest);
+			memset(tail + rest, 0, STRINDEX_CHUNK - rest);
+			chunk_data = tail;
+		}
+		
+		strindex_chunk_t &chunk = index.chunks[i];
+		uint64_t backslash;
+		
+		classify(chunk_data, chunk, backslash);
+		
+		uint64_t escaped = find_escaped(backslash, prev_escaped);
+		chunk.mask[STRINDEX_ESCAPED] = escaped;
+		chunk.mask[STRINDEX_QUOTE] &= ~escaped;
+	}
+}
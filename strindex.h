@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STRINDEX_H_
+#define STRINDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/** Number of bytes covered by a single index chunk */
+#define STRINDEX_CHUNK  64
+
+typedef enum {
+	STRINDEX_NEWLINE,   /**< '\n' */
+	STRINDEX_SPACE,     /**< ' ' */
+	STRINDEX_QUOTE,     /**< '"' (not escaped) */
+	STRINDEX_OPEN,      /**< '[' */
+	STRINDEX_CLOSE,     /**< ']' */
+	STRINDEX_ESCAPED,   /**< Characters escaped by a backslash */
+	STRINDEX_CLASSES
+} strindex_class_t; /**< Structural character classes */
+
+typedef struct {
+	uint64_t mask[STRINDEX_CLASSES];
+} strindex_chunk_t; /**< Bitmasks of 64 consecutive bytes */
+
+typedef struct {
+	std::vector< strindex_chunk_t> chunks;
+	size_t length;
+} strindex_t; /**< Structural index of a block */
+
+extern void strindex_build(strindex_t &, const char *, size_t);
+extern int strindex_class(const char);
+
+/** Find next character of the given class
+ *
+ * @param index     Structural index.
+ * @param cls       Character class.
+ * @param pos       Position to start searching from.
+ * @param limit     Position to stop searching at.
+ * @param unescaped Skip characters escaped by a backslash.
+ *
+ * @return Position of the next character of the class.
+ * @return Limit if there is no such character before the limit.
+ *
+ */
+static inline size_t strindex_next(const strindex_t &index,
+    strindex_class_t cls, size_t pos, size_t limit, bool unescaped)
+{
+	if (pos >= limit)
+		return limit;
+	
+	size_t chunk = pos / STRINDEX_CHUNK;
+	uint64_t mask = index.chunks[chunk].mask[cls] &
+	    (~UINT64_C(0) << (pos % STRINDEX_CHUNK));
+	
+	while (true) {
+		if (unescaped)
+			mask &= ~index.chunks[chunk].mask[STRINDEX_ESCAPED];
+		
+		if (mask != 0) {
+			size_t found = chunk * STRINDEX_CHUNK + __builtin_ctzll(mask);
+			return (found < limit) ? found : limit;
+		}
+		
+		chunk++;
+		if (chunk * STRINDEX_CHUNK >= limit)
+			return limit;
+		
+		mask = index.chunks[chunk].mask[cls];
+	}
+}
+
+#endif
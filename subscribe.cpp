@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "subscribe.h"
+
+using namespace std;
+
+/** Ring buffer size of each subscriber (power of 2) */
+#define RING_SIZE  (1 << 20)
+
+/** Pending data to try sending right away */
+#define RING_FLUSH  (1 << 16)
+
+/** Maximal length of the subscription request */
+#define REQUEST_LENGTH  256
+
+typedef struct {
+	int fd;
+	
+	/* Subscription request (domain glob) */
+	string request;
+	bool subscribed;
+	bool glob;
+	
+	/* Ring buffer of the pending lines */
+	vector< char> ring;
+	uint64_t head;
+	uint64_t tail;
+} subscriber_t; /**< Subscriber of the live log entries */
+
+/** Listening socket (-1 if none) */
+static int listen_fd = -1;
+
+/** Listening socket path */
+static string socket_path;
+
+/** Subscribers */
+static vector< subscriber_t *> subscribers;
+
+/** Initialize the subscription socket
+ *
+ * @param path Unix socket path.
+ *
+ * @return True on success.
+ *
+ */
+bool subscribe_init(const char *path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	
+	strcpy(addr.sun_path, path);
+	
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+	    0);
+	if (listen_fd < 0)
+		return false;
+	
+	/* Remove the stale socket of a previous instance */
+	unlink(path);
+	
+	if ((bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) ||
+	    (listen(listen_fd, SUBSCRIBE_MAX) != 0)) {
+		close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+	
+	socket_path = path;
+	return true;
+}
+
+/** Disconnect subscriber
+ *
+ * @param index Subscriber index.
+ *
+ */
+static void disconnect(size_t index)
+{
+	close(subscribers[index]->fd);
+	delete subscribers[index];
+	
+	subscribers.erase(subscribers.begin() + index);
+}
+
+/** Send pending data to a subscriber
+ *
+ * @param subscriber Subscriber.
+ *
+ * @return False if the subscriber has disconnected.
+ *
+ */
+static bool flush(subscriber_t &subscriber)
+{
+	while (subscriber.head != subscriber.tail) {
+		size_t start = subscriber.head & (RING_SIZE - 1);
+		size_t pending = subscriber.tail - subscriber.head;
+		
+		struct iovec iov[2];
+		iov[0].iov_base = &subscriber.ring[start];
+		iov[0].iov_len = min(pending, (size_t) RING_SIZE - start);
+		iov[1].iov_base = &subscriber.ring[0];
+		iov[1].iov_len = pending - iov[0].iov_len;
+		
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = (iov[1].iov_len > 0) ? 2 : 1;
+		
+		ssize_t sent = sendmsg(subscriber.fd, &msg,
+		    MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			
+			return ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+		}
+		
+		subscriber.head += sent;
+	}
+	
+	return true;
+}
+
+/** Read subscription request
+ *
+ * The request is a single line with the domain
+ * name or a glob matching the domain names.
+ *
+ * @param subscriber Subscriber.
+ *
+ * @return False if the subscriber has disconnected
+ *         or sent an invalid request.
+ *
+ */
+static bool receive(subscriber_t &subscriber)
+{
+	char buf[REQUEST_LENGTH];
+	
+	ssize_t count = recv(subscriber.fd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (count < 0)
+		return ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+		    (errno == EINTR));
+	
+	/* Disconnected */
+	if (count == 0)
+		return false;
+	
+	/* Anything sent after the request is ignored */
+	if (subscriber.subscribed)
+		return true;
+	
+	subscriber.request.append(buf, count);
+	
+	size_t end = subscriber.request.find('\n');
+	if (end == string::npos)
+		return (subscriber.request.length() < REQUEST_LENGTH);
+	
+	subscriber.request.resize(end);
+	if ((end > 0) && (subscriber.request[end - 1] == '\r'))
+		subscriber.request.resize(end - 1);
+	
+	if (subscriber.request.empty())
+		return false;
+	
+	subscriber.glob =
+	    (subscriber.request.find_first_of("*?[") != string::npos);
+	subscriber.ring.resize(RING_SIZE);
+	subscriber.subscribed = true;
+	
+	return true;
+}
+
+/** Accept new subscribers
+ *
+ */
+static void accept_subscribers(void)
+{
+	while (true) {
+		int fd = accept4(listen_fd, NULL, NULL,
+		    SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			break;
+		
+		if (subscribers.size() >= SUBSCRIBE_MAX) {
+			close(fd);
+			continue;
+		}
+		
+		subscriber_t *subscriber = new subscriber_t;
+		subscriber->fd = fd;
+		subscriber->subscribed = false;
+		subscriber->glob = false;
+		subscriber->head = 0;
+		subscriber->tail = 0;
+		
+		subscribers.push_back(subscriber);
+	}
+}
+
+/** Get the file descriptors to poll
+ *
+ * @param fds Poll structures to fill (at least
+ *            SUBSCRIBE_MAX + 1 entries).
+ *
+ * @return Number of poll structures filled.
+ *
+ */
+size_t subscribe_pollfds(struct pollfd *fds)
+{
+	if (listen_fd < 0)
+		return 0;
+	
+	fds[0].fd = listen_fd;
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+	
+	for (size_t i = 0; i < subscribers.size(); i++) {
+		subscriber_t &subscriber = *subscribers[i];
+		
+		fds[i + 1].fd = subscriber.fd;
+		fds[i + 1].events = POLLIN;
+		fds[i + 1].revents = 0;
+		
+		if (subscriber.head != subscriber.tail)
+			fds[i + 1].events |= POLLOUT;
+	}
+	
+	return subscribers.size() + 1;
+}
+
+/** Handle the polled events
+ *
+ * @param fds   Poll structures filled by subscribe_pollfds().
+ * @param count Number of the poll structures.
+ *
+ */
+void subscribe_events(const struct pollfd *fds, size_t count)
+{
+	if (count == 0)
+		return;
+	
+	/* Iterate backwards as the disconnected subscribers are removed */
+	for (size_t i = count - 1; i > 0; i--) {
+		subscriber_t &subscriber = *subscribers[i - 1];
+		bool alive = true;
+		
+		if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+			alive = false;
+		
+		if ((alive) && (fds[i].revents & POLLIN))
+			alive = receive(subscriber);
+		
+		if ((alive) && (fds[i].revents & POLLOUT))
+			alive = flush(subscriber);
+		
+		if (!alive)
+			disconnect(i - 1);
+	}
+	
+	if (fds[0].revents & POLLIN)
+		accept_subscribers();
+}
+
+/** Pass log entry to the subscribers of its domain
+ *
+ * The entry is only queued in the ring buffers of
+ * the subscribers. A subscriber whose ring buffer
+ * is full is disconnected.
+ *
+ * @param domain Domain name.
+ * @param access Log entry as stored.
+ *
+ */
+void subscribe_entry(const string &domain, const string &access)
+{
+	for (size_t i = subscribers.size(); i > 0; i--) {
+		subscriber_t &subscriber = *subscribers[i - 1];
+		
+		if (!subscriber.subscribed)
+			continue;
+		
+		if (subscriber.glob) {
+			if (fnmatch(subscriber.request.c_str(), domain.c_str(),
+			    FNM_CASEFOLD) != 0)
+				continue;
+		} else if (strcasecmp(subscriber.request.c_str(),
+		    domain.c_str()) != 0)
+			continue;
+		
+		/* Domain, space, entry and newline */
+		size_t length = domain.length() + access.length() + 2;
+		
+		if (subscriber.tail - subscriber.head + length > RING_SIZE) {
+			cerr << "accesslog: subscriber of " << subscriber.request <<
+			    " too slow, disconnected" << endl;
+			disconnect(i - 1);
+			continue;
+		}
+		
+		const char *parts[] = { domain.c_str(), " ", access.c_str(), "\n" };
+		size_t lengths[] = { domain.length(), 1, access.length(), 1 };
+		
+		for (unsigned int part = 0; part < 4; part++) {
+			for (size_t pos = 0; pos < lengths[part]; ) {
+				size_t start = subscriber.tail & (RING_SIZE - 1);
+				size_t chunk = min(lengths[part] - pos,
+				    (size_t) RING_SIZE - start);
+				
+				memcpy(&subscriber.ring[start], parts[part] + pos, chunk);
+				subscriber.tail += chunk;
+				pos += chunk;
+			}
+		}
+		
+		if ((subscriber.tail - subscriber.head >= RING_FLUSH) &&
+		    (!flush(subscriber)))
+			disconnect(i - 1);
+	}
+}
+
+/** Finish the subscription socket
+ *
+ * Send the pending data (as far as possible without
+ * blocking) and disconnect the subscribers.
+ *
+ */
+void subscribe_done(void)
+{
+	if (listen_fd < 0)
+		return;
+	
+	while (!subscribers.empty()) {
+		flush(*subscribers.back());
+		disconnect(subscribers.size() - 1);
+	}
+	
+	close(listen_fd);
+	listen_fd = -1;
+	
+	unlink(socket_path.c_str());
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include "syslogmsg.h"
+
+/** Number of the RFC 5424 header fields before the structured data */
+#define HEADER_FIELDS  5
+
+/** Maximal length of the priority */
+#define PRIORITY_LENGTH  3
+
+/** Maximal length of the RFC 5424 version */
+#define VERSION_LENGTH  2
+
+/** Length of the RFC 3164 timestamp ("Mmm dd hh:mm:ss") */
+#define TIMESTAMP_LENGTH  15
+
+/** Check for decimal digit */
+static inline bool is_digit(char chr)
+{
+	return ((chr >= '0') && (chr <= '9'));
+}
+
+/** Skip token and the space following it
+ *
+ * @param pos Position.
+ * @param end End of the message.
+ *
+ * @return Position after the token and the space.
+ *
+ */
+static const char *skip_token(const char *pos, const char *end)
+{
+	const char *space = (const char *) memchr(pos, ' ', end - pos);
+	return (space != NULL) ? space + 1 : end;
+}
+
+/** Skip RFC 5424 structured data
+ *
+ * The structured data are either "-" or a sequence of
+ * elements in brackets. The parameter values are quoted
+ * and may contain escaped '"', '\' and ']'.
+ *
+ * @param pos Position.
+ * @param end End of the message.
+ *
+ * @return Position after the structured data.
+ *
+ */
+static const char *skip_structured(const char *pos, const char *end)
+{
+	if ((pos < end) && (*pos == '-'))
+		return pos + 1;
+	
+	while ((pos < end) && (*pos == '[')) {
+		bool quoted = false;
+		
+		for (pos++; pos < end; pos++) {
+			if ((quoted) && (*pos == '\\') && (pos + 1 < end))
+				pos++;
+			else if (*pos == '"')
+				quoted = !quoted;
+			else if ((!quoted) && (*pos == ']'))
+				break;
+		}
+		
+		if (pos < end)
+			pos++;
+	}
+	
+	return pos;
+}
+
+/** Skip RFC 3164 timestamp
+ *
+ * Besides the "Mmm dd hh:mm:ss" timestamp, some senders
+ * use an RFC 3339 timestamp instead.
+ *
+ * @param pos Position.
+ * @param end End of the message.
+ *
+ * @return Position after the timestamp and the space.
+ *
+ */
+static const char *skip_timestamp(const char *pos, const char *end)
+{
+	if ((end - pos > TIMESTAMP_LENGTH) && (pos[3] == ' ') &&
+	    (pos[6] == ' ') && (pos[9] == ':') && (pos[12] == ':') &&
+	    (pos[TIMESTAMP_LENGTH] == ' '))
+		return pos + TIMESTAMP_LENGTH + 1;
+	
+	if ((pos < end) && (is_digit(*pos)))
+		return skip_token(pos, end);
+	
+	return pos;
+}
+
+/** Check whether the token is a tag ("name:" or "name[pid]:")
+ *
+ * @param pos Position of the token.
+ * @param end End of the message.
+ *
+ * @return True if the token is terminated by a colon.
+ *
+ */
+static bool is_tag(const char *pos, const char *end)
+{
+	const char *next = skip_token(pos, end);
+	
+	/* No space following (message without payload) */
+	if ((next == end) && ((next == pos) || (end[-1] != ' ')))
+		return false;
+	
+	return ((next - pos >= 2) && (next[-2] == ':'));
+}
+
+/** Strip syslog header
+ *
+ * Recognizes the RFC 5424 header (including the
+ * structured data and the byte order mark of the
+ * message) and the RFC 3164 header (with or without
+ * the hostname before the tag). Messages without the
+ * priority (i.e. plain log entries) are left intact.
+ * The trailing newlines are stripped as well.
+ *
+ * @param data   Message (updated to the payload).
+ * @param length Length of the message (updated).
+ *
+ */
+void syslogmsg_strip(const char *&data, size_t &length)
+{
+	const char *end = data + length;
+	const char *pos = data;
+	
+	while ((end > pos) && ((end[-1] == '\n') || (end[-1] == '\r')))
+		end--;
+	
+	length = end - data;
+	
+	/* Priority */
+	if ((pos == end) || (*pos != '<'))
+		return;
+	
+	const char *priority = ++pos;
+	while ((pos < end) && (is_digit(*pos)) &&
+	    (pos - priority < PRIORITY_LENGTH))
+		pos++;
+	
+	if ((pos == priority) || (pos == end) || (*pos != '>'))
+		return;
+	
+	pos++;
+	
+	/* RFC 5424 version followed by a space */
+	const char *version = pos;
+	while ((pos < end) && (is_digit(*pos)) &&
+	    (pos - version <= VERSION_LENGTH))
+		pos++;
+	
+	if ((pos > version) && (pos - version <= VERSION_LENGTH) &&
+	    (pos < end) && (*pos == ' ')) {
+		pos++;
+		
+		/* Timestamp, hostname, application, process and message ID */
+		for (unsigned int i = 0; i < HEADER_FIELDS; i++)
+			pos = skip_token(pos, end);
+		
+		pos = skip_structured(pos, end);
+		
+		if ((pos < end) && (*pos == ' '))
+			pos++;
+		
+		if ((end - pos >= 3) && (memcmp(pos, "\xef\xbb\xbf", 3) == 0))
+			pos += 3;
+	} else {
+		pos = skip_timestamp(version, end);
+		
+		/* Tag, or hostname followed by the tag */
+		if (is_tag(pos, end))
+			pos = skip_token(pos, end);
+		else {
+			const char *next = skip_token(pos, end);
+			if ((next < end) && (is_tag(next, end)))
+				pos = skip_token(next, end);
+		}
+	}
+	
+	data = pos;
+	length = end - pos;
+}
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "topk.h"
+#include "hash.h"
+#include "timer.h"
+#include "util.h"
+
+using namespace std;
+
+/** Number of counters per table */
+#define TOPK_COUNTERS  32
+
+/** Maximal length of a counted key */
+#define TOPK_KEY_LENGTH  256
+
+/** Dump interval (ms) */
+#define TOPK_INTERVAL  60000
+
+typedef struct {
+	uint64_t hash;
+	uint64_t count;
+	uint64_t error;
+	string key;
+} topk_counter_t; /**< Space-Saving counter */
+
+/** Space-Saving table */
+typedef vector< topk_counter_t> topk_table_t;
+
+typedef enum {
+	TOPK_PATH,
+	TOPK_REFERER,
+	TOPK_USER_AGENT,
+	TOPK_TABLES
+} topk_kind_t; /**< Counted fields */
+
+/** Names of the counted fields */
+static const char *kind_names[TOPK_TABLES] = {
+	"path",
+	"referer",
+	"user-agent"
+};
+
+typedef struct {
+	topk_table_t tables[TOPK_TABLES];
+	bool dirty;
+} topk_entry_t; /**< Top lists of a domain log */
+
+/** Top lists indexed by the domain log path */
+typedef unordered_map< string, topk_entry_t> topk_map;
+
+/** Top lists enabled */
+static bool enabled = false;
+
+/** Top lists of the current interval */
+static topk_map entries;
+
+/** Start of the current interval (ms) */
+static uint64_t interval_start;
+
+/** Enable top lists
+ *
+ * @param format Compiled log format (the request, referer
+ *               and user agent fields are required if
+ *               present).
+ *
+ */
+void topk_init(logformat_t &format)
+{
+	logformat_require(format, FIELD_REQUEST);
+	logformat_require(format, FIELD_REFERER);
+	logformat_require(format, FIELD_USER_AGENT);
+	
+	enabled = true;
+	interval_start = monotonic_ms();
+}
+
+/** Count key occurence
+ *
+ * Space-Saving algorithm: If the key is not monitored and
+ * all counters are taken, the counter with the minimal
+ * count is taken over by the key. The minimal count is the
+ * maximal overestimation of the new key.
+ *
+ * @param table  Space-Saving table.
+ * @param key    Key.
+ * @param length Length of the key.
+ *
+ */
+static void count_key(topk_table_t &table, const char *key, size_t length)
+{
+	if (length > TOPK_KEY_LENGTH)
+		length = TOPK_KEY_LENGTH;
+	
+	uint64_t hash = hash_bytes(key, length);
+	size_t min = 0;
+	
+	for (size_t i = 0; i < table.size(); i++) {
+		topk_counter_t &counter = table[i];
+		
+		if ((counter.hash == hash) && (counter.key.length() == length) &&
+		    (memcmp(counter.key.c_str(), key, length) == 0)) {
+			counter.count++;
+			return;
+		}
+		
+		if (counter.count < table[min].count)
+			min = i;
+	}
+	
+	if (table.size() < TOPK_COUNTERS) {
+		topk_counter_t counter;
+		counter.hash = hash;
+		counter.count = 1;
+		counter.error = 0;
+		counter.key.assign(key, length);
+		
+		table.push_back(counter);
+		return;
+	}
+	
+	topk_counter_t &counter = table[min];
+	counter.hash = hash;
+	counter.error = counter.count;
+	counter.count++;
+	counter.key.assign(key, length);
+}
+
+/** Count field value
+ *
+ * Empty values and '-' are not counted.
+ *
+ * @param table  Space-Saving table.
+ * @param line   Log entry.
+ * @param span   Field position.
+ *
+ */
+static void count_field(topk_table_t &table, const char *line,
+    const field_span_t &span)
+{
+	if ((span.start == FIELD_ABSENT) || (span.length == 0))
+		return;
+	
+	const char *value = line + span.start;
+	if ((span.length == 1) && (value[0] == '-'))
+		return;
+	
+	count_key(table, value, span.length);
+}
+
+/** Count request path
+ *
+ * The path is the second word of the request line
+ * without the query string.
+ *
+ * @param table  Space-Saving table.
+ * @param line   Log entry.
+ * @param span   Request line position.
+ *
+ */
+static void count_path(topk_table_t &table, const char *line,
+    const field_span_t &span)
+{
+	if (span.start == FIELD_ABSENT)
+		return;
+	
+	const char *request = line + span.start;
+	const char *end = request + span.length;
+	
+	const char *path = (const char *) memchr(request, ' ', span.length);
+	if (path == NULL)
+		return;
+	
+	path++;
+	
+	const char *path_end = path;
+	while ((path_end < end) && (*path_end != ' ') && (*path_end != '?'))
+		path_end++;
+	
+	if (path_end > path)
+		count_key(table, path, path_end - path);
+}
+
+/** Count log entry
+ *
+ * @param log_path Domain log path.
+ * @param line     Log entry as stored.
+ * @param fields   Parsed log entry.
+ *
+ */
+void topk_entry(const string &log_path, const char *line,
+    const log_fields_t &fields)
+{
+	if (!enabled)
+		return;
+	
+	topk_entry_t &entry = entries[log_path];
+	
+	count_path(entry.tables[TOPK_PATH], line, fields.field[FIELD_REQUEST]);
+	count_field(entry.tables[TOPK_REFERER], line,
+	    fields.field[FIELD_REFERER]);
+	count_field(entry.tables[TOPK_USER_AGENT], line,
+	    fields.field[FIELD_USER_AGENT]);
+	
+	entry.dirty = true;
+}
+
+/** Compare counters by count (descending)
+ *
+ * @param a First counter.
+ * @param b Second counter.
+ *
+ * @return True if the first counter has a higher count.
+ *
+ */
+static bool counter_greater(const topk_counter_t &a, const topk_counter_t &b)
+{
+	return a.count > b.count;
+}
+
+/** Dump top lists of a domain log
+ *
+ * Each line of the file contains the count, the maximal
+ * overestimation of the count and the key.
+ *
+ * @param path     Top list file path.
+ * @param entry    Top lists.
+ * @param interval Length of the interval (ms).
+ *
+ */
+static void dump(const string &path, topk_entry_t &entry, uint64_t interval)
+{
+	ostringstream stream;
+	
+	stream << "# time " << time(NULL) << " interval " <<
+	    interval / 1000 << endl;
+	
+	for (unsigned int i = 0; i < TOPK_TABLES; i++) {
+		topk_table_t &table = entry.tables[i];
+		sort(table.begin(), table.end(), counter_greater);
+		
+		stream << "# " << kind_names[i] << endl;
+		
+		for (size_t j = 0; j < table.size(); j++)
+			stream << table[j].count << " " << table[j].error << " " <<
+			    table[j].key << endl;
+	}
+	
+	string data = stream.str();
+	write_file(path.c_str(), data.c_str(), data.length());
+}
+
+/** Dump and reset top lists of the interval
+ *
+ * @param now Current time (ms).
+ *
+ */
+static void dump_all(uint64_t now)
+{
+	for (topk_map::iterator it = entries.begin(); it != entries.end(); ++it) {
+		if (it->second.dirty)
+			dump(it->first + TOPK_SUFFIX, it->second, now - interval_start);
+	}
+	
+	entries.clear();
+	interval_start = now;
+}
+
+/** Dump top lists periodically
+ *
+ * Does nothing until the dump interval
+ * elapses, thus it is cheap to call often.
+ *
+ */
+void topk_tick(void)
+{
+	if (!enabled)
+		return;
+	
+	uint64_t now = monotonic_ms();
+	if (now - interval_start < TOPK_INTERVAL)
+		return;
+	
+	dump_all(now);
+}
+
+/** Dump top lists of the last interval */
+void topk_done(void)
+{
+	if (!enabled)
+		return;
+	
+	dump_all(monotonic_ms());
+}
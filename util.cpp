@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2017 Martin Decky
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * - Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ * - The name of the author may not be used to endorse or promote products
+ *   derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/un.h>
+#include <string.h>
+#include <string>
+#include "util.h"
+
+using namespace std;
+
+/** Convert date & time to Unix time
+ *
+ * @param time Date & time (with the offset from UTC
+ *             in the +HHMM format).
+ *
+ * @return Seconds since the epoch (UTC).
+ *
+ */
+int64_t datetime_epoch(const datetime &time)
+{
+	/* Days since the epoch of the civil date (proleptic Gregorian) */
+	int64_t year = time.year - ((time.month <= 2) ? 1 : 0);
+	int64_t era = ((year >= 0) ? year : year - 399) / 400;
+	int64_t year_of_era = year - era * 400;
+	int64_t day_of_year = (153 * (time.month + ((time.month > 2) ? -3 : 9)) +
+	    2) / 5 + time.day - 1;
+	int64_t day_of_era = year_of_era * 365 + year_of_era / 4 -
+	    year_of_era / 100 + day_of_year;
+	int64_t days = era * 146097 + day_of_era - 719468;
+	
+	int64_t offset = (time.offset / 100) * 3600 + (time.offset % 100) * 60;
+	
+	return days * 86400 + time.hour * 3600 + time.minute * 60 +
+	    time.second - offset;
+}
+
+/** Convert Unix time to date & time
+ *
+ * Inverse of datetime_epoch().
+ *
+ * @param epoch  Unix time.
+ * @param offset Time zone offset (e.g. +0200 as 200).
+ * @param time   Date & time in the time zone.
+ *
+ */
+void datetime_civil(int64_t epoch, long int offset, datetime &time)
+{
+	int64_t local = epoch + (offset / 100) * 3600 + (offset % 100) * 60;
+	int64_t days = ((local >= 0) ? local : local - 86399) / 86400;
+	int64_t seconds = local - days * 86400;
+	
+	/* Civil date of the days since the epoch (proleptic Gregorian) */
+	days += 719468;
+	int64_t era = ((days >= 0) ? days : days - 146096) / 146097;
+	int64_t day_of_era = days - era * 146097;
+	int64_t year_of_era = (day_of_era - day_of_era / 1460 +
+	    day_of_era / 36524 - day_of_era / 146096) / 365;
+	int64_t day_of_year = day_of_era - (365 * year_of_era +
+	    year_of_era / 4 - year_of_era / 100);
+	int64_t month_index = (5 * day_of_year + 2) / 153;
+	
+	time.day = day_of_year - (153 * month_index + 2) / 5 + 1;
+	time.month = month_index + ((month_index < 10) ? 3 : -9);
+	time.year = year_of_era + era * 400 + ((time.month <= 2) ? 1 : 0);
+	
+	time.hour = seconds / 3600;
+	time.minute = (seconds / 60) % 60;
+	time.second = seconds % 60;
+	time.offset = offset;
+}
+
+/** Long write (wrapper for write(2))
+ *
+ * @param fd    File descriptor.
+ * @param buf   Data to write.
+ * @param count Number of bytes to write.
+ *
+ * @return True if all the data have been written.
+ *
+ */
+bool write_long(int fd, const void *buf, size_t count)
+{
+	size_t total = count;
+	
+	while (total > 0) {
+		ssize_t written = write(fd, buf, total);
+		
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			
+			return false;
+		}
+		
+		total -= written;
+		buf = (void *) (((char *) buf) + written);
+	}
+	
+	return true;
+}
+
+/** Replace file contents atomically
+ *
+ * The data are written to a temporary file
+ * which is then renamed over the file.
+ *
+ * @param path  File path.
+ * @param buf   Data to write.
+ * @param count Number of bytes to write.
+ *
+ * @return True on success.
+ *
+ */
+bool write_file(const char *path, const void *buf, size_t count)
+{
+	string tmp = string(path) + ".tmp";
+	
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE,
+	    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		return false;
+	
+	write_long(fd, buf, count);
+	close(fd);
+	
+	if (rename(tmp.c_str(), path) != 0) {
+		unlink(tmp.c_str());
+		return false;
+	}
+	
+	return true;
+}
+
+/** Decode unsigned integer from string span (base 10)
+ *
+ * @param str    String to decode.
+ * @param length Length of the string.
+ * @param val    Decoded integer.
+ *
+ * @return True on success.
+ * @return False on empty or invalid numerical string.
+ *
+ */
+bool span_decode(const char *str, size_t length, uint64_t &val)
+{
+	if (length == 0)
+		return false;
+	
+	val = 0;
+	
+	for (size_t pos = 0; pos < length; pos++) {
+		if ((str[pos] < '0') || (str[pos] > '9'))
+			return false;
+		
+		val = val * 10 + (str[pos] - '0');
+	}
+	
+	return true;
+}
+
+/** Decode network address from string span
+ *
+ * IPv4 addresses are mapped into the IPv6 address
+ * space (::ffff:a.b.c.d).
+ *
+ * @param str    String to decode.
+ * @param length Length of the string.
+ * @param addr   Decoded address (ADDRESS_LENGTH bytes).
+ *
+ * @return True on success.
+ * @return False if the string is not an IPv4 or IPv6 address.
+ *
+ */
+bool address_decode(const char *str, size_t length, uint8_t *addr)
+{
+	char buf[INET6_ADDRSTRLEN];
+	
+	if ((length == 0) || (length >= sizeof(buf)))
+		return false;
+	
+	memcpy(buf, str, length);
+	buf[length] = 0;
+	
+	if (memchr(str, ':', length) != NULL)
+		return (inet_pton(AF_INET6, buf, addr) == 1);
+	
+	memset(addr, 0, 10);
+	addr[10] = 0xff;
+	addr[11] = 0xff;
+	
+	return (inet_pton(AF_INET, buf, addr + 12) == 1);
+}
+
+/** Parse socket address
+ *
+ * The address is either a Unix socket path (absolute
+ * or prefixed by "unix:") or HOST:PORT (IPv6 address
+ * in brackets, empty host for any address).
+ *
+ * @param address Address to parse.
+ * @param type    Socket type (SOCK_STREAM or SOCK_DGRAM).
+ * @param passive Address to listen on.
+ * @param addr    Parsed address.
+ * @param length  Length of the parsed address.
+ * @param error   Error message.
+ *
+ * @return True on success.
+ *
+ */
+bool socket_address(const char *address, int type, bool passive,
+    struct sockaddr_storage &addr, socklen_t &length, string &error)
+{
+	memset(&addr, 0, sizeof(addr));
+	
+	string str = address;
+	if (str.compare(0, 5, "unix:") == 0)
+		str.erase(0, 5);
+	else if (str[0] != '/') {
+		size_t colon = str.rfind(':');
+		if (colon == string::npos) {
+			error = "Missing port in " + str;
+			return false;
+		}
+		
+		string host = str.substr(0, colon);
+		string port = str.substr(colon + 1);
+		
+		if ((host.length() >= 2) && (host[0] == '[') &&
+		    (host[host.length() - 1] == ']'))
+			host = host.substr(1, host.length() - 2);
+		
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = type;
+		hints.ai_flags = passive ? AI_PASSIVE : 0;
+		
+		struct addrinfo *result;
+		int rc = getaddrinfo(host.empty() ? NULL : host.c_str(),
+		    port.c_str(), &hints, &result);
+		if (rc != 0) {
+			error = str + ": " + gai_strerror(rc);
+			return false;
+		}
+		
+		memcpy(&addr, result->ai_addr, result->ai_addrlen);
+		length = result->ai_addrlen;
+		freeaddrinfo(result);
+		return true;
+	}
+	
+	struct sockaddr_un *unix_addr = (struct sockaddr_un *) &addr;
+	if (str.length() >= sizeof(unix_addr->sun_path)) {
+		error = "Socket path too long: " + str;
+		return false;
+	}
+	
+	unix_addr->sun_family = AF_UNIX;
+	strcpy(unix_addr->sun_path, str.c_str());
+	length = sizeof(struct sockaddr_un);
+	return true;
+}